@@ -0,0 +1,375 @@
+#include "escape_walker.cpp"
+#include "llvm_walker.cpp"
+#include "reach_walker.cpp"
+#include "type_walker.cpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Diploma;
+
+// compiler throughput on generated programs of different shapes
+// compile_bench [--json results.json] [--compare baseline.json] [--filter text] [-O0..-O3] [-jN] [--scaling[=N]]
+//               [--quick]
+// --scaling compiles every program with 1, 2, 4... up to N threads, all the cores by default, and shows how codegen
+// speeds up; with more threads than cores they only take turns, so those rows show what the threads cost and
+// nothing about the speedup
+
+struct Program {
+  string name;
+  string source;
+};
+
+// a long list of statements with growing expressions
+string flatProgram(int statements) {
+  stringstream out;
+  out << "v0 := 1\n";
+  for (auto i = 1; i < statements; i++) {
+    out << "v" << i << " := v" << i - 1 << " * 3 + " << i << " - v" << i - 1 << " / 2\n";
+    if (i % 10 == 0)
+      out << "println(v" << i << ", v" << i - 1 << " > " << i << ")\n";
+  }
+  return out.str();
+}
+
+// if-else inside of if-else, 'depth' levels deep, repeated 'count' times
+string nestedProgram(int depth, int count) {
+  stringstream out;
+  for (auto c = 0; c < count; c++) {
+    out << "x" << c << " := " << c << "\n";
+    for (auto d = 0; d < depth; d++) {
+      auto indent = string(d * 4, ' ');
+      out << indent << "if x" << c << " > " << d << "\n";
+      out << indent << "    x" << c << " = x" << c << " + " << d << "\n";
+    }
+    for (auto d = depth - 1; d >= 0; d--) {
+      auto indent = string(d * 4, ' ');
+      out << indent << "    println(x" << c << ")\n";
+      out << indent << "else\n";
+      out << indent << "    x" << c << " = x" << c << " - 1\n";
+    }
+  }
+  return out.str();
+}
+
+// many small functions, each one called a couple of times
+string functionsProgram(int functions) {
+  stringstream out;
+  for (auto i = 0; i < functions; i++) {
+    out << "f" << i << " := (a, b) ->\n";
+    out << "    c := a * " << i + 1 << " + b\n";
+    out << "    if c > " << i << "\n";
+    out << "        c - b\n";
+    out << "    else\n";
+    out << "        c + a\n";
+  }
+  for (auto i = 0; i < functions; i++) {
+    out << "println(f" << i << "(" << i << ", 2), f" << i << "(1, " << i << "))\n";
+  }
+  return out.str();
+}
+
+// huge strings and numbers, interpolation included
+string literalsProgram(int count, int length) {
+  stringstream out;
+  auto text = string();
+  for (auto i = 0; i < length; i++) {
+    text += (char)('a' + i % 26);
+  }
+  out << "s0 := \"" << text << "\"\n";
+  for (auto i = 1; i < count; i++) {
+    out << "s" << i << " := \"" << text << " 's" << i - 1 << "' " << text << "\"\n";
+  }
+  for (auto i = 0; i < count; i++) {
+    out << "n" << i << " := 1_000_000_" << i % 1000 << " + 3.141_592_653_" << i << "\n";
+  }
+  out << "println(s" << count - 1 << ", n" << count - 1 << ")\n";
+  return out.str();
+}
+
+// a big prelude of helpers, in chains of ten, and a script that calls a few of them
+string preludeProgram(int helpers, int used) {
+  stringstream out;
+  for (auto i = 0; i < helpers; i++) {
+    out << "h" << i << " := (a) ->\n";
+    out << "    b := a * " << i + 1 << "\n";
+    out << "    if b > " << i << "\n";
+    if (i % 10 != 0)
+      out << "        b - h" << i - 1 << "(a - 1)\n";
+    else
+      out << "        b - a\n";
+    out << "    else\n";
+    out << "        b + " << i << "\n";
+    out << "k" << i << " := \"helper " << i << "\"\n";
+  }
+  for (auto i = 0; i < used; i++) {
+    out << "println(k" << i * 7 << ", h" << i * 7 << "(" << i << "))\n";
+  }
+  return out.str();
+}
+
+vector<Program> generatePrograms(bool quick) {
+  auto scale = quick ? 1 : 4;
+  return {
+    {"flat/small", flatProgram(100 * scale)},
+    {"flat/large", flatProgram(1000 * scale)},
+    {"nested/depth16", nestedProgram(16, 2 * scale)},
+    {"nested/depth64", nestedProgram(64, scale)},
+    {"functions/small", functionsProgram(10 * scale)},
+    {"functions/large", functionsProgram(100 * scale)},
+    {"literals/short", literalsProgram(8 * scale, 100)},
+    {"literals/long", literalsProgram(4 * scale, 4000)},
+    {"prelude/unused", preludeProgram(100 * scale, 3)},
+  };
+}
+
+const char* phases[] = {"tokenize", "parse", "reachability", "type check", "escape analysis", "codegen", "pipeline"};
+const int phaseCount = sizeof(phases) / sizeof(*phases);
+
+struct Result {
+  string program;
+  string phase;
+  double seconds; // median of the runs
+  double mbPerSecond;
+  double nodesPerSecond;
+  int runs;
+};
+
+// one full compile, seconds spent in every phase
+vector<double> compileOnce(const string& source, int optLevel, int jobs, int64_t& nodes, double& unitSeconds) {
+  using clock = chrono::steady_clock;
+  vector<double> times;
+  auto lap = clock::now();
+  auto next = [&]() {
+    auto now = clock::now();
+    times.emplace_back(chrono::duration<double>(now - lap).count());
+    lap = now;
+  };
+
+  TimeReport::get().clear();
+  stringstream stream(source);
+  auto tokens = performTokenization(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+  next();
+  auto createdBefore = Expr::created;
+  auto syntaxTree = parseSyntaxTree(tokens);
+  nodes = Expr::created - createdBefore;
+  next();
+  {
+    ReachWalker reach;
+    reach.Do(syntaxTree);
+    syntaxTree = reach.reachable;
+  }
+  next();
+  TypeWalker().Do(syntaxTree);
+  next();
+  EscapeWalker().Do(syntaxTree);
+  next();
+  {
+    InterpreterWalker codegen(optLevel, "");
+    codegen.useThreads(jobs);
+    codegen.Do(syntaxTree);
+  } // the module is finished in the destructor
+  next();
+  unitSeconds = TimeReport::get().total("codegen units") / 1e6;
+
+  auto total = 0.0;
+  for (auto t : times) {
+    total += t;
+  }
+  times.emplace_back(total);
+  return times;
+}
+
+vector<Result> measure(const Program& program, int optLevel, int jobs, bool quick, double& unitSeconds) {
+  auto minTime = quick ? 0.05 : 0.5;
+  auto maxRuns = quick ? 3 : 30;
+  vector<vector<double>> samples(phaseCount);
+  vector<double> unitSamples;
+  auto nodes = (int64_t)0;
+  auto spent = 0.0;
+  auto runs = 0;
+  while (runs < maxRuns && (spent < minTime || runs < 3)) {
+    auto units = 0.0;
+    auto times = compileOnce(program.source, optLevel, jobs, nodes, units);
+    for (auto i = 0; i < phaseCount; i++) {
+      samples[i].emplace_back(times[i]);
+    }
+    unitSamples.emplace_back(units);
+    spent += times.back();
+    runs++;
+  }
+
+  std::sort(unitSamples.begin(), unitSamples.end());
+  unitSeconds = unitSamples[unitSamples.size() / 2];
+  vector<Result> results;
+  auto megabytes = program.source.size() / 1e6;
+  for (auto i = 0; i < phaseCount; i++) {
+    auto& s = samples[i];
+    std::sort(s.begin(), s.end());
+    auto median = s[s.size() / 2];
+    auto seconds = std::max(median, 1e-9);
+    results.push_back({program.name, phases[i], median, megabytes / seconds, nodes / seconds, runs});
+  }
+  return results;
+}
+
+string toJson(const Result& r) {
+  char line[512];
+  snprintf(
+    line, sizeof(line),
+    "{\"program\": \"%s\", \"phase\": \"%s\", \"seconds\": %.9f, \"mb_per_s\": %.3f, \"nodes_per_s\": %.1f, "
+    "\"runs\": %d}",
+    r.program.c_str(), r.phase.c_str(), r.seconds, r.mbPerSecond, r.nodesPerSecond, r.runs
+  );
+  return line;
+}
+
+// reads back what toJson writes, one result per line
+vector<Result> readJson(string path) {
+  vector<Result> results;
+  ifstream in(path);
+  string line;
+  while (getline(in, line)) {
+    char program[128], phase[64];
+    Result r;
+    auto fields = sscanf(
+      line.c_str(),
+      " {\"program\": \"%127[^\"]\", \"phase\": \"%63[^\"]\", \"seconds\": %lf, \"mb_per_s\": %lf, "
+      "\"nodes_per_s\": %lf, \"runs\": %d}",
+      program, phase, &r.seconds, &r.mbPerSecond, &r.nodesPerSecond, &r.runs
+    );
+    if (fields == 6) {
+      r.program = program;
+      r.phase = phase;
+      results.emplace_back(r);
+    }
+  }
+  return results;
+}
+
+int main(int argc, char** argv) {
+  string jsonPath = "", comparePath = "", filter = "";
+  auto optLevel = 0;
+  auto jobs = 1;
+  auto quick = false, scaling = false;
+  auto maxJobs = (int)std::max(1u, thread::hardware_concurrency());
+  for (auto i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (arg == "--compare" && i + 1 < argc) {
+      comparePath = argv[++i];
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--quick") {
+      quick = true;
+    } else if (arg == "--scaling") {
+      scaling = true;
+    } else if (arg.rfind("--scaling=", 0) == 0) {
+      scaling = true;
+      maxJobs = std::max(1, atoi(arg.c_str() + 10));
+    } else if (arg.size() > 2 && arg.rfind("-j", 0) == 0 && isdigit(arg[2])) {
+      jobs = std::max(1, atoi(arg.c_str() + 2));
+    } else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && isdigit(arg[2])) {
+      optLevel = arg[2] - '0';
+    } else {
+      cout << "what is '" << arg << "'?\n";
+      return 1;
+    }
+  }
+
+  auto jobCounts = vector<int>{jobs};
+  if (scaling) {
+    jobCounts.clear();
+    for (auto j = 1; j < maxJobs; j *= 2) {
+      jobCounts.emplace_back(j);
+    }
+    jobCounts.emplace_back(maxJobs);
+  }
+
+  auto baseline = comparePath.empty() ? vector<Result>() : readJson(comparePath);
+  auto regressions = 0;
+  vector<Result> all;
+  // the walkers talk to cout, only the table is interesting here
+  stringstream silenced;
+  auto coutBuffer = cout.rdbuf();
+
+  printf("%-18s %-16s %12s %10s %14s %8s\n", "program", "phase", "ms", "MB/s", "nodes/s", "vs base");
+  vector<Result> codegenTimes; // of every thread count, for the scaling table
+  vector<pair<int, double>> unitTimes; // the thread count and the seconds in "codegen units" of every one
+  for (auto& generated : generatePrograms(quick)) {
+    if (generated.name.find(filter) == string::npos)
+      continue;
+    for (auto j : jobCounts) {
+      auto program = generated;
+      if (scaling)
+        program.name += " -j" + to_string(j);
+      cout.rdbuf(silenced.rdbuf());
+      auto unitSeconds = 0.0;
+      auto results = measure(program, optLevel, j, quick, unitSeconds);
+      unitTimes.emplace_back(j, unitSeconds);
+      cout.rdbuf(coutBuffer);
+      silenced.str("");
+
+      for (auto& r : results) {
+        if (r.phase == "codegen")
+          codegenTimes.emplace_back(r);
+        auto change = string("");
+        for (auto& b : baseline) {
+          if (b.program == r.program && b.phase == r.phase && b.seconds > 0) {
+            auto ratio = r.seconds / b.seconds;
+            char text[32];
+            snprintf(text, sizeof(text), "%+.1f%%", (ratio - 1) * 100);
+            change = text;
+            if (ratio > 1.10 && r.seconds > 1e-4) { // smaller ones are noise
+              change += " !";
+              regressions++;
+            }
+          }
+        }
+        printf(
+          "%-18s %-16s %12.3f %10.2f %14.0f %8s\n", r.program.c_str(), r.phase.c_str(), r.seconds * 1000,
+          r.mbPerSecond, r.nodesPerSecond, change.c_str()
+        );
+        all.emplace_back(r);
+      }
+    }
+  }
+
+  if (scaling) {
+    auto cores = (int)std::max(1u, thread::hardware_concurrency());
+    printf(
+      "\ncodegen on more threads, -O%d, %d cores\n%-26s %12s %8s %8s\n", optLevel, cores, "program", "ms", "speedup",
+      "units %"
+    );
+    auto single = 0.0;
+    for (auto i = 0; i < codegenTimes.size(); i++) {
+      auto& r = codegenTimes[i];
+      auto [jobs, units] = unitTimes[i];
+      if (jobs == 1)
+        single = r.seconds;
+      printf(
+        "%-26s %12.3f %7.2fx %7.1f%%%s\n", r.program.c_str(), r.seconds * 1000, single / std::max(r.seconds, 1e-9),
+        100 * units / std::max(r.seconds, 1e-9), jobs > cores ? "  more threads than cores" : ""
+      );
+    }
+  }
+
+  if (!jsonPath.empty()) {
+    ofstream out(jsonPath);
+    out << "[\n";
+    for (auto i = 0; i < all.size(); i++) {
+      out << "  " << toJson(all[i]) << (i + 1 < all.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+  }
+  if (regressions > 0)
+    printf("%d results are more than 10%% slower than the baseline\n", regressions);
+  return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+#include "runtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// the map of the runtime against std::unordered_map on the same keys, in the same order
+// map_bench [--json results.json] [--filter text] [--quick]
+
+struct Result {
+  string workload;
+  string table;
+  double seconds;
+  int64_t operations;
+};
+
+struct Keys {
+  vector<int32_t> ints;
+  vector<double> reals;
+  vector<Str> strs;
+  vector<string> texts; // the same as strs, for std::unordered_map
+};
+
+// every key twice: the first half is put, the second half is looked up and missed
+Keys makeKeys(int count, int textSize) {
+  Keys keys;
+  mt19937_64 random(42);
+  for (auto i = 0; i < count * 2; i++) {
+    keys.ints.emplace_back((int32_t)random());
+    keys.reals.emplace_back((double)(random() >> 11) / 1024);
+    auto text = to_string(random());
+    text.resize(textSize, 'x');
+    Str value;
+    str_format(&value, "%s", text.c_str());
+    keys.strs.emplace_back(value);
+    keys.texts.emplace_back(text);
+  }
+  return keys;
+}
+
+// the median of a few runs, every run builds the table again
+double timeIt(const function<int64_t()>& run, int runs, int64_t& checksum) {
+  vector<double> times;
+  for (auto i = 0; i < runs; i++) {
+    auto start = chrono::steady_clock::now();
+    checksum += run();
+    times.emplace_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+// put all, find all twice (hits, then misses), remove all
+template <typename Key> int64_t runtimeRound(const vector<Key>& keys, int32_t keyKind) {
+  auto count = keys.size() / 2;
+  auto map = map_new(keyKind, sizeof(int64_t));
+  int64_t sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    if constexpr (is_same_v<Key, Str>)
+      *(int64_t*)map_put_str(map, &keys[i]) = i;
+    else if constexpr (is_same_v<Key, double>)
+      *(int64_t*)map_put_f64(map, keys[i]) = i;
+    else
+      *(int64_t*)map_put_i32(map, keys[i]) = i;
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    void* slot;
+    if constexpr (is_same_v<Key, Str>)
+      slot = map_find_str(map, &keys[i]);
+    else if constexpr (is_same_v<Key, double>)
+      slot = map_find_f64(map, keys[i]);
+    else
+      slot = map_find_i32(map, keys[i]);
+    sum += slot != nullptr ? *(int64_t*)slot : -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if constexpr (is_same_v<Key, Str>)
+      sum += map_remove_str(map, &keys[i]);
+    else if constexpr (is_same_v<Key, double>)
+      sum += map_remove_f64(map, keys[i]);
+    else
+      sum += map_remove_i32(map, keys[i]);
+  }
+  sum += map_size(map);
+  ref_release(map);
+  return sum;
+}
+
+template <typename Key> int64_t standardRound(const vector<Key>& keys) {
+  auto count = keys.size() / 2;
+  unordered_map<Key, int64_t> map;
+  int64_t sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    map[keys[i]] = i;
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto found = map.find(keys[i]);
+    sum += found != map.end() ? found->second : -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    sum += map.erase(keys[i]);
+  }
+  return sum + map.size();
+}
+
+string toJson(const Result& r) {
+  char line[256];
+  snprintf(
+    line, sizeof(line), "{\"workload\": \"%s\", \"table\": \"%s\", \"seconds\": %.9f, \"ops_per_s\": %.1f}",
+    r.workload.c_str(), r.table.c_str(), r.seconds, r.operations / max(r.seconds, 1e-9)
+  );
+  return line;
+}
+
+int main(int argc, char** argv) {
+  string jsonPath = "", filter = "";
+  auto quick = false;
+  for (auto i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--quick") {
+      quick = true;
+    } else {
+      cout << "what is '" << arg << "'?\n";
+      return 1;
+    }
+  }
+
+  auto runs = quick ? 3 : 9;
+  vector<int> sizes = quick ? vector<int>{1000, 100000} : vector<int>{1000, 100000, 1000000};
+  vector<Result> all;
+  int64_t checksum = 0;
+  printf("%-20s %14s %14s %10s\n", "workload", "runtime ms", "std ms", "speedup");
+  for (auto size : sizes) {
+    auto shortKeys = makeKeys(size, 12);
+    auto longKeys = makeKeys(size, 40);
+    // a put, two finds and a remove for every key that is put
+    auto operations = (int64_t)size * 4;
+    vector<tuple<string, function<int64_t()>, function<int64_t()>>> workloads = {
+      {"i32", [&] { return runtimeRound(shortKeys.ints, MAP_I32); }, [&] { return standardRound(shortKeys.ints); }},
+      {"f64", [&] { return runtimeRound(shortKeys.reals, MAP_F64); }, [&] { return standardRound(shortKeys.reals); }},
+      {"str short", [&] { return runtimeRound(shortKeys.strs, MAP_STR); },
+       [&] { return standardRound(shortKeys.texts); }},
+      {"str long", [&] { return runtimeRound(longKeys.strs, MAP_STR); }, [&] { return standardRound(longKeys.texts); }},
+    };
+    for (auto& [name, runtime, standard] : workloads) {
+      auto workload = name + " " + to_string(size);
+      if (workload.find(filter) == string::npos)
+        continue;
+      auto runtimeSeconds = timeIt(runtime, runs, checksum);
+      auto standardSeconds = timeIt(standard, runs, checksum);
+      all.push_back({workload, "runtime", runtimeSeconds, operations});
+      all.push_back({workload, "std::unordered_map", standardSeconds, operations});
+      printf(
+        "%-20s %14.3f %14.3f %9.2fx\n", workload.c_str(), runtimeSeconds * 1000, standardSeconds * 1000,
+        standardSeconds / max(runtimeSeconds, 1e-9)
+      );
+    }
+  }
+
+  if (!jsonPath.empty()) {
+    ofstream out(jsonPath);
+    out << "[\n";
+    for (auto i = 0; i < all.size(); i++) {
+      out << "  " << toJson(all[i]) << (i + 1 < all.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+  }
+  static volatile int64_t sink;
+  sink = checksum; // the rounds can't be optimized away
+  return 0;
+}
@@ -0,0 +1,330 @@
+#include "server.hpp"
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Diploma;
+using namespace llvm;
+
+// how fast the compiled code is: every name.txt of the programs directory goes through the whole pipeline
+// at -O0..-O3 and runs next to name.c built with cc -O2, both have to print the same
+// program_bench [--json results.json] [--compare baseline.json] [--filter text] [--quick]
+//               [--programs=bench/programs] [--runtime=libdiploma_runtime.a]
+// the ratios to C are compared with the baseline, so a slower machine doesn't look like a regression; the peak
+// memory of both is shown too, a program that keeps what it should free grows far past its C version
+
+struct Result {
+  string program;
+  int optLevel;
+  double seconds; // median of the runs
+  double cSeconds;
+  double ratio;
+  bool sameOutput;
+  double megabytes; // the max RSS of one run
+  double cMegabytes;
+};
+
+// "2>&1" of the command, and its exit code
+int runCommand(string command, string& output) {
+#ifdef _WIN32
+  return -1;
+#else
+  auto pipe = popen((command + " 2>&1").c_str(), "r");
+  if (pipe == nullptr)
+    return -1;
+  char chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+    output.append(chunk, count);
+  }
+  auto status = pclose(pipe);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+}
+
+// the median wall time, the output goes nowhere so the terminal doesn't slow it down
+double timeRuns(const string& path, int runs) {
+  vector<double> times;
+  for (auto i = 0; i < runs; i++) {
+    auto start = chrono::steady_clock::now();
+    if (system((path + " > /dev/null").c_str()) != 0)
+      return -1;
+    times.emplace_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+#ifndef _WIN32
+// a child counts the heap of its parent in its max RSS, so the measured runs are started by a copy of this
+// process made before even the static constructors of LLVM fill it, it gets their paths and sends back the MB
+FILE* launcherPaths = nullptr;
+FILE* launcherResults = nullptr;
+
+double runForPeak(const char* path) {
+  auto pid = fork();
+  if (pid == 0) {
+    if (freopen("/dev/null", "w", stdout) != nullptr)
+      execl(path, path, (char*)nullptr);
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0); // bytes there
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+__attribute__((constructor(101))) void startLauncher() {
+  int paths[2], results[2];
+  if (pipe(paths) != 0 || pipe(results) != 0)
+    return;
+  auto pid = fork();
+  if (pid == 0) {
+    close(paths[1]);
+    close(results[0]);
+    auto in = fdopen(paths[0], "r");
+    auto out = fdopen(results[1], "w");
+    char path[4096];
+    while (fgets(path, sizeof(path), in) != nullptr) { // until this process is gone
+      path[strcspn(path, "\n")] = '\0';
+      fprintf(out, "%f\n", runForPeak(path));
+      fflush(out);
+    }
+    _exit(0);
+  }
+  close(paths[0]);
+  close(results[1]);
+  if (pid > 0) {
+    launcherPaths = fdopen(paths[1], "w");
+    launcherResults = fdopen(results[0], "r");
+  }
+}
+#endif
+
+// the max RSS of one run in MB, -1 if it can't be measured
+double peakMegabytes(const string& path) {
+  auto megabytes = -1.0;
+#ifndef _WIN32
+  if (launcherPaths == nullptr || fprintf(launcherPaths, "%s\n", path.c_str()) < 0 || fflush(launcherPaths) != 0)
+    return -1;
+  if (fscanf(launcherResults, "%lf", &megabytes) != 1)
+    return -1;
+#endif
+  return megabytes;
+}
+
+string temporaryPath(string suffix) {
+  SmallString<128> path;
+  sys::fs::createTemporaryFile("program_bench", suffix, path);
+  return path.str().str();
+}
+
+// like diploma-client --run does it: the object from the compile server code, linked with the runtime
+bool buildProgram(const string& source, int optLevel, const string& runtimePath, const string& path) {
+  CompileRequest request;
+  request.mode = "object";
+  request.optLevel = optLevel;
+  request.source = source;
+  auto reply = compile(request, runtimePath);
+  if (reply.status != 0) {
+    cout << reply.diagnostics;
+    return false;
+  }
+  auto objectPath = temporaryPath("o");
+  {
+    ofstream out(objectPath, ios::binary);
+    out << reply.output;
+  }
+  string linkOutput;
+  auto status = runCommand("cc " + objectPath + " " + runtimePath + " -lm -o " + path, linkOutput);
+  sys::fs::remove(objectPath);
+  if (status != 0)
+    cout << "can't link the program:\n" << linkOutput;
+  return status == 0;
+}
+
+string toJson(const Result& r) {
+  char line[512];
+  snprintf(
+    line, sizeof(line),
+    "{\"program\": \"%s\", \"opt\": %d, \"seconds\": %.9f, \"c_seconds\": %.9f, \"ratio\": %.4f, "
+    "\"same_output\": %s, \"mb\": %.3f, \"c_mb\": %.3f}",
+    r.program.c_str(), r.optLevel, r.seconds, r.cSeconds, r.ratio, r.sameOutput ? "true" : "false", r.megabytes,
+    r.cMegabytes
+  );
+  return line;
+}
+
+// reads back what toJson writes, one result per line, older ones without the memory too
+vector<Result> readJson(string path) {
+  vector<Result> results;
+  ifstream in(path);
+  string line;
+  while (getline(in, line)) {
+    char program[128], same[8];
+    Result r;
+    r.megabytes = r.cMegabytes = -1;
+    auto fields = sscanf(
+      line.c_str(),
+      " {\"program\": \"%127[^\"]\", \"opt\": %d, \"seconds\": %lf, \"c_seconds\": %lf, \"ratio\": %lf, "
+      "\"same_output\": %7[a-z], \"mb\": %lf, \"c_mb\": %lf}",
+      program, &r.optLevel, &r.seconds, &r.cSeconds, &r.ratio, same, &r.megabytes, &r.cMegabytes
+    );
+    if (fields >= 6) {
+      r.program = program;
+      r.sameOutput = string(same) == "true";
+      results.emplace_back(r);
+    }
+  }
+  return results;
+}
+
+int main(int argc, char** argv) {
+  string jsonPath = "", comparePath = "", filter = "";
+  string programsDir = "bench/programs", runtimePath = "";
+  auto quick = false;
+  for (auto i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (arg == "--compare" && i + 1 < argc) {
+      comparePath = argv[++i];
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--quick") {
+      quick = true;
+    } else if (arg.rfind("--programs=", 0) == 0) {
+      programsDir = arg.substr(11);
+    } else if (arg.rfind("--runtime=", 0) == 0) {
+      runtimePath = arg.substr(10);
+    } else {
+      cout << "what is '" << arg << "'?\n";
+      return 1;
+    }
+  }
+  if (runtimePath.empty()) { // built next to it
+    SmallString<128> path(sys::path::parent_path(sys::fs::getMainExecutable(argv[0], (void*)&main)));
+    sys::path::append(path, "libdiploma_runtime.a");
+    runtimePath = path.str().str();
+  }
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  vector<string> names;
+  error_code error;
+  for (sys::fs::directory_iterator it(programsDir, error), end; it != end && !error; it.increment(error)) {
+    auto path = it->path();
+    if (sys::path::extension(path) == ".txt" && sys::fs::exists(path.substr(0, path.size() - 4) + ".c"))
+      names.emplace_back(sys::path::stem(path).str());
+  }
+  if (error || names.empty()) {
+    cout << "no programs with a C version in " << programsDir << "\n";
+    return 1;
+  }
+  std::sort(names.begin(), names.end());
+
+  auto runs = quick ? 3 : 7;
+  auto optLevels = quick ? vector<int>{0, 2} : vector<int>{0, 1, 2, 3};
+  auto baseline = comparePath.empty() ? vector<Result>() : readJson(comparePath);
+  auto regressions = 0, growths = 0, failures = 0;
+  vector<Result> all;
+  auto programPath = temporaryPath("");
+  auto cPath = temporaryPath("");
+
+  printf("%-14s %4s %12s %12s %8s %8s %8s %8s\n", "program", "opt", "ms", "C ms", "ratio", "vs base", "MB", "C MB");
+  for (auto& name : names) {
+    if (name.find(filter) == string::npos)
+      continue;
+    auto base = programsDir + "/" + name;
+    ifstream in(base + ".txt");
+    stringstream source;
+    source << in.rdbuf();
+
+    string cOutput, buildOutput;
+    if (runCommand("cc -O2 -ffp-contract=off " + base + ".c -lm -o " + cPath, buildOutput) != 0) {
+      cout << "can't build " << base << ".c:\n" << buildOutput;
+      failures++;
+      continue;
+    }
+    runCommand(cPath, cOutput);
+    auto cSeconds = timeRuns(cPath, runs);
+    auto cMegabytes = peakMegabytes(cPath);
+
+    for (auto optLevel : optLevels) {
+      string output;
+      if (!buildProgram(source.str(), optLevel, runtimePath, programPath) || runCommand(programPath, output) != 0) {
+        cout << name << " -O" << optLevel << " doesn't build or run\n" << output;
+        failures++;
+        continue;
+      }
+      auto seconds = timeRuns(programPath, runs);
+      auto ratio = seconds / max(cSeconds, 1e-9);
+      Result r = {name, optLevel, seconds, cSeconds, ratio, output == cOutput, peakMegabytes(programPath), cMegabytes};
+      if (!r.sameOutput)
+        failures++;
+
+      auto change = string(r.sameOutput ? "" : "output!");
+      for (auto& b : baseline) {
+        if (b.program == r.program && b.optLevel == r.optLevel && b.ratio > 0 && r.sameOutput) {
+          char text[32];
+          snprintf(text, sizeof(text), "%+.1f%%", (r.ratio / b.ratio - 1) * 100);
+          change = text;
+          if (r.ratio > b.ratio * 1.10 && r.seconds > 0.01) { // shorter runs are mostly starting the process
+            change += " !";
+            regressions++;
+          }
+          if (b.megabytes > 0 && r.megabytes > b.megabytes * 1.5 + 1) { // a few MB move with the allocator
+            change += " mem!";
+            growths++;
+          }
+        }
+      }
+      printf(
+        "%-14s %4s %12.3f %12.3f %7.2fx %8s %8.1f %8.1f\n", name.c_str(), ("-O" + to_string(optLevel)).c_str(),
+        seconds * 1000, cSeconds * 1000, r.ratio, change.c_str(), r.megabytes, cMegabytes
+      );
+      all.emplace_back(r);
+    }
+  }
+  sys::fs::remove(programPath);
+  sys::fs::remove(cPath);
+
+  if (!jsonPath.empty()) {
+    ofstream out(jsonPath);
+    out << "[\n";
+    for (auto i = 0; i < all.size(); i++) {
+      out << "  " << toJson(all[i]) << (i + 1 < all.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+  }
+  if (failures > 0)
+    printf("%d builds don't compile, don't run or print something else than their C version\n", failures);
+  if (regressions > 0)
+    printf("%d ratios to C are more than 10%% worse than the baseline\n", regressions);
+  if (growths > 0)
+    printf("%d programs need more than half again the memory of the baseline\n", growths);
+  return regressions > 0 || growths > 0 || failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+int main(void) {
+  int size = 800, limit = 50, inside = 0;
+  for (int y = 0; y < size; y++) {
+    double ci = 2.0 * y / size - 1.0;
+    for (int x = 0; x < size; x++) {
+      double cr = 2.0 * x / size - 1.5;
+      double zr = 0.0, zi = 0.0;
+      int i = 0;
+      while (i < limit) {
+        double t = zr * zr - zi * zi + cr;
+        zi = 2.0 * zr * zi + ci;
+        zr = t;
+        if (zr * zr + zi * zi > 4.0)
+          i = limit + 1;
+        else
+          i++;
+      }
+      if (i == limit)
+        inside++;
+    }
+  }
+  printf("%d\n", inside);
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+
+typedef struct {
+  double x, y, z, vx, vy, vz, mass;
+} Body;
+
+#define PI 3.141592653589793
+#define SOLAR_MASS (4.0 * PI * PI)
+#define DAYS_PER_YEAR 365.24
+#define BODIES 5
+
+// Newton's method from 1, the same steps as the language version takes
+static double root(double value) {
+  double guess = 1.0;
+  for (int i = 0; i < 30; i++) {
+    guess = (guess + value / guess) / 2.0;
+  }
+  return guess;
+}
+
+static void interact(Body* a, Body* b, double dt) {
+  double dx = a->x - b->x;
+  double dy = a->y - b->y;
+  double dz = a->z - b->z;
+  double squared = dx * dx + dy * dy + dz * dz;
+  double distance = root(squared);
+  double magnitude = dt / (squared * distance);
+  a->vx = a->vx - dx * b->mass * magnitude;
+  a->vy = a->vy - dy * b->mass * magnitude;
+  a->vz = a->vz - dz * b->mass * magnitude;
+  b->vx = b->vx + dx * a->mass * magnitude;
+  b->vy = b->vy + dy * a->mass * magnitude;
+  b->vz = b->vz + dz * a->mass * magnitude;
+}
+
+static double energy(const Body* bodies) {
+  double e = 0.0;
+  for (int i = 0; i < BODIES; i++) {
+    const Body* b = &bodies[i];
+    e += 0.5 * b->mass * (b->vx * b->vx + b->vy * b->vy + b->vz * b->vz);
+  }
+  for (int i = 0; i < BODIES; i++) {
+    for (int j = i + 1; j < BODIES; j++) {
+      double dx = bodies[i].x - bodies[j].x;
+      double dy = bodies[i].y - bodies[j].y;
+      double dz = bodies[i].z - bodies[j].z;
+      e -= bodies[i].mass * bodies[j].mass / root(dx * dx + dy * dy + dz * dz);
+    }
+  }
+  return e;
+}
+
+int main(void) {
+  Body bodies[BODIES] = {
+    {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, SOLAR_MASS},
+    {4.84143144246472090, -1.16032004402742839, -0.103622044471123109, 0.00166007664274403694 * DAYS_PER_YEAR,
+     0.00769901118419740425 * DAYS_PER_YEAR, -0.0000690460016972063023 * DAYS_PER_YEAR,
+     0.000954791938424326609 * SOLAR_MASS},
+    {8.34336671824457987, 4.12479856412430479, -0.403523417114321381, -0.00276742510726862411 * DAYS_PER_YEAR,
+     0.00499852801234917238 * DAYS_PER_YEAR, 0.0000230417297573763929 * DAYS_PER_YEAR,
+     0.000285885980666130812 * SOLAR_MASS},
+    {12.8943695621391310, -15.1111514016986312, -0.223307578892655734, 0.00296460137564761618 * DAYS_PER_YEAR,
+     0.00237847173959480950 * DAYS_PER_YEAR, -0.0000296589568540237556 * DAYS_PER_YEAR,
+     0.0000436624404335156298 * SOLAR_MASS},
+    {15.3796971148509165, -25.9193146099879641, 0.179258772950371181, 0.00268067772490389322 * DAYS_PER_YEAR,
+     0.00162824170038242295 * DAYS_PER_YEAR, -0.0000951592254519715870 * DAYS_PER_YEAR,
+     0.0000515138902046611451 * SOLAR_MASS},
+  };
+
+  // the sun moves against the planets, so the system stays in place
+  double px = 0.0, py = 0.0, pz = 0.0;
+  for (int i = 1; i < BODIES; i++) {
+    px += bodies[i].vx * bodies[i].mass;
+    py += bodies[i].vy * bodies[i].mass;
+    pz += bodies[i].vz * bodies[i].mass;
+  }
+  bodies[0].vx = 0.0 - px / SOLAR_MASS;
+  bodies[0].vy = 0.0 - py / SOLAR_MASS;
+  bodies[0].vz = 0.0 - pz / SOLAR_MASS;
+
+  printf("%f\n", energy(bodies));
+  for (int step = 0; step < 200000; step++) {
+    for (int i = 0; i < BODIES; i++) {
+      for (int j = i + 1; j < BODIES; j++) {
+        interact(&bodies[i], &bodies[j], 0.01);
+      }
+    }
+    for (int i = 0; i < BODIES; i++) {
+      bodies[i].x = bodies[i].x + 0.01 * bodies[i].vx;
+      bodies[i].y = bodies[i].y + 0.01 * bodies[i].vy;
+      bodies[i].z = bodies[i].z + 0.01 * bodies[i].vz;
+    }
+  }
+  printf("%f\n", energy(bodies));
+  return 0;
+}
@@ -0,0 +1,8 @@
+#include <stdio.h>
+
+int main(void) {
+  for (int i = 0; i < 1000000; i++) {
+    printf("%d, %d, %f, %d\n", i, i * 3, (double)i / 7.0, i > 500000);
+  }
+  return 0;
+}
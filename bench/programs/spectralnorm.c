@@ -0,0 +1,49 @@
+#include <stdio.h>
+
+#define N 1000
+
+static double a(int i, int j) {
+  return 1.0 / (double)((i + j) * (i + j + 1) / 2 + i + 1);
+}
+
+// out = A * v, or A transposed * v
+static void multiply(const double* v, double* out, int transposed) {
+  for (int i = 0; i < N; i++) {
+    double sum = 0.0;
+    for (int j = 0; j < N; j++) {
+      sum = sum + (transposed ? a(j, i) : a(i, j)) * v[j];
+    }
+    out[i] = sum;
+  }
+}
+
+static void multiplyBoth(const double* v, double* out, double* temporary) {
+  multiply(v, temporary, 0);
+  multiply(temporary, out, 1);
+}
+
+static double root(double value) {
+  double guess = 1.0;
+  for (int i = 0; i < 30; i++) {
+    guess = (guess + value / guess) / 2.0;
+  }
+  return guess;
+}
+
+int main(void) {
+  static double u[N], v[N], temporary[N];
+  for (int i = 0; i < N; i++) {
+    u[i] = 1.0;
+  }
+  for (int round = 0; round < 10; round++) {
+    multiplyBoth(u, v, temporary);
+    multiplyBoth(v, u, temporary);
+  }
+  double vBv = 0.0, vv = 0.0;
+  for (int i = 0; i < N; i++) {
+    vBv = vBv + u[i] * v[i];
+    vv = vv + v[i] * v[i];
+  }
+  printf("%f\n", root(vBv / vv) * 1000000000.0);
+  return 0;
+}
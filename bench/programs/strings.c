@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a new string for every join, the caller frees the one it replaces like the language does
+static char* join(const char* left, const char* right) {
+  size_t leftSize = strlen(left), rightSize = strlen(right);
+  char* result = malloc(leftSize + rightSize + 1);
+  memcpy(result, left, leftSize);
+  memcpy(result + leftSize, right, rightSize + 1);
+  return result;
+}
+
+int main(void) {
+  int same = 0;
+  char* previous = join("", "");
+  char piece[32];
+  for (int line = 0; line < 300000; line++) {
+    snprintf(piece, sizeof(piece), "line %d:", line);
+    char* text = join(piece, "");
+    for (int i = 0; i < 20; i++) {
+      snprintf(piece, sizeof(piece), " %d", line + i);
+      char* joined = join(text, piece);
+      free(text);
+      text = joined;
+    }
+    if (strcmp(text, previous) == 0)
+      same++;
+    if (line / 10000 * 10000 == line)
+      printf("%s\n", text);
+    free(previous);
+    previous = text;
+  }
+  printf("%d\n", same);
+  free(previous);
+  return 0;
+}
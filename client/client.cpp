@@ -0,0 +1,102 @@
+#include "protocol.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Diploma;
+
+// takes the place of the compiler on the command line, the work is done by a running 'diploma --serve'
+// diploma-client [input] [-O0..-O3] [--time-report] [--cache[=dir]] [--emit=ir|object] [--run] [-o file]
+//                [--socket=path] [--stop]
+int main(int argc, char** argv) {
+  string inputPath = "input.txt";
+  string outputPath = "";
+  string socketPath = defaultSocketPath();
+  CompileRequest request;
+  for (auto i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--time-report") {
+      request.timeReport = true;
+    } else if (arg == "--cache") {
+      request.cacheDir = "diploma-cache";
+    } else if (arg.rfind("--cache=", 0) == 0) {
+      request.cacheDir = arg.substr(8);
+    } else if (arg == "--emit=ir" || arg == "--emit=object") {
+      request.mode = arg.substr(7);
+    } else if (arg == "--run") {
+      request.mode = "run";
+    } else if (arg == "--stop") {
+      request.mode = "stop";
+    } else if (arg == "-o" && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (arg.rfind("--socket=", 0) == 0) {
+      socketPath = arg.substr(9);
+    } else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && isdigit(arg[2])) {
+      request.optLevel = arg[2] - '0';
+    } else if (arg[0] != '-') {
+      inputPath = arg;
+    } else {
+      cout << "what is '" << arg << "'?\n";
+    }
+  }
+  if (outputPath.empty())
+    outputPath = request.mode == "object" ? "output.o" : "output.ir";
+
+#ifdef _WIN32
+  cout << "the compile server needs Unix sockets\n";
+  return 1;
+#else
+  if (!request.cacheDir.empty() && request.cacheDir[0] != '/') { // relative to us, not to the server
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory)) != nullptr)
+      request.cacheDir = string(directory) + "/" + request.cacheDir;
+  }
+  if (request.mode != "stop") {
+    ifstream input(inputPath, ios::binary);
+    if (!input) {
+      cout << "can't read " << inputPath << "\n";
+      return 1;
+    }
+    stringstream source;
+    source << input.rdbuf();
+    request.source = source.str();
+  }
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+  auto server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(server, (sockaddr*)&address, sizeof(address)) != 0) {
+    cout << "no compile server on " << socketPath << ", start one with 'diploma --serve'\n";
+    return 1;
+  }
+
+  CompileReply reply;
+  if (!sendRequest(server, request) || !receiveReply(server, reply)) {
+    cout << "the compile server went away\n";
+    return 1;
+  }
+  close(server);
+
+  cout << reply.diagnostics;
+  if (request.mode == "run") {
+    cout << reply.output << flush;
+    return reply.status;
+  }
+  if (request.mode != "stop") {
+    ofstream output(outputPath, ios::binary);
+    output << reply.output;
+  }
+  cout << "done." << endl;
+  return reply.status;
+#endif
+}
@@ -49,6 +49,17 @@ enum Grapheme {
   IF,
   ELSE,
   RET,
+  TAIL,
+  MEMO,
+  YIELD,
+
+  TYPE,
+
+  REF,   // ref, ref32, ref64
+  DEREF,
+  UNIQ,
+  SHAR,
+  WEAK,
 };
 
 } // namespace Diploma
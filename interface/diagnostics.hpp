@@ -0,0 +1,14 @@
+#ifndef DIAGNOSTICS
+#define DIAGNOSTICS
+
+#include <ostream>
+
+namespace Diploma {
+
+// where the compiler complains about the program: stdout, or the reply of the compile server
+std::ostream& diagnostics();
+void setDiagnostics(std::ostream* out); // for the calling thread, nullptr goes back to stdout
+
+} // namespace Diploma
+
+#endif // DIAGNOSTICS
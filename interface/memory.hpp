@@ -0,0 +1,28 @@
+#ifndef MEMORY
+#define MEMORY
+
+#include <cstdint>
+
+namespace Diploma {
+
+// what operator new and delete did on the calling thread, they are replaced to count it
+struct MemoryCounters {
+  int64_t allocations;
+  int64_t allocated; // bytes asked for
+  int64_t frees;
+  int64_t freed;
+  int64_t peak;      // the most bytes that were live at once since the last resetPeak
+};
+
+MemoryCounters memoryCounters();
+int64_t resetPeak(int64_t live); // starts the peak over from live, returns the old one
+int64_t peakResidentBytes();     // of the whole process, as the system sees it
+
+// work a thread did for another one, like the units of -jN: what it allocated and freed since 'since' is taken
+// out of its counters and added to the ones of the thread it was done for, frees of the other thread then match
+MemoryCounters takeMemory(const MemoryCounters& since);
+void addMemory(const MemoryCounters& taken);
+
+} // namespace Diploma
+
+#endif // MEMORY
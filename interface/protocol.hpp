@@ -0,0 +1,34 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <string>
+
+namespace Diploma {
+
+// what diploma-client asks the compile server for, the same options the compiler takes
+struct CompileRequest {
+  std::string mode = "ir"; // ir, object, run, or stop to shut the server down
+  int optLevel = 0;
+  std::string cacheDir = ""; // absolute, the server has its own working directory
+  bool timeReport = false;
+  std::string source;
+};
+
+struct CompileReply {
+  int status = 0;          // exit code of the program for run, not 0 when the back end failed
+  std::string diagnostics; // what the compiler said, with the time report
+  std::string output;      // IR text, an object file or what the program printed
+};
+
+// $DIPLOMA_SOCKET or one in the temporary directory per user
+std::string defaultSocketPath();
+
+// "key value" lines, the last field is "key size" with that many raw bytes after it
+bool sendRequest(int fd, const CompileRequest& request);
+bool receiveRequest(int fd, CompileRequest& request);
+bool sendReply(int fd, const CompileReply& reply);
+bool receiveReply(int fd, CompileReply& reply);
+
+} // namespace Diploma
+
+#endif // PROTOCOL
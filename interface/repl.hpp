@@ -0,0 +1,12 @@
+#ifndef REPL
+#define REPL
+
+namespace Diploma {
+
+// diploma --repl: every entered line is compiled into a module of its own and run by the JIT right away,
+// variables and functions of the earlier lines stay alive; returns when the input ends or on ":quit"
+int repl(int optLevel);
+
+} // namespace Diploma
+
+#endif // REPL
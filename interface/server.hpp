@@ -0,0 +1,18 @@
+#ifndef SERVER
+#define SERVER
+
+#include "protocol.hpp"
+#include <string>
+
+namespace Diploma {
+
+// diploma --serve: keeps LLVM loaded and compiles on a pool of threads, one request per connection;
+// programs to run are linked with the runtime library at runtimePath, empty for the one next to the compiler
+int serve(std::string socketPath, int workers, std::string runtimePath);
+
+// what the server does for one request, on the calling thread
+CompileReply compile(const CompileRequest& request, std::string runtimePath);
+
+} // namespace Diploma
+
+#endif // SERVER
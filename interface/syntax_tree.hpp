@@ -3,19 +3,23 @@
 
 #include "tokenizer.hpp"
 #include <any>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
 namespace Diploma {
 
 class Expr;
 class BoolExpr;
-class Int32Expr;
-class Real64Expr;
+class IntExpr;
+class RealExpr;
 class StrExpr;
+class FormatExpr;
 class NewVarExpr;
 class VarAssignExpr;
 class VarExpr;
 class UnaryExpr;
+class CastExpr;
 class ComparisonExpr;
 class BinaryExpr;
 class LogicalExpr;
@@ -24,19 +28,32 @@ class BlockExpr;
 class FuncExpr;
 class CallExpr;
 class PrintlnExpr;
+class RefExpr;
+class DerefExpr;
+class TypeExpr;
+class NewObjExpr;
+class MemberExpr;
+class MemberAssignExpr;
+class MethodCallExpr;
+class YieldExpr;
+class ForExpr;
+class WhileExpr;
+class MapExpr;
 
 class TreeWalker {
 public:
   virtual void Do(std::vector<Diploma::Expr*>) = 0;
 
   virtual std::any visitBool(BoolExpr*) = 0;
-  virtual std::any visitInt32(Int32Expr*) = 0;
-  virtual std::any visitReal64(Real64Expr*) = 0;
+  virtual std::any visitInt(IntExpr*) = 0;
+  virtual std::any visitReal(RealExpr*) = 0;
   virtual std::any visitStr(StrExpr*) = 0;
+  virtual std::any visitFormat(FormatExpr*) = 0;
   virtual std::any visitNewVar(NewVarExpr*) = 0;
   virtual std::any visitVarAssign(VarAssignExpr*) = 0;
   virtual std::any visitVar(VarExpr*) = 0;
   virtual std::any visitUnary(UnaryExpr*) = 0;
+  virtual std::any visitCast(CastExpr*) = 0;
   virtual std::any visitComparison(ComparisonExpr*) = 0;
   virtual std::any visitBinary(BinaryExpr*) = 0;
   virtual std::any visitLogical(LogicalExpr*) = 0;
@@ -45,6 +62,17 @@ public:
   virtual std::any visitFunc(FuncExpr*) = 0;
   virtual std::any visitCall(CallExpr*) = 0;
   virtual std::any visitPrintln(PrintlnExpr*) = 0;
+  virtual std::any visitRef(RefExpr*) = 0;
+  virtual std::any visitDeref(DerefExpr*) = 0;
+  virtual std::any visitType(TypeExpr*) = 0;
+  virtual std::any visitNewObj(NewObjExpr*) = 0;
+  virtual std::any visitMember(MemberExpr*) = 0;
+  virtual std::any visitMemberAssign(MemberAssignExpr*) = 0;
+  virtual std::any visitMethodCall(MethodCallExpr*) = 0;
+  virtual std::any visitYield(YieldExpr*) = 0;
+  virtual std::any visitFor(ForExpr*) = 0;
+  virtual std::any visitWhile(WhileExpr*) = 0;
+  virtual std::any visitMap(MapExpr*) = 0;
 
   virtual ~TreeWalker() = default;
 };
@@ -54,16 +82,43 @@ enum ExprType {
 
   BOOL,
 
+  I8,
+  I16,
   I32,
-  R64,
+  I64,
+  U32,
+  U64,
+  F32,
+  R64, // f64
 
   STR,
   FUNC,
+  GEN, // made by a call of a generator, 'for x of' runs it
+  MAP, // the key and value types are in the MapExpr it comes from
+
+  UNIQ_REF,
+  SHAR_REF,
+  WEAK_REF,
+
+  OBJ,
 };
 
 class Expr {
 public:
-  ExprType type;
+  ExprType type = VOID;
+  TypeExpr* objType = nullptr; // class of an OBJ value, or of the object a ref points to
+  int line = -1, column = -1;  // where it starts, zero based like in the tokens, -1 when the compiler made it
+
+  inline static thread_local int64_t created = 0;              // for the time report
+  inline static thread_local std::vector<Expr*>* owned = nullptr; // set by the compile server to free the tree
+
+  Expr() {
+    created++;
+    if (owned != nullptr)
+      owned->emplace_back(this);
+  }
+
+  virtual ~Expr() = default;
 
   virtual std::any visit(TreeWalker* walker) = 0;
 };
@@ -79,25 +134,34 @@ public:
   }
 };
 
-class Int32Expr : public Expr {
+// i32 unless it has a suffix or doesn't fit, then i64;
+// without a suffix it takes the type of the number on the other side of an operation
+class IntExpr : public Expr {
 public:
-  int32_t value;
+  uint64_t value; // the bits, signed ones are in two's complement
+  ExprType literalType;
+  bool suffixed;
 
-  Int32Expr(int32_t value) : value(value) {}
+  IntExpr(uint64_t value, ExprType literalType = I32, bool suffixed = false)
+    : value(value), literalType(literalType), suffixed(suffixed) {}
 
   std::any visit(TreeWalker* walker) override {
-    return walker->visitInt32(this);
+    return walker->visitInt(this);
   }
 };
 
-class Real64Expr : public Expr {
+// f64 unless it has the f32 suffix, without a suffix it turns into the f32 it meets
+class RealExpr : public Expr {
 public:
-  float value;
+  double value;
+  ExprType literalType;
+  bool suffixed;
 
-  Real64Expr(float value) : value(value) {}
+  RealExpr(double value, ExprType literalType = R64, bool suffixed = false)
+    : value(value), literalType(literalType), suffixed(suffixed) {}
 
   std::any visit(TreeWalker* walker) override {
-    return walker->visitReal64(this);
+    return walker->visitReal(this);
   }
 };
 
@@ -112,6 +176,18 @@ public:
   }
 };
 
+// interpolated string, constant segments are StrExpr
+class FormatExpr : public Expr {
+public:
+  std::vector<Expr*> parts;
+
+  FormatExpr(std::vector<Expr*> parts) : parts(parts) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitFormat(this);
+  }
+};
+
 class VarExpr : public Expr {
 public:
   Token identifier;
@@ -159,6 +235,19 @@ public:
   }
 };
 
+// value as i64, between numbers of any width and bool
+class CastExpr : public Expr {
+public:
+  Expr* value;
+  Token target;
+
+  CastExpr(Expr* value, Token target) : value(value), target(target) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitCast(this);
+  }
+};
+
 class ComparisonExpr : public Expr {
 public:
   Token oper;
@@ -229,7 +318,16 @@ public:
   Expr* body;
 
   std::vector<ExprType> argsTypes;
-  ExprType retType;
+  ExprType retType = VOID;
+  bool returnsOwned = false; // returns a ref allocated inside, the caller has to free it
+  bool tail = false;         // marked 'tail', recursion must not grow the stack
+  bool memo = false;         // marked 'memo', results are cached by the args; FoldWalker drops it if not pure
+  bool generator = false;    // has a yield, a call only makes the generator and runs nothing yet
+  ExprType yieldType = VOID;
+
+  std::vector<std::string> captures; // variables of enclosing scopes, copied into the environment
+  std::vector<bool> argsEscape;      // the function keeps the arg after it returns
+  bool escapes = true;               // the environment outlives the scope that creates it
 
   FuncExpr(std::vector<Token> args, Expr* body) : args(args), body(body) {}
 
@@ -243,6 +341,9 @@ public:
   Expr* func;
   std::vector<Expr*> args;
 
+  bool ownsResult = false;
+  std::vector<Expr*> lent; // stack allocations of the caller given to args that are not kept
+
   CallExpr(Expr* func, std::vector<Expr*> args) : func(func), args(args) {}
 
   std::any visit(TreeWalker* walker) override {
@@ -261,7 +362,204 @@ public:
   }
 };
 
-std::vector<Expr*> parseSyntaxTree(std::vector<Token> t);
+class RefExpr : public Expr {
+public:
+  Grapheme kind; // UNIQ, SHAR or WEAK
+  Expr* value;
+
+  ExprType valueType = VOID;
+  bool escapes = true; // outlives the function that creates it, so it goes to heap
+  bool atomic = false; // may be seen by other threads, counters are changed atomically
+
+  RefExpr(Grapheme kind, Expr* value) : kind(kind), value(value) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitRef(this);
+  }
+};
+
+class DerefExpr : public Expr {
+public:
+  Expr* ref;
+
+  DerefExpr(Expr* ref) : ref(ref) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitDeref(this);
+  }
+};
+
+// Name type (fields...) : Base(args...)
+//     field := value
+//     method args -> body
+class TypeExpr : public Expr {
+public:
+  Token name;
+  std::vector<Token> params;
+  TypeExpr* base = nullptr;
+  std::vector<Expr*> baseArgs;
+  std::vector<NewVarExpr*> fields; // a field of some base type gets a new initial value
+  std::vector<std::pair<std::string, FuncExpr*>> methods;
+  std::vector<TypeExpr*> derived;
+
+  std::vector<std::pair<std::string, ExprType>> ownFields; // fields that are not in base types
+  bool polymorphic = false;         // some call needs dynamic dispatch, objects keep a vtable pointer
+  std::vector<std::string> vtable;  // slots of the whole hierarchy, filled on the root only
+
+  TypeExpr(Token name, std::vector<Token> params) : name(name), params(params) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitType(this);
+  }
+
+  TypeExpr* root() {
+    return base == nullptr ? this : base->root();
+  }
+
+  bool isSubtypeOf(TypeExpr* other) {
+    return this == other || (base != nullptr && base->isSubtypeOf(other));
+  }
+
+  // the closest implementation up the hierarchy and the type it is declared in
+  std::pair<TypeExpr*, FuncExpr*> findMethod(std::string methodName) {
+    for (auto& [name, method] : methods) {
+      if (name == methodName)
+        return {this, method};
+    }
+    return base == nullptr ? std::pair<TypeExpr*, FuncExpr*>(nullptr, nullptr) : base->findMethod(methodName);
+  }
+};
+
+class NewObjExpr : public Expr {
+public:
+  std::vector<Expr*> args;
+
+  bool escapes = true; // same as for RefExpr
+
+  NewObjExpr(TypeExpr* objType, std::vector<Expr*> args) : args(args) {
+    this->objType = objType;
+  }
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitNewObj(this);
+  }
+};
+
+class MemberExpr : public Expr {
+public:
+  Expr* object;
+  Token member;
+
+  MemberExpr(Expr* object, Token member) : object(object), member(member) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitMember(this);
+  }
+};
+
+class MemberAssignExpr : public Expr {
+public:
+  Expr* object;
+  Token member;
+  Expr* value;
+
+  MemberAssignExpr(Expr* object, Token member, Expr* value) : object(object), member(member), value(value) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitMemberAssign(this);
+  }
+};
+
+class MethodCallExpr : public Expr {
+public:
+  Expr* object; // 'base' inside of a method calls the base implementation
+  Token method;
+  std::vector<Expr*> args;
+
+  TypeExpr* receiverType = nullptr; // the most specific type known at compile time
+  TypeExpr* targetOwner = nullptr;
+  FuncExpr* target = nullptr;
+  bool throughBase = false;
+  bool dynamic = false; // several implementations are possible, goes through the vtable
+  MapExpr* map = nullptr; // put, get, has, remove or size of a map, nothing to dispatch
+
+  MethodCallExpr(Expr* object, Token method, std::vector<Expr*> args) : object(object), method(method), args(args) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitMethodCall(this);
+  }
+};
+
+// the function it is in becomes a generator, every value goes to the 'for' that runs it
+class YieldExpr : public Expr {
+public:
+  Expr* value;
+
+  YieldExpr(Expr* value) : value(value) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitYield(this);
+  }
+};
+
+// for item of generator
+//     body
+class ForExpr : public Expr {
+public:
+  Token item;
+  Expr* source;
+  BlockExpr* body;
+
+  ExprType itemType = VOID; // what the generator yields
+
+  ForExpr(Token item, Expr* source, BlockExpr* body) : item(item), source(source), body(body) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitFor(this);
+  }
+};
+
+class WhileExpr : public Expr {
+public:
+  Expr* condition;
+  BlockExpr* body;
+
+  WhileExpr(Expr* condition, BlockExpr* body) : condition(condition), body(body) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitWhile(this);
+  }
+};
+
+// {key: value, ...}, the keys are i32, f64 or str; an empty one gets its types from the first put
+class MapExpr : public Expr {
+public:
+  std::vector<std::pair<Expr*, Expr*>> entries;
+
+  ExprType keyType = VOID;
+  ExprType valueType = VOID;
+
+  MapExpr(std::vector<std::pair<Expr*, Expr*>> entries) : entries(entries) {}
+
+  std::any visit(TreeWalker* walker) override {
+    return walker->visitMap(this);
+  }
+};
+
+// keepTypes: the types declared by the previous call are still known, for the REPL
+std::vector<Expr*> parseSyntaxTree(std::vector<Token> t, bool keepTypes = false);
+
+// numbers: "i8", "u64", "f32", ... to the type, if it is one
+std::optional<ExprType> numberType(const std::string& name);
+std::string typeName(ExprType type);
+bool isNumber(ExprType type);
+bool isInteger(ExprType type);
+bool isFloat(ExprType type);
+bool isUnsigned(ExprType type);
+int bitWidth(ExprType type);
+// the type both sides of an operation are converted to: a float wins over integers,
+// the wider one wins, unsigned wins over signed of the same width
+ExprType promote(ExprType left, ExprType right);
 
 } // namespace Diploma
 
@@ -0,0 +1,81 @@
+#ifndef TIMING
+#define TIMING
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Diploma {
+
+// where the compile time and memory go: nested phases and counters of the things compiled
+class TimeReport {
+public:
+  struct Event {
+    std::string name;
+    int64_t start;    // microseconds since the report was created
+    int64_t duration;
+    int depth;
+    int64_t allocated; // bytes, by operator new during the phase
+    int64_t freed;
+    int64_t peak;      // the most bytes the phase had live at once on top of what was there before it
+    int64_t resident;  // peak RSS of the process when the phase ended
+    int thread = 0;    // the -jN worker it ran on, 0 for the thread of the report
+  };
+
+  // for the memory report: how many of something there are and the bytes they take
+  struct Size {
+    std::string name;
+    int64_t count;
+    int64_t bytes;
+  };
+
+  bool measureSizes = false; // --mem-report, walks the tree and writes bitcode only to measure them
+
+  static TimeReport& get(); // of the calling thread
+  void clear();
+
+  void begin(std::string name);
+  void end();
+  void count(std::string counter, int64_t value); // overwrites, the last value wins
+  void size(std::string name, int64_t count, int64_t bytes);
+
+  // phases a thread ran for another one: the ones since the mark are taken out of this report, when they have all
+  // ended, and added to the report of the other thread under the phase it has open, in the order they are added
+  size_t mark();
+  std::vector<Event> take(size_t mark);
+  void add(const std::vector<Event>& taken, int thread);
+
+  int64_t total(std::string name); // microseconds of every phase with the name, on every thread
+
+  void print(std::ostream& out);
+  void printMemory(std::ostream& out);
+  bool writeTrace(std::string path); // trace_event JSON for chrome://tracing and Perfetto
+
+private:
+  std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+  std::vector<Event> events;
+  std::vector<size_t> open;
+  std::vector<std::pair<std::string, int64_t>> counters;
+  std::vector<Size> sizes;
+
+  int64_t now();
+  int64_t originMicroseconds();
+};
+
+// times the scope it lives in
+class ScopedTimer {
+public:
+  ScopedTimer(std::string name) {
+    TimeReport::get().begin(name);
+  }
+
+  ~ScopedTimer() {
+    TimeReport::get().end();
+  }
+};
+
+} // namespace Diploma
+
+#endif // TIMING
@@ -0,0 +1,252 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define threadLocal __declspec(thread)
+#define pushAtomic(head, item) \
+  do { \
+    (item)->next = *(head); \
+  } while (_InterlockedCompareExchangePointer((void* volatile*)(head), (item), (item)->next) != (item)->next)
+#else
+#define threadLocal _Thread_local
+#define pushAtomic(head, item) \
+  do { \
+    (item)->next = __atomic_load_n((head), __ATOMIC_RELAXED); \
+  } while (!__atomic_compare_exchange_n((head), &(item)->next, (item), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ticks() __rdtsc()
+#elif defined(_M_X64) || defined(_M_IX86)
+#define ticks() __rdtsc()
+#else
+#define ticks() nanoseconds()
+#endif
+
+#define EVENT_CAPACITY 4096
+#define MAX_DEPTH 256 // deeper calls are counted in the frame at this depth, the stacks stay readable
+
+// what the hooks write, replayed into the call tree when the buffer is full and at exit
+typedef struct {
+  int32_t function; // -1 - function when leaving it
+  uint64_t time;
+} CallEvent;
+
+typedef struct {
+  int32_t function;
+  int32_t parent;
+  int32_t firstChild;
+  int32_t nextSibling;
+  uint64_t self;
+} CallNode;
+
+typedef struct ThreadCalls {
+  CallEvent events[EVENT_CAPACITY];
+  int32_t eventCount;
+  CallNode* nodes; // the tree of the stacks seen by the thread, 0 is the root above main
+  int32_t nodeCount, nodeCapacity;
+  int32_t stack[MAX_DEPTH + 1];
+  int32_t depth, hiddenDepth; // hidden: frames past MAX_DEPTH
+  uint64_t lastTime;
+  int32_t* active;          // activations of every function, recursion counts once in total time
+  uint64_t* outermostStart; // when the first one of them started
+  struct ThreadCalls* next;
+} ThreadCalls;
+
+typedef struct {
+  uint64_t calls;
+  uint64_t self;
+  uint64_t total;
+} FunctionCalls;
+
+static const char* callsPath;
+static const char** callsNames;
+static int32_t callsCount;
+static FunctionCalls* functionCalls;
+static ThreadCalls* threads;
+static threadLocal ThreadCalls* current;
+static uint64_t startTicks, startNanoseconds;
+
+static uint64_t nanoseconds(void) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void* allocateOrDie(size_t size) {
+  void* block = calloc(1, size);
+  if (block == NULL) {
+    fprintf(stderr, "out of memory for the calls profile\n");
+    abort();
+  }
+  return block;
+}
+
+static int32_t childOf(ThreadCalls* thread, int32_t parent, int32_t function) {
+  for (int32_t child = thread->nodes[parent].firstChild; child != 0; child = thread->nodes[child].nextSibling) {
+    if (thread->nodes[child].function == function)
+      return child;
+  }
+  if (thread->nodeCount == thread->nodeCapacity) {
+    thread->nodeCapacity *= 2;
+    thread->nodes = realloc(thread->nodes, thread->nodeCapacity * sizeof(CallNode));
+    if (thread->nodes == NULL) {
+      fprintf(stderr, "out of memory for the calls profile\n");
+      abort();
+    }
+  }
+  int32_t child = thread->nodeCount++;
+  CallNode node = {function, parent, 0, thread->nodes[parent].firstChild, 0};
+  thread->nodes[child] = node;
+  thread->nodes[parent].firstChild = child;
+  return child;
+}
+
+// turns the buffered events into self time, total time and calls, the buffer is empty again
+static void replay(ThreadCalls* thread) {
+  for (int32_t i = 0; i < thread->eventCount; i++) {
+    CallEvent event = thread->events[i];
+    int32_t top = thread->stack[thread->depth];
+    uint64_t spent = event.time - thread->lastTime;
+    thread->nodes[top].self += spent;
+    if (top != 0)
+      functionCalls[thread->nodes[top].function].self += spent;
+    thread->lastTime = event.time;
+
+    if (event.function >= 0) {
+      int32_t function = event.function;
+      functionCalls[function].calls++;
+      if (thread->active[function]++ == 0)
+        thread->outermostStart[function] = event.time;
+      if (thread->depth < MAX_DEPTH) {
+        thread->stack[thread->depth + 1] = childOf(thread, top, function);
+        thread->depth++;
+      } else {
+        thread->hiddenDepth++;
+      }
+    } else {
+      int32_t function = -1 - event.function;
+      if (thread->active[function] > 0 && --thread->active[function] == 0)
+        functionCalls[function].total += event.time - thread->outermostStart[function];
+      if (thread->hiddenDepth > 0)
+        thread->hiddenDepth--;
+      else if (thread->depth > 0)
+        thread->depth--;
+    }
+  }
+  thread->eventCount = 0;
+}
+
+static ThreadCalls* startThread(void) {
+  ThreadCalls* thread = allocateOrDie(sizeof(ThreadCalls));
+  thread->nodeCapacity = 256;
+  thread->nodes = allocateOrDie(thread->nodeCapacity * sizeof(CallNode));
+  thread->nodeCount = 1;
+  thread->nodes[0].function = -1;
+  thread->active = allocateOrDie(callsCount * sizeof(int32_t));
+  thread->outermostStart = allocateOrDie(callsCount * sizeof(uint64_t));
+  thread->lastTime = ticks();
+  pushAtomic(&threads, thread);
+  current = thread;
+  return thread;
+}
+
+static void record(int32_t function) {
+  ThreadCalls* thread = current != NULL ? current : startThread();
+  if (thread->eventCount == EVENT_CAPACITY)
+    replay(thread);
+  CallEvent* event = &thread->events[thread->eventCount++];
+  event->function = function;
+  event->time = ticks();
+}
+
+void calls_enter(int32_t function) {
+  record(function);
+}
+
+void calls_exit(int32_t function) {
+  record(-1 - function);
+}
+
+// main;f:3;g:7 <self nanoseconds>, parents first
+static void writeStacks(FILE* file, ThreadCalls* thread, double nanosecondsPerTick) {
+  for (int32_t i = 1; i < thread->nodeCount; i++) {
+    uint64_t self = (uint64_t)(thread->nodes[i].self * nanosecondsPerTick);
+    if (self == 0)
+      continue;
+    int32_t path[MAX_DEPTH + 1];
+    int32_t length = 0;
+    for (int32_t node = i; node != 0; node = thread->nodes[node].parent) {
+      path[length++] = thread->nodes[node].function;
+    }
+    while (length > 0) {
+      fputs(callsNames[path[--length]], file);
+      fputc(length > 0 ? ';' : ' ', file);
+    }
+    fprintf(file, "%llu\n", (unsigned long long)self);
+  }
+}
+
+static int bySelfTime(const void* left, const void* right) {
+  uint64_t l = functionCalls[*(const int32_t*)left].self, r = functionCalls[*(const int32_t*)right].self;
+  return l < r ? 1 : l > r ? -1 : 0;
+}
+
+static void writeCalls(void) {
+  uint64_t endTicks = ticks(), endNanoseconds = nanoseconds();
+  double nanosecondsPerTick = 1;
+  if (endTicks > startTicks)
+    nanosecondsPerTick = (double)(endNanoseconds - startNanoseconds) / (endTicks - startTicks);
+  for (ThreadCalls* thread = threads; thread != NULL; thread = thread->next) {
+    replay(thread);
+  }
+
+  FILE* file = fopen(callsPath, "w");
+  if (file == NULL) {
+    fprintf(stderr, "can't write the calls profile to %s\n", callsPath);
+  } else {
+    for (ThreadCalls* thread = threads; thread != NULL; thread = thread->next) {
+      writeStacks(file, thread, nanosecondsPerTick);
+    }
+    fclose(file);
+  }
+
+  int32_t* order = allocateOrDie(callsCount * sizeof(int32_t));
+  for (int32_t i = 0; i < callsCount; i++) {
+    order[i] = i;
+  }
+  qsort(order, callsCount, sizeof(int32_t), bySelfTime);
+  fprintf(stderr, "calls profile, the stacks are in %s\n", callsPath);
+  fprintf(stderr, "%12s %12s %12s  %s\n", "self ms", "total ms", "calls", "function");
+  for (int32_t i = 0; i < callsCount; i++) {
+    FunctionCalls* calls = &functionCalls[order[i]];
+    if (calls->calls == 0)
+      continue;
+    double self = calls->self * nanosecondsPerTick / 1e6, total = calls->total * nanosecondsPerTick / 1e6;
+    fprintf(stderr, "%12.3f %12.3f %12llu  %s\n", self, total, (unsigned long long)calls->calls, callsNames[order[i]]);
+  }
+  free(order);
+}
+
+void calls_register(const char* path, const char* names, int32_t count) {
+  const char* override = getenv("DIPLOMA_CALLS");
+  callsPath = override != NULL ? override : path;
+  callsCount = count;
+  callsNames = allocateOrDie(count * sizeof(const char*));
+  functionCalls = allocateOrDie(count * sizeof(FunctionCalls));
+  char* copy = allocateOrDie(strlen(names) + 1); // split in place at the '\n's
+  strcpy(copy, names);
+  for (int32_t i = 0; i < count; i++) {
+    callsNames[i] = copy;
+    copy = strchr(copy, '\n');
+    *copy++ = '\0';
+  }
+  startTicks = ticks();
+  startNanoseconds = nanoseconds();
+  atexit(writeCalls);
+}
@@ -0,0 +1,169 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define atomicIncrement(p) _InterlockedIncrement((volatile long*)(p))
+#define atomicDecrement(p) _InterlockedDecrement((volatile long*)(p))
+#define threadLocal __declspec(thread)
+#else
+#define atomicIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define atomicDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define threadLocal _Thread_local
+#endif
+
+#define CLASS_COUNT 5
+#define LARGE_CLASS 0xff
+#define SLAB_SIZE (1 << 16)
+
+// precedes every value, 16 bytes so the value stays aligned for anything
+typedef struct {
+  uint32_t strong;
+  uint32_t weak; // +1 while strong != 0, the block is freed when it drops to zero
+  uint32_t blockSize; // header included, rounded up to the size class
+  uint32_t flags;
+} RefHeader;
+
+typedef struct FreeBlock {
+  struct FreeBlock* next;
+} FreeBlock;
+
+static const uint32_t classSizes[CLASS_COUNT] = {32, 64, 128, 256, 512};
+
+static threadLocal FreeBlock* freeLists[CLASS_COUNT];
+static threadLocal char* slabCursor[CLASS_COUNT];
+static threadLocal char* slabEnd[CLASS_COUNT];
+
+RefStats ref_stats;
+static int statsRequested = -1;
+
+static RefHeader* headerOf(const void* value) {
+  return (RefHeader*)value - 1;
+}
+
+static uint32_t classOf(size_t blockSize) {
+  for (uint32_t i = 0; i < CLASS_COUNT; i++) {
+    if (blockSize <= classSizes[i])
+      return i;
+  }
+  return LARGE_CLASS;
+}
+
+static void* takeBlock(uint32_t sizeClass, size_t blockSize) {
+  if (sizeClass == LARGE_CLASS) {
+    ref_stats.large++;
+    return malloc(blockSize);
+  }
+
+  FreeBlock* block = freeLists[sizeClass];
+  if (block != NULL) {
+    freeLists[sizeClass] = block->next;
+    ref_stats.pooled++;
+    return block;
+  }
+
+  uint32_t classSize = classSizes[sizeClass];
+  if (slabCursor[sizeClass] == slabEnd[sizeClass]) {
+    char* slab = malloc(SLAB_SIZE);
+    if (slab == NULL)
+      return NULL;
+    ref_stats.slabs++;
+    slabCursor[sizeClass] = slab;
+    slabEnd[sizeClass] = slab + SLAB_SIZE / classSize * classSize;
+  }
+  void* result = slabCursor[sizeClass];
+  slabCursor[sizeClass] += classSize;
+  return result;
+}
+
+static void freeBlock(RefHeader* header) {
+  uint32_t sizeClass = classOf(header->blockSize);
+  ref_stats.frees++;
+  ref_stats.liveBytes -= header->blockSize;
+  if (sizeClass == LARGE_CLASS) {
+    free(header);
+    return;
+  }
+  FreeBlock* block = (FreeBlock*)header;
+  block->next = freeLists[sizeClass];
+  freeLists[sizeClass] = block;
+}
+
+void* ref_alloc(int64_t size, int32_t flags) {
+  if (statsRequested < 0) {
+    statsRequested = getenv("DIPLOMA_HEAP_STATS") != NULL;
+    if (statsRequested)
+      atexit(ref_print_stats);
+  }
+
+  size_t blockSize = sizeof(RefHeader) + (size_t)size;
+  uint32_t sizeClass = classOf(blockSize);
+  RefHeader* header = takeBlock(sizeClass, blockSize);
+  if (header == NULL) {
+    fprintf(stderr, "out of memory allocating %lld bytes\n", (long long)size);
+    abort();
+  }
+
+  header->strong = 1;
+  header->weak = 1;
+  header->blockSize = sizeClass == LARGE_CLASS ? blockSize : classSizes[sizeClass];
+  header->flags = flags;
+
+  ref_stats.allocations++;
+  ref_stats.liveBytes += header->blockSize;
+  if (ref_stats.liveBytes > ref_stats.peakBytes)
+    ref_stats.peakBytes = ref_stats.liveBytes;
+  return header + 1;
+}
+
+void ref_retain(void* value) {
+  RefHeader* header = headerOf(value);
+  if (header->flags & REF_ATOMIC)
+    atomicIncrement(&header->strong);
+  else
+    header->strong++;
+}
+
+void ref_weak_retain(void* value) {
+  RefHeader* header = headerOf(value);
+  if (header->flags & REF_ATOMIC)
+    atomicIncrement(&header->weak);
+  else
+    header->weak++;
+}
+
+void ref_weak_release(void* value) {
+  RefHeader* header = headerOf(value);
+  uint32_t weak = header->flags & REF_ATOMIC ? atomicDecrement(&header->weak) : --header->weak;
+  if (weak == 0)
+    freeBlock(header);
+}
+
+void ref_release(void* value) {
+  RefHeader* header = headerOf(value);
+  uint32_t strong = header->flags & REF_ATOMIC ? atomicDecrement(&header->strong) : --header->strong;
+  if (strong == 0) {
+    if (header->flags & REF_DROP)
+      (*(void (**)(void*))value)(value);
+    ref_weak_release(value); // the strong owners' share of weak
+  }
+}
+
+bool ref_alive(const void* value) {
+  return headerOf(value)->strong != 0;
+}
+
+void ref_print_stats(void) {
+  fprintf(
+    stderr,
+    "ref heap: %llu allocations (%llu pooled, %llu large), %llu frees, %llu slabs, %llu bytes live, %llu peak\n",
+    (unsigned long long)ref_stats.allocations,
+    (unsigned long long)ref_stats.pooled,
+    (unsigned long long)ref_stats.large,
+    (unsigned long long)ref_stats.frees,
+    (unsigned long long)ref_stats.slabs,
+    (unsigned long long)ref_stats.liveBytes,
+    (unsigned long long)ref_stats.peakBytes
+  );
+}
@@ -0,0 +1,339 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define specialized __forceinline
+static int lowestBit(uint32_t value) {
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return (int)index;
+}
+static int leadingZeros16(uint32_t value) {
+  unsigned long index;
+  _BitScanReverse(&index, value);
+  return 15 - (int)index;
+}
+#else
+// the public functions of every key kind get a copy of the probing with the hash and the compare of the kind inside
+#define specialized inline __attribute__((always_inline))
+#define lowestBit(value) __builtin_ctz(value)
+#define leadingZeros16(value) (__builtin_clz(value) - 16)
+#endif
+
+#define GROUP_WIDTH 16
+#define EMPTY ((int8_t)-128)
+#define DELETED ((int8_t)-2) // a probe goes on past it, full ones are the 7 bits of the hash, >= 0
+
+typedef uint32_t Bits; // one bit for every byte of a group
+
+struct Map {
+  void (*drop)(void*); // REF_DROP
+  int8_t* control;     // capacity + GROUP_WIDTH bytes, the first group is repeated after the end
+  char* slots;         // the key, then the value at valueOffset
+  uint64_t capacity;   // 0 or a power of two from GROUP_WIDTH up
+  uint64_t mask;
+  int64_t size;
+  int64_t growthLeft; // empty slots that can still be filled, an eighth always stays empty so lookups end
+  int32_t keyKind;
+  bool strValues;
+  int32_t keySize, valueOffset, valueSize, slotSize;
+};
+
+// what a map without slots probes, a lookup stops right there and a put grows it first
+static int8_t emptyGroup[GROUP_WIDTH] = {
+  EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY,
+};
+
+static Bits matchByte(const int8_t* group, int8_t value) {
+#ifdef HAVE_SSE2
+  __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+  return (Bits)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+  Bits bits = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    bits |= (Bits)(group[i] == value) << i;
+  }
+  return bits;
+#endif
+}
+
+// empty or deleted, the bytes with the top bit set
+static Bits matchFree(const int8_t* group) {
+#ifdef HAVE_SSE2
+  return (Bits)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+  Bits bits = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    bits |= (Bits)(group[i] < 0) << i;
+  }
+  return bits;
+#endif
+}
+
+static uint64_t mix(uint64_t value) {
+  value = (value ^ value >> 33) * 0xff51afd7ed558ccdull;
+  value = (value ^ value >> 33) * 0xc4ceb9fe1a85ec53ull;
+  return value ^ value >> 33;
+}
+
+static specialized uint64_t hashOf(int32_t keyKind, const void* key) {
+  if (keyKind == MAP_I32)
+    return mix((uint32_t) * (const int32_t*)key);
+  if (keyKind == MAP_F64) {
+    double value = *(const double*)key;
+    uint64_t bits;
+    if (value == 0)
+      value = 0; // -0 too
+    memcpy(&bits, &value, sizeof(bits));
+    return mix(bits);
+  }
+  return str_hash(key);
+}
+
+static specialized bool equalKeys(int32_t keyKind, const void* stored, const void* key) {
+  if (keyKind == MAP_I32)
+    return *(const int32_t*)stored == *(const int32_t*)key;
+  if (keyKind == MAP_F64)
+    return *(const double*)stored == *(const double*)key;
+  const Str* left = stored;
+  const Str* right = key;
+  if (left->words[0] == right->words[0] && left->words[1] == right->words[1])
+    return true;
+  return ((uint8_t)left->bytes[15] & STR_LONG) && str_equal(left, right);
+}
+
+static char* slotAt(const Map* map, uint64_t index) {
+  return map->slots + index * map->slotSize;
+}
+
+static void setControl(Map* map, uint64_t index, int8_t value) {
+  map->control[index] = value;
+  if (index < GROUP_WIDTH)
+    map->control[map->capacity + index] = value;
+}
+
+static void* allocateOrDie(Map* map, size_t size) {
+  void* block = malloc(size);
+  if (block == NULL) {
+    fprintf(stderr, "out of memory growing a map of %lld keys\n", (long long)map->size);
+    abort();
+  }
+  return block;
+}
+
+// the groups are visited at 1, 2, 3... groups further each time, with a power of two of them that is all of them
+static specialized int64_t find(const Map* map, int32_t keyKind, const void* key, uint64_t hash) {
+  int8_t tag = (int8_t)(hash & 0x7f);
+  uint64_t position = hash >> 7 & map->mask;
+  for (uint64_t step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+    const int8_t* group = map->control + position;
+    for (Bits bits = matchByte(group, tag); bits != 0; bits &= bits - 1) {
+      uint64_t index = (position + lowestBit(bits)) & map->mask;
+      if (equalKeys(keyKind, slotAt(map, index), key))
+        return (int64_t)index;
+    }
+    if (matchByte(group, EMPTY) != 0)
+      return -1;
+    position = (position + step) & map->mask;
+  }
+}
+
+static uint64_t findFree(const Map* map, uint64_t hash) {
+  uint64_t position = hash >> 7 & map->mask;
+  for (uint64_t step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+    Bits bits = matchFree(map->control + position);
+    if (bits != 0)
+      return (position + lowestBit(bits)) & map->mask;
+    position = (position + step) & map->mask;
+  }
+}
+
+static void resize(Map* map, uint64_t capacity) {
+  int8_t* oldControl = map->control;
+  char* oldSlots = map->slots;
+  uint64_t oldCapacity = map->capacity;
+  map->control = allocateOrDie(map, capacity + GROUP_WIDTH);
+  memset(map->control, EMPTY, capacity + GROUP_WIDTH);
+  map->slots = allocateOrDie(map, capacity * map->slotSize);
+  map->capacity = capacity;
+  map->mask = capacity - 1;
+  map->growthLeft = (int64_t)(capacity - capacity / 8) - map->size;
+  for (uint64_t i = 0; i < oldCapacity; i++) {
+    if (oldControl[i] < 0)
+      continue;
+    const char* slot = oldSlots + i * map->slotSize;
+    uint64_t hash = hashOf(map->keyKind, slot);
+    uint64_t index = findFree(map, hash);
+    setControl(map, index, (int8_t)(hash & 0x7f));
+    memcpy(slotAt(map, index), slot, map->slotSize);
+  }
+  if (oldCapacity > 0) {
+    free(oldControl);
+    free(oldSlots);
+  }
+}
+
+// runs out of empty slots: doubles, or only clears the deleted ones when they took most of the room
+static void grow(Map* map) {
+  if (map->capacity == 0)
+    resize(map, GROUP_WIDTH);
+  else if ((uint64_t)map->size * 16 <= map->capacity * 7)
+    resize(map, map->capacity);
+  else
+    resize(map, map->capacity * 2);
+}
+
+static specialized void* put(Map* map, int32_t keyKind, const void* key) {
+  uint64_t hash = hashOf(keyKind, key);
+  int64_t found = find(map, keyKind, key, hash);
+  if (found >= 0)
+    return slotAt(map, found) + map->valueOffset;
+  uint64_t index = findFree(map, hash);
+  if (map->growthLeft == 0 && map->control[index] != DELETED) {
+    grow(map);
+    index = findFree(map, hash);
+  }
+  if (map->control[index] == EMPTY)
+    map->growthLeft--;
+  setControl(map, index, (int8_t)(hash & 0x7f));
+  map->size++;
+  char* slot = slotAt(map, index);
+  memcpy(slot, key, map->keySize);
+  if (keyKind == MAP_STR)
+    str_retain((const Str*)slot);
+  memset(slot + map->valueOffset, 0, map->valueSize);
+  return slot + map->valueOffset;
+}
+
+// the shares of the strings in the slot
+static void releaseSlot(Map* map, const char* slot) {
+  if (map->keyKind == MAP_STR)
+    str_release((const Str*)slot);
+  if (map->strValues)
+    str_release((const Str*)(slot + map->valueOffset));
+}
+
+static specialized void* findValue(const Map* map, int32_t keyKind, const void* key) {
+  int64_t found = find(map, keyKind, key, hashOf(keyKind, key));
+  return found >= 0 ? slotAt(map, found) + map->valueOffset : NULL;
+}
+
+// lookups stop at an empty byte, so the slot can only be empty again if no group around it was ever full
+static specialized bool removeKey(Map* map, int32_t keyKind, const void* key) {
+  int64_t found = find(map, keyKind, key, hashOf(keyKind, key));
+  if (found < 0)
+    return false;
+  uint64_t index = (uint64_t)found;
+  releaseSlot(map, slotAt(map, index));
+  Bits emptyBefore = matchByte(map->control + ((index - GROUP_WIDTH) & map->mask), EMPTY);
+  Bits emptyAfter = matchByte(map->control + index, EMPTY);
+  bool neverFull =
+    emptyBefore != 0 && emptyAfter != 0 && lowestBit(emptyAfter) + leadingZeros16(emptyBefore) < GROUP_WIDTH;
+  setControl(map, index, neverFull ? EMPTY : DELETED);
+  if (neverFull)
+    map->growthLeft++;
+  map->size--;
+  return true;
+}
+
+static void dropMap(void* value) {
+  Map* map = value;
+  if (map->keyKind == MAP_STR || map->strValues) {
+    for (int64_t i = map_next(map, 0); i >= 0; i = map_next(map, i + 1)) {
+      releaseSlot(map, slotAt(map, (uint64_t)i));
+    }
+  }
+  if (map->capacity > 0) {
+    free(map->control);
+    free(map->slots);
+  }
+}
+
+static int32_t roundUp(int32_t value, int32_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+Map* map_new(int32_t keyKind, int32_t valueSize) {
+  Map* map = ref_alloc(sizeof(Map), REF_DROP);
+  map->drop = dropMap;
+  map->control = emptyGroup;
+  map->slots = NULL;
+  map->capacity = map->mask = 0;
+  map->size = map->growthLeft = 0;
+  map->strValues = (keyKind & MAP_STR_VALUES) != 0;
+  keyKind &= ~MAP_STR_VALUES;
+  map->keyKind = keyKind;
+  map->keySize = keyKind == MAP_STR ? sizeof(Str) : keyKind == MAP_F64 ? sizeof(double) : sizeof(int32_t);
+  int32_t valueAlignment = valueSize & -valueSize; // the sizes of the values are powers of two or strings
+  if (valueAlignment > 8 || valueAlignment == 0)
+    valueAlignment = 8;
+  int32_t keyAlignment = map->keySize < 8 ? map->keySize : 8;
+  map->valueOffset = roundUp(map->keySize, valueAlignment);
+  map->valueSize = valueSize;
+  map->slotSize = roundUp(map->valueOffset + valueSize, keyAlignment > valueAlignment ? keyAlignment : valueAlignment);
+  return map;
+}
+
+int64_t map_size(const Map* map) {
+  return map->size;
+}
+
+void* map_put_i32(Map* map, int32_t key) {
+  return put(map, MAP_I32, &key);
+}
+
+void* map_put_f64(Map* map, double key) {
+  return put(map, MAP_F64, &key);
+}
+
+void* map_put_str(Map* map, const Str* key) {
+  return put(map, MAP_STR, key);
+}
+
+void* map_find_i32(const Map* map, int32_t key) {
+  return findValue(map, MAP_I32, &key);
+}
+
+void* map_find_f64(const Map* map, double key) {
+  return findValue(map, MAP_F64, &key);
+}
+
+void* map_find_str(const Map* map, const Str* key) {
+  return findValue(map, MAP_STR, key);
+}
+
+bool map_remove_i32(Map* map, int32_t key) {
+  return removeKey(map, MAP_I32, &key);
+}
+
+bool map_remove_f64(Map* map, double key) {
+  return removeKey(map, MAP_F64, &key);
+}
+
+bool map_remove_str(Map* map, const Str* key) {
+  return removeKey(map, MAP_STR, key);
+}
+
+// the last group also reads the repeated bytes after the end, those are skipped
+int64_t map_next(const Map* map, int64_t position) {
+  for (uint64_t i = position < 0 ? 0 : (uint64_t)position; i < map->capacity; i += GROUP_WIDTH) {
+    Bits full = ~matchFree(map->control + i) & 0xffff;
+    if (full != 0) {
+      uint64_t index = i + lowestBit(full);
+      return index < map->capacity ? (int64_t)index : -1;
+    }
+  }
+  return -1;
+}
+
+const void* map_key(const Map* map, int64_t position) {
+  return slotAt(map, (uint64_t)position);
+}
@@ -0,0 +1,198 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_LIMIT 1000000
+
+struct Memo {
+  char* name; // a copy, the code of the REPL can be gone when the stats are printed
+  int32_t argCount;
+  bool integerArg;
+  // small integer args: the result of n is at n, the array grows to the biggest n stored
+  int64_t* directValues;
+  uint8_t* directFilled;
+  int64_t directCapacity;
+  // the rest: linear probing over slots of argCount args and then the result, at most half full
+  int64_t* slots;
+  uint8_t* filled;
+  uint64_t capacity;
+  int64_t size;
+  int64_t limit;
+  uint64_t hits, misses, clears;
+  struct Memo* next;
+};
+
+static Memo* firstMemo = NULL;
+static Memo** lastMemo = &firstMemo;
+static int statsRequested = -1;
+
+static void* allocateOrDie(const Memo* memo, size_t size) {
+  void* block = calloc(1, size);
+  if (block == NULL) {
+    fprintf(stderr, "out of memory for the cache of '%s'\n", memo->name);
+    abort();
+  }
+  return block;
+}
+
+static uint64_t mix(uint64_t value) {
+  value = (value ^ value >> 33) * 0xff51afd7ed558ccdull;
+  value = (value ^ value >> 33) * 0xc4ceb9fe1a85ec53ull;
+  return value ^ value >> 33;
+}
+
+static uint64_t hashArgs(const int64_t* args, int32_t count) {
+  uint64_t hash = 0x9e3779b97f4a7c15ull;
+  for (int32_t i = 0; i < count; i++) {
+    hash = mix(hash ^ (uint64_t)args[i]);
+  }
+  return hash;
+}
+
+static int64_t* slotAt(const Memo* memo, uint64_t index) {
+  return memo->slots + index * (memo->argCount + 1);
+}
+
+// the slot with the args, or the empty one where they go
+static uint64_t findSlot(const Memo* memo, const int64_t* args) {
+  uint64_t mask = memo->capacity - 1;
+  uint64_t index = hashArgs(args, memo->argCount) & mask;
+  while (memo->filled[index] && memcmp(slotAt(memo, index), args, memo->argCount * sizeof(int64_t)) != 0) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+static bool isDirect(const Memo* memo, const int64_t* args) {
+  return memo->integerArg && (uint64_t)args[0] < MEMO_DIRECT;
+}
+
+static void growDirect(Memo* memo, int64_t key) {
+  int64_t capacity = memo->directCapacity > 0 ? memo->directCapacity : 64;
+  while (capacity <= key) {
+    capacity *= 2;
+  }
+  int64_t* values = allocateOrDie(memo, capacity * sizeof(int64_t));
+  uint8_t* filled = allocateOrDie(memo, capacity);
+  if (memo->directCapacity > 0) {
+    memcpy(values, memo->directValues, memo->directCapacity * sizeof(int64_t));
+    memcpy(filled, memo->directFilled, memo->directCapacity);
+    free(memo->directValues);
+    free(memo->directFilled);
+  }
+  memo->directValues = values;
+  memo->directFilled = filled;
+  memo->directCapacity = capacity;
+}
+
+static void resize(Memo* memo, uint64_t capacity) {
+  int64_t* oldSlots = memo->slots;
+  uint8_t* oldFilled = memo->filled;
+  uint64_t oldCapacity = memo->capacity;
+  size_t slotBytes = (memo->argCount + 1) * sizeof(int64_t);
+  memo->slots = allocateOrDie(memo, capacity * slotBytes);
+  memo->filled = allocateOrDie(memo, capacity);
+  memo->capacity = capacity;
+  for (uint64_t i = 0; i < oldCapacity; i++) {
+    if (!oldFilled[i])
+      continue;
+    const int64_t* slot = oldSlots + i * (memo->argCount + 1);
+    uint64_t index = findSlot(memo, slot);
+    memo->filled[index] = 1;
+    memcpy(slotAt(memo, index), slot, slotBytes);
+  }
+  free(oldSlots);
+  free(oldFilled);
+}
+
+Memo* memo_new(const char* name, int32_t argCount, bool integerArg) {
+  if (statsRequested < 0) {
+    statsRequested = getenv("DIPLOMA_MEMO_STATS") != NULL;
+    if (statsRequested)
+      atexit(memo_print_stats);
+  }
+
+  size_t nameSize = strlen(name) + 1;
+  Memo* memo = calloc(1, sizeof(Memo) + nameSize);
+  if (memo == NULL) {
+    fprintf(stderr, "out of memory for the cache of '%s'\n", name);
+    abort();
+  }
+  memo->name = memcpy(memo + 1, name, nameSize);
+  memo->argCount = argCount;
+  memo->integerArg = integerArg && argCount == 1;
+  const char* limit = getenv("DIPLOMA_MEMO_LIMIT");
+  memo->limit = limit != NULL ? strtoll(limit, NULL, 10) : DEFAULT_LIMIT;
+  if (memo->limit < 1)
+    memo->limit = DEFAULT_LIMIT;
+  *lastMemo = memo;
+  lastMemo = &memo->next;
+  return memo;
+}
+
+bool memo_find(Memo* memo, const int64_t* args, int64_t* result) {
+  if (isDirect(memo, args)) {
+    int64_t key = args[0];
+    if (key < memo->directCapacity && memo->directFilled[key]) {
+      memo->hits++;
+      *result = memo->directValues[key];
+      return true;
+    }
+  } else if (memo->capacity > 0) {
+    uint64_t index = findSlot(memo, args);
+    if (memo->filled[index]) {
+      memo->hits++;
+      *result = slotAt(memo, index)[memo->argCount];
+      return true;
+    }
+  }
+  memo->misses++;
+  return false;
+}
+
+void memo_store(Memo* memo, const int64_t* args, int64_t result) {
+  if (isDirect(memo, args)) {
+    int64_t key = args[0];
+    if (key >= memo->directCapacity)
+      growDirect(memo, key);
+    memo->directFilled[key] = 1;
+    memo->directValues[key] = result;
+    return;
+  }
+
+  if (memo->size >= memo->limit) { // the old results go, the recent ones are the likely ones to come again
+    memset(memo->filled, 0, memo->capacity);
+    memo->size = 0;
+    memo->clears++;
+  }
+  if ((uint64_t)(memo->size + 1) * 2 > memo->capacity)
+    resize(memo, memo->capacity > 0 ? memo->capacity * 2 : 16);
+  uint64_t index = findSlot(memo, args);
+  int64_t* slot = slotAt(memo, index);
+  if (!memo->filled[index]) {
+    memo->filled[index] = 1;
+    memo->size++;
+    memcpy(slot, args, memo->argCount * sizeof(int64_t));
+  }
+  slot[memo->argCount] = result;
+}
+
+void memo_print_stats(void) {
+  for (Memo* memo = firstMemo; memo != NULL; memo = memo->next) {
+    int64_t direct = 0;
+    for (int64_t i = 0; i < memo->directCapacity; i++) {
+      direct += memo->directFilled[i];
+    }
+    fprintf(
+      stderr,
+      "memo %s: %llu hits, %llu misses, %lld cached (%lld by index), %llu clears\n",
+      memo->name,
+      (unsigned long long)memo->hits,
+      (unsigned long long)memo->misses,
+      (long long)(memo->size + direct),
+      (long long)direct,
+      (unsigned long long)memo->clears
+    );
+  }
+}
@@ -0,0 +1,142 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+
+#define OUTPUT_CAPACITY (1 << 16)
+
+static char output[OUTPUT_CAPACITY];
+static size_t outputSize = 0;
+static int32_t lineLength = 0;
+static int isTerminal = -1; // unknown until the first write
+
+static void writeAll(const char* bytes, size_t count) {
+  while (count > 0) {
+    int written = write(1, bytes, count);
+    if (written <= 0)
+      return; // nowhere to report it
+    bytes += written;
+    count -= written;
+  }
+}
+
+void flush_output(void) {
+  writeAll(output, outputSize);
+  outputSize = 0;
+}
+
+// room for at least count bytes
+static char* reserve(size_t count) {
+  if (isTerminal < 0) {
+    isTerminal = isatty(1);
+    atexit(flush_output);
+  }
+  if (outputSize + count > OUTPUT_CAPACITY)
+    flush_output();
+  return output + outputSize;
+}
+
+static void commit(size_t count) {
+  outputSize += count;
+  lineLength += count;
+}
+
+static void writeBytes(const char* value, size_t size) {
+  if (size > OUTPUT_CAPACITY / 2) {
+    flush_output();
+    writeAll(value, size);
+    lineLength += size;
+    return;
+  }
+  memcpy(reserve(size), value, size);
+  commit(size);
+}
+
+void write_i32(int32_t value) {
+  char digits[10];
+  int count = 0;
+  uint32_t rest = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+  do {
+    digits[count++] = '0' + rest % 10;
+    rest /= 10;
+  } while (rest != 0);
+
+  char* cursor = reserve(11);
+  size_t size = 0;
+  if (value < 0)
+    cursor[size++] = '-';
+  while (count > 0)
+    cursor[size++] = digits[--count];
+  commit(size);
+}
+
+// 64-bit division is slower, so i32 keeps its own loop
+static void writeWide(uint64_t rest, bool negative) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + rest % 10;
+    rest /= 10;
+  } while (rest != 0);
+
+  char* cursor = reserve(21);
+  size_t size = 0;
+  if (negative)
+    cursor[size++] = '-';
+  while (count > 0)
+    cursor[size++] = digits[--count];
+  commit(size);
+}
+
+void write_i64(int64_t value) {
+  writeWide(value < 0 ? 0u - (uint64_t)value : (uint64_t)value, value < 0);
+}
+
+void write_u64(uint64_t value) {
+  writeWide(value, false);
+}
+
+void write_f64(double value) {
+  char* cursor = reserve(64);
+  int size = snprintf(cursor, 64, "%f", value);
+  if (size >= 64) { // huge values take up to ~320 chars
+    char* big = malloc(size + 1);
+    snprintf(big, size + 1, "%f", value);
+    writeBytes(big, size);
+    free(big);
+    return;
+  }
+  commit(size);
+}
+
+void write_bool(bool value) {
+  *reserve(1) = value ? '1' : '0';
+  commit(1);
+}
+
+void write_str(const Str* value) {
+  writeBytes(str_data(value), str_size(value));
+}
+
+void write_ptr(const void* value) {
+  char* cursor = reserve(32);
+  commit(snprintf(cursor, 32, "%p", value));
+}
+
+int32_t write_ln(void) {
+  *reserve(1) = '\n';
+  commit(1);
+  int32_t result = lineLength;
+  lineLength = 0;
+  if (isTerminal)
+    flush_output();
+  return result;
+}
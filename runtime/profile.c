@@ -0,0 +1,34 @@
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* profilePath;
+static const char* profileNames;
+static const uint64_t* profileCounters;
+static int32_t profileCount;
+
+static void writeProfile(void) {
+  FILE* file = fopen(profilePath, "w");
+  if (file == NULL) {
+    fprintf(stderr, "can't write the profile to %s\n", profilePath);
+    return;
+  }
+  fprintf(file, "# diploma profile, %d counters\n", profileCount);
+  const char* name = profileNames;
+  for (int32_t i = 0; i < profileCount; i++) {
+    const char* end = strchr(name, '\n');
+    fprintf(file, "%.*s %llu\n", (int)(end - name), name, (unsigned long long)profileCounters[i]);
+    name = end + 1;
+  }
+  fclose(file);
+}
+
+void profile_register(const char* path, const char* names, const uint64_t* counters, int32_t count) {
+  const char* override = getenv("DIPLOMA_PROFILE");
+  profilePath = override != NULL ? override : path;
+  profileNames = names;
+  profileCounters = counters;
+  profileCount = count;
+  atexit(writeProfile);
+}
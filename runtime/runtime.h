@@ -0,0 +1,150 @@
+#ifndef RUNTIME
+#define RUNTIME
+
+// functions the generated programs are linked with
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a string value, 16 bytes on little endian targets: up to 15 bytes live inside of it and the last byte is
+// the size; longer ones point to their bytes, which end with '\0', and keep the size in the second word,
+// STR_LONG set in the top byte; strings of up to 15 bytes are always kept inside, so equal ones have equal words;
+// the bytes made at run time come from ref_alloc and have STR_OWNED set too, every copy kept somewhere holds
+// a share of them, the bytes of literals are never freed
+typedef union {
+  uint64_t words[2];
+  char bytes[16];
+} Str;
+
+#define STR_INLINE 15
+#define STR_LONG 0x80
+#define STR_OWNED 0x40
+
+static inline uint64_t str_size(const Str* value) {
+  uint8_t tag = (uint8_t)value->bytes[15];
+  return tag & STR_LONG ? value->words[1] & ~((uint64_t)0xff << 56) : tag;
+}
+
+static inline const char* str_data(const Str* value) {
+  return (uint8_t)value->bytes[15] & STR_LONG ? (const char*)(uintptr_t)value->words[0] : value->bytes;
+}
+
+// the bytes are new and owned by the result, short results don't allocate
+void str_concat(Str* result, const Str* left, const Str* right);
+// the printf format with its args into a string of exactly the size it needs
+void str_format(Str* result, const char* format, ...);
+bool str_equal(const Str* left, const Str* right);
+// by the bytes as unsigned, <0, 0 or >0 like memcmp
+int32_t str_compare(const Str* left, const Str* right);
+uint64_t str_hash(const Str* value);
+// a share of the owned bytes, nothing for short strings and literals
+void str_retain(const Str* value);
+void str_release(const Str* value);
+
+// buffered stdout, flushed when full, on exit, and on each line if stdout is a terminal
+void flush_output(void);
+void write_i32(int32_t value);
+void write_i64(int64_t value);
+void write_u64(uint64_t value);
+void write_f64(double value);
+void write_bool(bool value);
+void write_str(const Str* value);
+void write_ptr(const void* value);
+// ends the line, returns the number of bytes written since the previous one
+int32_t write_ln(void);
+
+// heap for uniq/shar/weak refs, small values come from per-thread size class pools
+
+#define REF_ATOMIC 1 // counters may be touched by several threads
+#define REF_DROP 2   // the value starts with a void (*)(void*) that frees what it holds when the last owner lets go
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t pooled; // allocations served from a free list
+  uint64_t slabs;  // chunks taken from malloc for the pools
+  uint64_t large;  // values too big for the pools
+  uint64_t liveBytes;
+  uint64_t peakBytes;
+} RefStats;
+
+// not synchronized, counts are approximate when several threads allocate
+extern RefStats ref_stats;
+
+// the value has one strong owner on return
+void* ref_alloc(int64_t size, int32_t flags);
+void ref_retain(void* value);
+void ref_release(void* value);
+void ref_weak_retain(void* value);
+void ref_weak_release(void* value);
+bool ref_alive(const void* value);
+// also printed to stderr at exit when DIPLOMA_HEAP_STATS is set
+void ref_print_stats(void);
+
+// maps of the language, open addressing over groups of 16 control bytes, one per slot: empty, deleted or
+// 7 bits of the hash of the key in it, a lookup compares the whole group at once; the map itself comes from
+// ref_alloc, the values are valueSize bytes and go in and out through the slot pointers the functions give,
+// a slot is valid until the next put or remove; the map holds a share of the str keys it keeps and, with
+// MAP_STR_VALUES, of the str values in its slots, they are released when removed and when the map is dropped
+
+#define MAP_I32 0
+#define MAP_F64 1 // -0 and 0 are the same key, NaN is never found, like with ==
+#define MAP_STR 2
+#define MAP_STR_VALUES 0x100 // or'ed into the key kind, the values are Str
+
+typedef struct Map Map;
+
+Map* map_new(int32_t keyKind, int32_t valueSize);
+int64_t map_size(const Map* map);
+// the slot of the key, a zeroed one if the key is new
+void* map_put_i32(Map* map, int32_t key);
+void* map_put_f64(Map* map, double key);
+void* map_put_str(Map* map, const Str* key);
+// the slot, NULL if there is no such key
+void* map_find_i32(const Map* map, int32_t key);
+void* map_find_f64(const Map* map, double key);
+void* map_find_str(const Map* map, const Str* key);
+// false if there was no such key
+bool map_remove_i32(Map* map, int32_t key);
+bool map_remove_f64(Map* map, double key);
+bool map_remove_str(Map* map, const Str* key);
+// iteration: the first full slot at the position or after it, -1 at the end; the key of the slot there
+int64_t map_next(const Map* map, int64_t position);
+const void* map_key(const Map* map, int64_t position);
+
+// caches of the functions marked 'memo': the args of a call, each widened to 64 bits, are the key of the result
+// bits; a single integer arg from 0 to MEMO_DIRECT indexes an array, anything else goes to a hash table that
+// is cleared when it holds DIPLOMA_MEMO_LIMIT results (a million by default)
+
+#define MEMO_DIRECT 65536
+
+typedef struct Memo Memo;
+
+Memo* memo_new(const char* name, int32_t argCount, bool integerArg);
+// true and the result if the args were stored before
+bool memo_find(Memo* memo, const int64_t* args, int64_t* result);
+void memo_store(Memo* memo, const int64_t* args, int64_t result);
+// hits, misses and cached results of every memo function, also printed to stderr at exit when
+// DIPLOMA_MEMO_STATS is set
+void memo_print_stats(void);
+
+// counters of a program built with --profile-generate, names are separated by '\n',
+// "name count" lines go to the path (or DIPLOMA_PROFILE) at exit for --profile-use
+void profile_register(const char* path, const char* names, const uint64_t* counters, int32_t count);
+
+// a program built with --profile-calls reports entering and leaving every function, the names are separated
+// by '\n' and named after the source line; at exit the self time, total time and calls of every function
+// go to stderr and the stacks to the path (or DIPLOMA_CALLS) as folded lines for flame graph tools
+void calls_register(const char* path, const char* names, int32_t count);
+void calls_enter(int32_t function);
+void calls_exit(int32_t function);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RUNTIME
@@ -0,0 +1,163 @@
+#include "runtime.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static int lowestBit(uint64_t value) {
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return (int)index;
+}
+#else
+#define lowestBit(value) __builtin_ctzll(value)
+#endif
+
+static void makeShort(Str* result, const char* bytes, size_t size) {
+  Str value = {{0, 0}}; // the unused bytes stay zero, equal strings have equal words
+  memcpy(value.bytes, bytes, size);
+  value.bytes[15] = (char)size;
+  *result = value;
+}
+
+// the bytes are from allocateBytes, the result holds the only share of them
+static void makeLong(Str* result, const char* bytes, size_t size) {
+  result->words[0] = (uintptr_t)bytes;
+  result->words[1] = (uint64_t)size | (uint64_t)(STR_LONG | STR_OWNED) << 56;
+}
+
+static char* allocateBytes(size_t size) {
+  return ref_alloc((int64_t)size + 1, 0);
+}
+
+static bool isOwned(const Str* value) {
+  return ((uint8_t)value->bytes[15] & STR_OWNED) != 0; // never set in the size of a short one
+}
+
+// where the first different byte is, size if there is none; 16 bytes at a time, the tail is the last 16 again
+static size_t mismatch(const char* left, const char* right, size_t size) {
+  size_t i = 0;
+#ifdef HAVE_SSE2
+  if (size >= 16) {
+    for (;; i += 16) {
+      if (i + 16 > size)
+        i = size - 16;
+      __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+      uint32_t different = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(l, r)) ^ 0xffff;
+      if (different != 0)
+        return i + lowestBit(different);
+      if (i + 16 == size)
+        return size;
+    }
+  }
+#else
+  for (; i + 8 <= size; i += 8) {
+    uint64_t l, r;
+    memcpy(&l, left + i, 8);
+    memcpy(&r, right + i, 8);
+    if (l != r)
+      return i + lowestBit(l ^ r) / 8; // little endian, the lowest byte comes first
+  }
+#endif
+  for (; i < size; i++) {
+    if (left[i] != right[i])
+      return i;
+  }
+  return size;
+}
+
+void str_concat(Str* result, const Str* left, const Str* right) {
+  size_t leftSize = str_size(left), rightSize = str_size(right), size = leftSize + rightSize;
+  if (size <= STR_INLINE) {
+    char bytes[STR_INLINE];
+    memcpy(bytes, str_data(left), leftSize);
+    memcpy(bytes + leftSize, str_data(right), rightSize);
+    makeShort(result, bytes, size);
+    return;
+  }
+  char* bytes = allocateBytes(size);
+  memcpy(bytes, str_data(left), leftSize);
+  memcpy(bytes + leftSize, str_data(right), rightSize);
+  bytes[size] = '\0';
+  makeLong(result, bytes, size);
+}
+
+void str_format(Str* result, const char* format, ...) {
+  va_list args, again;
+  va_start(args, format);
+  va_copy(again, args);
+  char small[STR_INLINE + 1];
+  int size = vsnprintf(small, sizeof(small), format, args);
+  va_end(args);
+  if (size < 0)
+    size = 0;
+  if (size <= STR_INLINE) {
+    makeShort(result, small, size);
+  } else {
+    char* bytes = allocateBytes(size);
+    vsnprintf(bytes, size + 1, format, again);
+    makeLong(result, bytes, size);
+  }
+  va_end(again);
+}
+
+bool str_equal(const Str* left, const Str* right) {
+  if (left->words[0] == right->words[0] && left->words[1] == right->words[1])
+    return true;
+  // short ones are equal only with equal words, an owned long one can be equal to a literal
+  uint8_t leftTag = (uint8_t)left->bytes[15], rightTag = (uint8_t)right->bytes[15];
+  size_t size = str_size(left);
+  if (!(leftTag & rightTag & STR_LONG) || size != str_size(right))
+    return false;
+  return mismatch(str_data(left), str_data(right), size) == size;
+}
+
+int32_t str_compare(const Str* left, const Str* right) {
+  size_t leftSize = str_size(left), rightSize = str_size(right);
+  size_t common = leftSize < rightSize ? leftSize : rightSize;
+  const char* l = str_data(left);
+  const char* r = str_data(right);
+  size_t at = l == r ? common : mismatch(l, r, common);
+  if (at < common)
+    return (uint8_t)l[at] < (uint8_t)r[at] ? -1 : 1;
+  return leftSize < rightSize ? -1 : leftSize > rightSize ? 1 : 0;
+}
+
+static uint64_t mix(uint64_t hash, uint64_t word) {
+  hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+  return hash ^ hash >> 32;
+}
+
+uint64_t str_hash(const Str* value) {
+  if (!((uint8_t)value->bytes[15] & STR_LONG)) // the words are the whole string
+    return mix(mix(0x9e3779b97f4a7c15ull, value->words[0]), value->words[1]);
+  size_t size = str_size(value);
+  const char* bytes = str_data(value);
+  uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = mix(hash, word);
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, bytes + i, size - i);
+  return mix(hash, tail);
+}
+
+void str_retain(const Str* value) {
+  if (isOwned(value))
+    ref_retain((void*)(uintptr_t)value->words[0]);
+}
+
+void str_release(const Str* value) {
+  if (isOwned(value))
+    ref_release((void*)(uintptr_t)value->words[0]);
+}
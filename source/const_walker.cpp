@@ -0,0 +1,294 @@
+#ifndef CONST_WALKER
+#define CONST_WALKER
+
+#include "syntax_tree.hpp"
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+namespace Diploma {
+
+// evaluates expressions known at compile time,
+// the result is bool, int32_t, double or std::string, empty any if value is unknown until runtime;
+// numbers of the other widths are left for runtime
+class ConstWalker : public TreeWalker {
+public:
+  void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) {
+      expr->visit(this);
+    }
+  }
+
+  // same text printf gives for the value at runtime
+  static std::string toText(std::any value) {
+    if (value.type() == typeid(bool))
+      return std::to_string((int)std::any_cast<bool>(value));
+    if (value.type() == typeid(int32_t))
+      return std::to_string(std::any_cast<int32_t>(value));
+    if (value.type() == typeid(double)) {
+      auto real = std::any_cast<double>(value);
+      std::string text(std::snprintf(nullptr, 0, "%f", real), '\0');
+      std::snprintf(text.data(), text.size() + 1, "%f", real);
+      return text;
+    }
+    if (value.type() == typeid(std::string))
+      return std::any_cast<std::string>(value);
+    return "";
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return boolExpr->value;
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    if (intExpr->type == R64) // met a real one
+      return (double)(int64_t)intExpr->value;
+    if (intExpr->type != I32)
+      return {};
+    return (int32_t)intExpr->value;
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    if (realExpr->type != R64)
+      return {};
+    return realExpr->value;
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return strExpr->value;
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    std::string text = "";
+    for (auto part : formatExpr->parts) {
+      auto value = part->visit(this);
+      if (!value.has_value())
+        return {};
+      text += toText(value);
+    }
+    return text;
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    return {};
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    return {};
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    return {};
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    auto value = unaryExpr->value->visit(this);
+    if (value.type() == typeid(int32_t)) {
+      auto i = std::any_cast<int32_t>(value);
+      if (unaryExpr->oper.grapheme == MINUS)
+        return (int32_t)(0u - (uint32_t)i);
+      if (unaryExpr->oper.grapheme == PLUS)
+        return i;
+    } else if (value.type() == typeid(double)) {
+      auto r = std::any_cast<double>(value);
+      if (unaryExpr->oper.grapheme == MINUS)
+        return -r;
+      if (unaryExpr->oper.grapheme == PLUS)
+        return r;
+    }
+    return {};
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    return {};
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    auto left = comparisonExpr->left->visit(this);
+    auto right = comparisonExpr->right->visit(this);
+    auto oper = comparisonExpr->oper.grapheme;
+
+    if (left.type() == typeid(std::string) && right.type() == typeid(std::string)) {
+      return compare(oper, std::any_cast<std::string>(left), std::any_cast<std::string>(right));
+    }
+
+    if (isInt(left) && isInt(right)) {
+      auto l = std::any_cast<int32_t>(left);
+      auto r = std::any_cast<int32_t>(right);
+      return compare(oper, l, r);
+    }
+    if (isNumber(left) && isNumber(right)) {
+      return compare(oper, toReal(left), toReal(right));
+    }
+    return {};
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    auto left = binaryExpr->left->visit(this);
+    auto right = binaryExpr->right->visit(this);
+    auto oper = binaryExpr->oper.grapheme;
+
+    if (left.type() == typeid(std::string) && right.type() == typeid(std::string)) {
+      if (oper == PLUS)
+        return std::any_cast<std::string>(left) + std::any_cast<std::string>(right);
+      return {};
+    }
+    if (isInt(left) && isInt(right)) {
+      auto l = std::any_cast<int32_t>(left);
+      auto r = std::any_cast<int32_t>(right);
+      if (oper == SLASH && r == 0)
+        return {}; // leave it for runtime
+      return calculate(oper, l, r);
+    }
+    if (isNumber(left) && isNumber(right)) {
+      return calculate(oper, toReal(left), toReal(right));
+    }
+    return {};
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    auto left = logicalExpr->left->visit(this);
+    if (left.type() != typeid(bool))
+      return {};
+    auto l = std::any_cast<bool>(left);
+    if (logicalExpr->oper.grapheme == OR && l)
+      return true;
+    if (logicalExpr->oper.grapheme == AND && !l)
+      return false;
+
+    auto right = logicalExpr->right->visit(this);
+    if (right.type() != typeid(bool))
+      return {};
+    return std::any_cast<bool>(right);
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    return {};
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    return {};
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    return {};
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    return {};
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    return {};
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    return {};
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    return {};
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    return {};
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    return {};
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    return {};
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    return {};
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    return {};
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    return {};
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    return {};
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    return {};
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    return {};
+  }
+
+private:
+  static bool isInt(const std::any& value) {
+    return value.type() == typeid(int32_t);
+  }
+
+  static bool isNumber(const std::any& value) {
+    return isInt(value) || value.type() == typeid(double);
+  }
+
+  static double toReal(const std::any& value) {
+    return isInt(value) ? std::any_cast<int32_t>(value) : std::any_cast<double>(value);
+  }
+
+  template <typename T> static std::any compare(Grapheme oper, T l, T r) {
+    switch (oper) {
+    case EQUAL_EQUAL:
+      return l == r;
+    case BANG_EQUAL:
+      return l != r;
+    case LESS:
+      return l < r;
+    case LESS_EQUAL:
+      return l <= r;
+    case GREATER:
+      return l > r;
+    case GREATER_EQUAL:
+      return l >= r;
+    default:
+      return {};
+    }
+  }
+
+  template <typename T> static std::any calculate(Grapheme oper, T l, T r) {
+    if constexpr (std::is_integral_v<T>) { // wraps around like the generated code does
+      auto ul = (uint32_t)l, ur = (uint32_t)r;
+      switch (oper) {
+      case STAR:
+        return (T)(ul * ur);
+      case SLASH:
+        return r == -1 ? (T)(0u - ul) : (T)(l / r);
+      case PLUS:
+        return (T)(ul + ur);
+      case MINUS:
+        return (T)(ul - ur);
+      default:
+        return {};
+      }
+    }
+    switch (oper) {
+    case STAR:
+      return (T)(l * r);
+    case SLASH:
+      return (T)(l / r);
+    case PLUS:
+      return (T)(l + r);
+    case MINUS:
+      return (T)(l - r);
+    default:
+      return {};
+    }
+  }
+};
+
+} // namespace Diploma
+
+#endif // CONST_WALKER
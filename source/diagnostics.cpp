@@ -0,0 +1,16 @@
+#include "diagnostics.hpp"
+#include <iostream>
+
+namespace Diploma {
+
+static thread_local std::ostream* diagnosticsOut = nullptr;
+
+std::ostream& diagnostics() {
+  return diagnosticsOut != nullptr ? *diagnosticsOut : std::cout;
+}
+
+void setDiagnostics(std::ostream* out) {
+  diagnosticsOut = out;
+}
+
+} // namespace Diploma
@@ -0,0 +1,378 @@
+#include "syntax_tree.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace Diploma {
+
+// decides which refs, objects and closure environments can live on the stack of the function that creates them,
+// they escape when returned, passed to a call that keeps them, stored in another ref or object,
+// shared with a copy (shar), watched by a weak ref or captured by an escaping closure;
+// also finds the variables every function captures; runs after TypeWalker
+class EscapeWalker : public TreeWalker {
+  // RefExpr, NewObjExpr, FuncExpr or MapExpr, nullptr stands for one from outside of the function
+  using Refs = std::set<Expr*>;
+
+  std::map<std::string, Refs> vars;
+  std::map<std::string, FuncExpr*> functions;
+  Refs created; // refs allocated by the current function
+  std::set<std::string> fields; // of the type whose methods are walked
+
+  struct Frame {
+    FuncExpr* func;
+    std::set<std::string> locals;
+  };
+  std::vector<Frame> frames;                          // functions the walker is inside of
+  std::set<std::string> topFunctions;                 // called directly if they capture nothing
+  std::map<Expr*, std::pair<FuncExpr*, int>> params;  // stand for the args inside of a function
+  std::set<FuncExpr*> walking;
+  int loops = 0; // an assignment in a loop body can outlive the ref the next round makes in the same place
+
+public:
+  bool keepTopLevel = false; // in a REPL top level variables outlive the line that sets them
+
+  void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) {
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      if (newVar != nullptr && dynamic_cast<FuncExpr*>(newVar->value) != nullptr) {
+        topFunctions.insert(newVar->identifier.value);
+        functions[newVar->identifier.value] = (FuncExpr*)newVar->value;
+      }
+    }
+    for (auto expr : syntax) {
+      expr->visit(this);
+    }
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return Refs();
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    return Refs();
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    return Refs();
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return Refs();
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    for (auto part : formatExpr->parts) {
+      part->visit(this);
+    }
+    return Refs();
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    auto refs = bind(newVarExpr->value);
+    vars[newVarExpr->identifier.value] = refs;
+    if (!frames.empty())
+      frames.back().locals.insert(newVarExpr->identifier.value);
+    if (auto func = dynamic_cast<FuncExpr*>(newVarExpr->value))
+      functions[newVarExpr->identifier.value] = func;
+    return refs;
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    auto refs = bind(varAssignExpr->value);
+    if (fields.count(varAssignExpr->identifier.value) > 0 || loops > 0)
+      escape(refs);
+    vars[varAssignExpr->identifier.value].insert(refs.begin(), refs.end());
+    return refs;
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    capture(varExpr->identifier.value);
+    return vars[varExpr->identifier.value];
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    unaryExpr->value->visit(this);
+    return Refs();
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    castExpr->value->visit(this);
+    return Refs();
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    comparisonExpr->left->visit(this);
+    comparisonExpr->right->visit(this);
+    return Refs();
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    binaryExpr->left->visit(this);
+    binaryExpr->right->visit(this);
+    return Refs();
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    logicalExpr->left->visit(this);
+    logicalExpr->right->visit(this);
+    return Refs();
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    ifElseExpr->condition->visit(this);
+    auto refs = std::any_cast<Refs>(ifElseExpr->thenBlock->visit(this));
+    if (ifElseExpr->elseBlock != nullptr) {
+      auto elseRefs = std::any_cast<Refs>(ifElseExpr->elseBlock->visit(this));
+      refs.insert(elseRefs.begin(), elseRefs.end());
+    }
+    return refs;
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    auto last = Refs();
+    for (auto expr : blockExpr->list) {
+      last = std::any_cast<Refs>(expr->visit(this));
+    }
+    return last;
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    auto oldVars = vars;
+    auto oldCreated = created;
+    auto oldLoops = loops;
+    created.clear();
+    loops = 0;
+    frames.push_back({funcExpr, {}});
+    walking.insert(funcExpr);
+    funcExpr->argsEscape.assign(funcExpr->args.size(), false);
+    for (auto i = 0; i < funcExpr->args.size(); i++) {
+      auto param = new VarExpr(funcExpr->args[i]);
+      params[param] = {funcExpr, i};
+      vars[funcExpr->args[i].value] = {param};
+      frames.back().locals.insert(funcExpr->args[i].value);
+    }
+
+    auto returned = std::any_cast<Refs>(funcExpr->body->visit(this));
+    escape(returned);
+    funcExpr->returnsOwned = !returned.empty() && !funcExpr->generator; // a generator returns its frame
+    for (auto ref : returned) {
+      if (created.count(ref) == 0)
+        funcExpr->returnsOwned = false;
+    }
+    if (funcExpr->generator) // the frame keeps them after the call
+      funcExpr->argsEscape.assign(funcExpr->args.size(), true);
+
+    vars = oldVars;
+    created = oldCreated;
+    loops = oldLoops;
+    frames.pop_back();
+    walking.erase(funcExpr);
+
+    funcExpr->escapes = false;
+    if (funcExpr->captures.empty())
+      return Refs();
+    for (auto name : funcExpr->captures) { // copied into the environment
+      escape(vars[name]);
+    }
+    created.insert(funcExpr);
+    return Refs{funcExpr};
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    auto func = dynamic_cast<FuncExpr*>(callExpr->func);
+    if (auto var = dynamic_cast<VarExpr*>(callExpr->func)) {
+      auto known = functions.find(var->identifier.value);
+      if (known != functions.end())
+        func = known->second;
+    }
+    callExpr->func->visit(this);
+
+    auto known = func != nullptr && walking.count(func) == 0; // a recursive call keeps everything
+    for (auto i = 0; i < callExpr->args.size(); i++) {
+      auto refs = std::any_cast<Refs>(callExpr->args[i]->visit(this));
+      if (known && i < func->argsEscape.size() && !func->argsEscape[i]) { // only borrowed for the call
+        for (auto ref : refs) {
+          if (created.count(ref) != 0)
+            callExpr->lent.emplace_back(ref);
+        }
+        continue;
+      }
+      escape(refs);
+      if (func == nullptr) { // nobody knows where it goes
+        for (auto ref : refs) {
+          if (auto refExpr = dynamic_cast<RefExpr*>(ref))
+            refExpr->atomic = true;
+        }
+      }
+    }
+
+    callExpr->ownsResult = func != nullptr && func->returnsOwned;
+    return callExpr->ownsResult ? Refs{nullptr} : Refs();
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    for (auto v : printlnExpr->values) {
+      v->visit(this);
+    }
+    return Refs();
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    auto inner = std::any_cast<Refs>(refExpr->value->visit(this));
+    escape(inner);
+    if (refExpr->kind == WEAK)
+      return Refs();
+
+    refExpr->escapes = false;
+    created.insert(refExpr);
+    return Refs{refExpr};
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    derefExpr->ref->visit(this);
+    return outside(derefExpr);
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    for (auto a : typeExpr->baseArgs) {
+      escape(std::any_cast<Refs>(a->visit(this)));
+    }
+    for (auto field : typeExpr->fields) {
+      escape(std::any_cast<Refs>(field->value->visit(this)));
+    }
+    auto oldFields = fields;
+    for (auto t = typeExpr; t != nullptr; t = t->base) {
+      for (auto [name, type] : t->ownFields) {
+        fields.insert(name);
+      }
+    }
+    for (auto [name, method] : typeExpr->methods) {
+      method->visit(this);
+    }
+    fields = oldFields;
+    return Refs();
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    for (auto a : newObjExpr->args) {
+      escape(std::any_cast<Refs>(a->visit(this)));
+    }
+    newObjExpr->escapes = false;
+    created.insert(newObjExpr);
+    return Refs{newObjExpr};
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    memberExpr->object->visit(this);
+    return outside(memberExpr);
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    memberAssignExpr->object->visit(this);
+    escape(std::any_cast<Refs>(memberAssignExpr->value->visit(this)));
+    return Refs();
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    if (!methodCallExpr->throughBase)
+      methodCallExpr->object->visit(this); // 'this' can't be kept by the method
+    for (auto arg : methodCallExpr->args) {
+      escape(std::any_cast<Refs>(arg->visit(this)));
+    }
+    return outside(methodCallExpr);
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    auto refs = std::any_cast<Refs>(yieldExpr->value->visit(this));
+    escape(refs); // read by the 'for' after the generator is suspended
+    return refs;
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    forExpr->source->visit(this);
+    auto name = forExpr->item.value;
+    vars[name] = isPointer(forExpr->itemType) ? Refs{nullptr} : Refs();
+    if (!frames.empty())
+      frames.back().locals.insert(name);
+    loops++;
+    forExpr->body->visit(this);
+    loops--;
+    return Refs();
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    whileExpr->condition->visit(this);
+    loops++;
+    whileExpr->body->visit(this);
+    loops--;
+    return Refs();
+  }
+
+  // always on the heap, it grows; only tracked so a function that returns a new one hands it over
+  std::any visitMap(MapExpr* mapExpr) {
+    for (auto& [key, value] : mapExpr->entries) {
+      key->visit(this);
+      escape(std::any_cast<Refs>(value->visit(this)));
+    }
+    created.insert(mapExpr);
+    return Refs{mapExpr};
+  }
+
+private:
+  void escape(const Refs& refs) {
+    for (auto ref : refs) {
+      if (auto refExpr = dynamic_cast<RefExpr*>(ref))
+        refExpr->escapes = true;
+      if (auto newObjExpr = dynamic_cast<NewObjExpr*>(ref))
+        newObjExpr->escapes = true;
+      if (auto funcExpr = dynamic_cast<FuncExpr*>(ref))
+        funcExpr->escapes = true;
+      if (params.count(ref) != 0)
+        params[ref].first->argsEscape[params[ref].second] = true;
+    }
+  }
+
+  // a variable of an enclosing scope is captured by every function between that scope and the use
+  void capture(std::string name) {
+    if (frames.empty() || fields.count(name) != 0)
+      return;
+    auto definedIn = -1;
+    for (auto i = (int)frames.size() - 1; i >= 0; i--) {
+      if (frames[i].locals.count(name) != 0) {
+        definedIn = i;
+        break;
+      }
+    }
+    if (definedIn == -1) { // top level
+      if (vars.count(name) == 0)
+        return;
+      if (topFunctions.count(name) != 0 && functions[name]->captures.empty())
+        return;
+    }
+    for (auto i = definedIn + 1; i < frames.size(); i++) {
+      auto& captures = frames[i].func->captures;
+      if (std::find(captures.begin(), captures.end(), name) == captures.end())
+        captures.emplace_back(name);
+    }
+  }
+
+  static bool isPointer(ExprType type) {
+    return type == UNIQ_REF || type == SHAR_REF || type == OBJ || type == MAP;
+  }
+
+  static Refs outside(Expr* expr) {
+    return isPointer(expr->type) ? Refs{nullptr} : Refs();
+  }
+
+  // value that gets a name, copies of shar refs share the counter, so the original goes to heap
+  Refs bind(Expr* value) {
+    auto refs = std::any_cast<Refs>(value->visit(this));
+    if (value->type == SHAR_REF && dynamic_cast<RefExpr*>(value) == nullptr)
+      escape(refs);
+    if (keepTopLevel && frames.empty())
+      escape(refs);
+    return refs;
+  }
+};
+
+} // namespace Diploma
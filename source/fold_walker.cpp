@@ -0,0 +1,483 @@
+#include "const_walker.cpp"
+#include "diagnostics.hpp"
+#include "syntax_tree.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Diploma {
+
+// runs a pure function on the values ConstWalker knows: the args and the variables of the body
+// live in a frame of their own, anything it can't compute or too much work makes the result empty
+class CallEvaluator : public ConstWalker {
+  const std::map<std::string, FuncExpr*>& functions; // pure top level ones
+  std::vector<std::map<std::string, std::any>> frames = {{}};
+  int steps = 0;
+
+public:
+  static const int maxSteps = 100000;
+  static const int maxDepth = 1000; // calls inside of calls, each one takes the stack of the compiler
+
+  struct Void {}; // what a statement without a value gives, empty means unknown
+
+  CallEvaluator(const std::map<std::string, FuncExpr*>& functions) : functions(functions) {}
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    auto value = newVarExpr->value->visit(this);
+    if (value.has_value())
+      frames.back()[newVarExpr->identifier.value] = value;
+    return value;
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    auto& frame = frames.back();
+    auto found = frame.find(varAssignExpr->identifier.value);
+    if (found == frame.end())
+      return {};
+    return found->second = varAssignExpr->value->visit(this);
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    auto& frame = frames.back();
+    auto found = frame.find(varExpr->identifier.value);
+    return found != frame.end() ? found->second : std::any();
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    auto condition = ifElseExpr->condition->visit(this);
+    if (condition.type() != typeid(bool) || ++steps > maxSteps)
+      return {};
+    if (std::any_cast<bool>(condition))
+      return ifElseExpr->thenBlock->visit(this);
+    if (ifElseExpr->elseBlock == nullptr)
+      return Void();
+    return ifElseExpr->elseBlock->visit(this);
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    auto value = std::any(Void());
+    for (auto expr : blockExpr->list) {
+      value = expr->visit(this);
+      if (!value.has_value() || ++steps > maxSteps)
+        return {};
+    }
+    return value;
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    auto var = dynamic_cast<VarExpr*>(callExpr->func);
+    if (var == nullptr || frames.back().count(var->identifier.value) != 0)
+      return {};
+    auto function = functions.find(var->identifier.value);
+    if (function == functions.end() || function->second->args.size() != callExpr->args.size())
+      return {};
+    if (++steps > maxSteps || frames.size() > maxDepth)
+      return {};
+
+    std::map<std::string, std::any> frame;
+    for (auto i = 0; i < callExpr->args.size(); i++) {
+      auto value = callExpr->args[i]->visit(this);
+      if (!value.has_value())
+        return {};
+      frame[function->second->args[i].value] = value;
+    }
+    frames.emplace_back(std::move(frame));
+    auto result = function->second->body->visit(this);
+    frames.pop_back();
+    return result;
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    while (true) {
+      auto condition = whileExpr->condition->visit(this);
+      if (condition.type() != typeid(bool) || ++steps > maxSteps)
+        return {};
+      if (!std::any_cast<bool>(condition))
+        return Void();
+      if (!whileExpr->body->visit(this).has_value())
+        return {};
+    }
+  }
+};
+
+// replaces calls of pure top level functions with constant args by the value they return,
+// a function is pure when it doesn't print, doesn't change variables it didn't declare,
+// doesn't touch refs or objects and only calls pure functions; runs after TypeWalker;
+// also checks the functions marked 'memo', see checkMemos
+class FoldWalker : public TreeWalker {
+  struct Frame {
+    FuncExpr* func;
+    std::set<std::string> locals;
+  };
+  std::vector<Frame> frames;
+  std::map<std::string, FuncExpr*> topFunctions; // declared once at the top level and never assigned
+  std::set<FuncExpr*> impure;
+  std::map<FuncExpr*, std::set<FuncExpr*>> calls;
+  std::map<std::string, FuncExpr*> pure;
+  std::map<FuncExpr*, std::set<std::string>> reads; // variables from outside of the function
+  std::vector<FuncExpr*> memos;
+  bool folding = false; // the first walk finds out what is pure, the second one folds
+
+public:
+  int folded = 0;
+
+  void Do(std::vector<Expr*> syntax) {
+    std::map<std::string, int> declared;
+    for (auto expr : syntax) {
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      if (newVar == nullptr)
+        continue;
+      auto name = newVar->identifier.value;
+      if (declared[name]++ == 0 && dynamic_cast<FuncExpr*>(newVar->value) != nullptr)
+        topFunctions[name] = (FuncExpr*)newVar->value;
+      else
+        topFunctions.erase(name);
+    }
+
+    for (auto& expr : syntax) {
+      walk(expr);
+    }
+    for (auto changed = true; changed;) { // a function that calls an impure one is impure too
+      changed = false;
+      for (auto& [func, callees] : calls) {
+        for (auto callee : callees) {
+          if (impure.count(callee) != 0 && impure.insert(func).second)
+            changed = true;
+        }
+      }
+    }
+    for (auto [name, func] : topFunctions) {
+      if (impure.count(func) == 0)
+        pure[name] = func;
+    }
+    checkMemos();
+
+    folding = true;
+    for (auto& expr : syntax) {
+      walk(expr);
+    }
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return {};
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    return {};
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    return {};
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return {};
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    walk(formatExpr->parts);
+    return {};
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    walk(newVarExpr->value);
+    if (!frames.empty())
+      frames.back().locals.insert(newVarExpr->identifier.value);
+    return {};
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    walk(varAssignExpr->value);
+    auto name = varAssignExpr->identifier.value;
+    if (frames.empty() || frames.back().locals.count(name) == 0) {
+      markImpure();
+      if (!isLocal(name))
+        topFunctions.erase(name);
+    }
+    return {};
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    auto name = varExpr->identifier.value;
+    if (!frames.empty() && !isLocal(name))
+      reads[frames.back().func].insert(name);
+    return {};
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    walk(unaryExpr->value);
+    return {};
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    walk(castExpr->value);
+    return {};
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    walk(comparisonExpr->left);
+    walk(comparisonExpr->right);
+    return {};
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    walk(binaryExpr->left);
+    walk(binaryExpr->right);
+    return {};
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    walk(logicalExpr->left);
+    walk(logicalExpr->right);
+    return {};
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    walk(ifElseExpr->condition);
+    visit(ifElseExpr->thenBlock);
+    visit(ifElseExpr->elseBlock);
+    return {};
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    walk(blockExpr->list);
+    return {};
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    if (funcExpr->memo && !folding)
+      memos.emplace_back(funcExpr);
+    frames.push_back({funcExpr, {}});
+    for (auto& arg : funcExpr->args) {
+      frames.back().locals.insert(arg.value);
+    }
+    walk(funcExpr->body);
+    frames.pop_back();
+    return {};
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    walk(callExpr->func);
+    walk(callExpr->args);
+    auto callee = topFunction(callExpr);
+    if (callee != nullptr && !frames.empty())
+      calls[frames.back().func].insert(callee);
+    else if (callee == nullptr)
+      markImpure(); // a function value, can be anything
+    return {};
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    walk(printlnExpr->values);
+    markImpure();
+    return {};
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    walk(refExpr->value);
+    markImpure();
+    return {};
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    walk(derefExpr->ref);
+    markImpure();
+    return {};
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    walk(typeExpr->baseArgs);
+    for (auto field : typeExpr->fields) {
+      walk(field->value);
+    }
+    for (auto& [name, method] : typeExpr->methods) {
+      visit(method);
+    }
+    return {};
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    walk(newObjExpr->args);
+    markImpure();
+    return {};
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    walk(memberExpr->object);
+    markImpure();
+    return {};
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    walk(memberAssignExpr->object);
+    walk(memberAssignExpr->value);
+    markImpure();
+    return {};
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    walk(methodCallExpr->object);
+    walk(methodCallExpr->args);
+    markImpure();
+    return {};
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    walk(yieldExpr->value);
+    markImpure(); // a call of a generator makes a frame, it is no value
+    return {};
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    walk(forExpr->source);
+    if (!frames.empty())
+      frames.back().locals.insert(forExpr->item.value);
+    visit(forExpr->body);
+    return {};
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    walk(whileExpr->condition);
+    visit(whileExpr->body);
+    return {};
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    for (auto& [key, value] : mapExpr->entries) {
+      walk(key);
+      walk(value);
+    }
+    markImpure();
+    return {};
+  }
+
+private:
+  void walk(Expr*& expr) {
+    if (expr == nullptr)
+      return;
+    if (folding) {
+      auto call = dynamic_cast<CallExpr*>(expr);
+      auto literal = call != nullptr ? fold(call) : nullptr;
+      if (literal != nullptr) {
+        expr = literal;
+        return;
+      }
+    }
+    expr->visit(this);
+  }
+
+  void walk(std::vector<Expr*>& exprs) {
+    for (auto& expr : exprs) {
+      walk(expr);
+    }
+  }
+
+  // the ones that can't be replaced by a literal
+  void visit(Expr* expr) {
+    if (expr != nullptr)
+      expr->visit(this);
+  }
+
+  bool isLocal(std::string name) {
+    for (auto& frame : frames) {
+      if (frame.locals.count(name) != 0)
+        return true;
+    }
+    return false;
+  }
+
+  void markImpure() {
+    if (!frames.empty())
+      impure.insert(frames.back().func);
+  }
+
+  // a cached result is only right if nothing but the args decides it: the function and everything it calls
+  // are pure and read no variables from outside, the args and the result are numbers or bool;
+  // the ones that are not stay plain functions
+  void checkMemos() {
+    for (auto func : memos) {
+      auto problem = memoProblem(func);
+      if (problem.empty())
+        continue;
+      diagnostics() << problem << "\n";
+      func->memo = false;
+    }
+  }
+
+  std::string memoProblem(FuncExpr* func) {
+    auto named = std::find_if(topFunctions.begin(), topFunctions.end(), [&](auto& entry) {
+      return entry.second == func;
+    });
+    if (named == topFunctions.end()) {
+      return "the function at " + std::to_string(func->line) + ":" + std::to_string(func->column) +
+             " can't be 'memo', only functions declared once at the top level and never assigned can";
+    }
+    auto name = "'" + named->first + "' can't be 'memo', ";
+    if (impure.count(func) != 0)
+      return name + "it or a function it calls prints, changes outer variables or touches refs, objects or maps";
+
+    std::set<FuncExpr*> visited = {func};
+    std::vector<FuncExpr*> stack = {func};
+    while (!stack.empty()) {
+      auto current = stack.back();
+      stack.pop_back();
+      for (auto& read : reads[current]) {
+        if (topFunctions.count(read) == 0)
+          return name + "it reads '" + read + "', which can change between calls";
+      }
+      for (auto callee : calls[current]) {
+        if (visited.insert(callee).second)
+          stack.emplace_back(callee);
+      }
+    }
+
+    for (auto type : func->argsTypes) {
+      if (!isCacheable(type))
+        return name + "only number and bool args are cached, not " + typeName(type);
+    }
+    if (!isCacheable(func->retType))
+      return name + "only number and bool results are cached, not " + typeName(func->retType);
+    return "";
+  }
+
+  static bool isCacheable(ExprType type) {
+    return type >= BOOL && type <= R64;
+  }
+
+  FuncExpr* topFunction(CallExpr* callExpr) {
+    auto var = dynamic_cast<VarExpr*>(callExpr->func);
+    if (var == nullptr || isLocal(var->identifier.value))
+      return nullptr;
+    auto found = topFunctions.find(var->identifier.value);
+    return found != topFunctions.end() ? found->second : nullptr;
+  }
+
+  // the literal of the same type the call returns, nullptr if it has to run
+  Expr* fold(CallExpr* callExpr) {
+    auto callee = topFunction(callExpr);
+    if (callee == nullptr || pure.count(((VarExpr*)callExpr->func)->identifier.value) == 0)
+      return nullptr;
+    CallEvaluator evaluator(pure);
+    auto value = callExpr->visit(&evaluator);
+    auto literal = (Expr*)nullptr;
+    if (callExpr->type == BOOL && value.type() == typeid(bool))
+      literal = new BoolExpr(std::any_cast<bool>(value));
+    else if (callExpr->type == I32 && value.type() == typeid(int32_t))
+      literal = new IntExpr((uint64_t)(int64_t)std::any_cast<int32_t>(value), I32, true);
+    else if (callExpr->type == R64 && value.type() == typeid(double))
+      literal = new RealExpr(std::any_cast<double>(value), R64, true);
+    else if (callExpr->type == STR && value.type() == typeid(std::string))
+      literal = new StrExpr(std::any_cast<std::string>(value));
+    if (literal == nullptr)
+      return nullptr;
+    literal->type = callExpr->type;
+    literal->line = callExpr->line;
+    literal->column = callExpr->column;
+    folded++;
+    return literal;
+  }
+};
+
+} // namespace Diploma
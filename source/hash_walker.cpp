@@ -0,0 +1,241 @@
+#include "syntax_tree.hpp"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace Diploma {
+
+// hash of a function as the code generator sees it: the tree with the types and escape results,
+// positions and layout of the text don't change it; a call to another top level function mixes in
+// the signature of that one, so a unit is rebuilt when something it depends on changes;
+// runs after EscapeWalker, the result is uint64_t
+class HashWalker : public TreeWalker {
+  const std::map<std::string, FuncExpr*>& globals; // top level functions without captures
+
+public:
+  bool usesObjects = false; // user types are emitted on demand by whoever uses them first, can't be cached
+  // a generator frame is put on the stack only where the body of the generator is inlined, so generators and
+  // the functions that use them stay in the module of main
+  bool usesGenerators = false;
+
+  HashWalker(const std::map<std::string, FuncExpr*>& globals) : globals(globals) {}
+
+  void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) {
+      expr->visit(this);
+    }
+  }
+
+  uint64_t hash(Expr* expr) {
+    return std::any_cast<uint64_t>(expr->visit(this));
+  }
+
+  // FNV-1a over the bytes of the value
+  template <typename T> static uint64_t mix(uint64_t h, T value) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    for (auto b : bytes) {
+      h = (h ^ b) * 0x100000001b3ull;
+    }
+    return h;
+  }
+
+  static uint64_t mix(uint64_t h, std::string text) {
+    h = mix(h, text.size());
+    for (auto c : text) {
+      h = (h ^ (unsigned char)c) * 0x100000001b3ull;
+    }
+    return h;
+  }
+
+  // what callers see of a function
+  static uint64_t signature(uint64_t h, FuncExpr* func) {
+    h = mix(h, func->args.size());
+    for (auto type : func->argsTypes) {
+      h = mix(h, type);
+    }
+    for (bool escapes : func->argsEscape) {
+      h = mix(h, escapes);
+    }
+    h = mix(h, func->retType);
+    return mix(h, func->returnsOwned);
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return mix(start(boolExpr, 1), boolExpr->value);
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    return mix(start(intExpr, 2), intExpr->value);
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    return mix(start(realExpr, 3), realExpr->value);
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return mix(start(strExpr, 4), strExpr->value);
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    return list(start(formatExpr, 5), formatExpr->parts);
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    auto h = mix(start(newVarExpr, 6), newVarExpr->identifier.value);
+    return mix(h, hash(newVarExpr->value));
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    auto h = mix(start(varAssignExpr, 7), varAssignExpr->identifier.value);
+    return mix(h, hash(varAssignExpr->value));
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    auto h = mix(start(varExpr, 8), varExpr->identifier.value);
+    auto global = globals.find(varExpr->identifier.value);
+    if (global != globals.end()) {
+      h = signature(h, global->second);
+      usesGenerators = usesGenerators || global->second->generator;
+    }
+    return h;
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    auto h = mix(start(unaryExpr, 9), unaryExpr->oper.grapheme);
+    return mix(h, hash(unaryExpr->value));
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    return mix(start(castExpr, 25), hash(castExpr->value));
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    auto h = mix(start(comparisonExpr, 10), comparisonExpr->oper.grapheme);
+    return mix(mix(h, hash(comparisonExpr->left)), hash(comparisonExpr->right));
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    auto h = mix(start(binaryExpr, 11), binaryExpr->oper.grapheme);
+    return mix(mix(h, hash(binaryExpr->left)), hash(binaryExpr->right));
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    auto h = mix(start(logicalExpr, 12), logicalExpr->oper.grapheme);
+    return mix(mix(h, hash(logicalExpr->left)), hash(logicalExpr->right));
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    auto h = mix(start(ifElseExpr, 13), hash(ifElseExpr->condition));
+    h = mix(h, hash(ifElseExpr->thenBlock));
+    return mix(h, ifElseExpr->elseBlock != nullptr ? hash(ifElseExpr->elseBlock) : 0);
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    return list(start(blockExpr, 14), blockExpr->list);
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    usesGenerators = usesGenerators || funcExpr->generator;
+    auto h = signature(start(funcExpr, 15), funcExpr);
+    for (auto arg : funcExpr->args) {
+      h = mix(h, arg.value);
+    }
+    for (auto name : funcExpr->captures) {
+      h = mix(h, name);
+    }
+    h = mix(mix(mix(h, funcExpr->escapes), funcExpr->tail), funcExpr->memo);
+    h = mix(mix(h, funcExpr->generator), funcExpr->yieldType);
+    return mix(h, hash(funcExpr->body));
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    auto h = mix(start(callExpr, 16), hash(callExpr->func));
+    h = mix(list(h, callExpr->args), callExpr->ownsResult);
+    return mix(h, callExpr->lent.size());
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    return list(start(printlnExpr, 17), printlnExpr->values);
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    auto h = mix(mix(start(refExpr, 18), refExpr->kind), refExpr->valueType);
+    h = mix(mix(h, refExpr->escapes), refExpr->atomic);
+    return mix(h, hash(refExpr->value));
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    return mix(start(derefExpr, 19), hash(derefExpr->ref));
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    usesObjects = true;
+    return mix(start(typeExpr, 20), typeExpr->name.value);
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    usesObjects = true;
+    return list(start(newObjExpr, 21), newObjExpr->args);
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    usesObjects = true;
+    return mix(start(memberExpr, 22), memberExpr->member.value);
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    usesObjects = true;
+    return mix(start(memberAssignExpr, 23), memberAssignExpr->member.value);
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    if (methodCallExpr->map != nullptr) { // built in, nothing is emitted on demand
+      auto h = mix(start(methodCallExpr, 24), methodCallExpr->method.value);
+      h = mix(mix(h, methodCallExpr->map->keyType), methodCallExpr->map->valueType);
+      return list(mix(h, hash(methodCallExpr->object)), methodCallExpr->args);
+    }
+    usesObjects = true;
+    return mix(start(methodCallExpr, 24), methodCallExpr->method.value);
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    return mix(start(yieldExpr, 26), hash(yieldExpr->value));
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    auto h = mix(mix(start(forExpr, 27), forExpr->item.value), forExpr->itemType);
+    return mix(mix(h, hash(forExpr->source)), hash(forExpr->body));
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    return mix(mix(start(whileExpr, 28), hash(whileExpr->condition)), hash(whileExpr->body));
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    auto h = mix(mix(start(mapExpr, 29), mapExpr->keyType), mapExpr->valueType);
+    h = mix(h, mapExpr->entries.size());
+    for (auto [key, value] : mapExpr->entries) {
+      h = mix(mix(h, hash(key)), hash(value));
+    }
+    return h;
+  }
+
+private:
+  uint64_t start(Expr* expr, int kind) {
+    if (expr->type == OBJ || expr->objType != nullptr)
+      usesObjects = true;
+    return mix(mix((uint64_t)0xcbf29ce484222325ull, kind), expr->type);
+  }
+
+  uint64_t list(uint64_t h, const std::vector<Expr*>& exprs) {
+    h = mix(h, exprs.size());
+    for (auto expr : exprs) {
+      h = mix(h, hash(expr));
+    }
+    return h;
+  }
+};
+
+} // namespace Diploma
@@ -1,17 +1,52 @@
+#include "const_walker.cpp"
+#include "diagnostics.hpp"
+#include "hash_walker.cpp"
+#include "memory.hpp"
+#include "runtime.h"
 #include "syntax_tree.hpp"
+#include "timing.hpp"
+#include <cstdlib>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <llvm/ADT/APFloat.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ProfileSummary.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/ValueSymbolTable.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/SandboxIR/Utils.h>
 #include <llvm/SandboxIR/Value.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/IPO/Inliner.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
 
 using namespace llvm;
 
@@ -22,6 +57,14 @@ template <typename T> void dump(T* v) {
 
 namespace Diploma {
 
+// what the earlier lines of a REPL left behind: every line is a module of its own,
+// their top level functions and variables are only declared in the next ones
+struct Session {
+  int line = 0;
+  std::map<std::string, FuncExpr*> functions; // top level ones without captures, named after themselves
+  std::map<std::string, ExprType> variables;  // globals named "session.<name>"
+};
+
 class InterpreterWalker : public TreeWalker {
 private:
   LLVMContext* llvmContext;
@@ -29,100 +72,532 @@ private:
   IRBuilder<>* irBuilder;
 
   BasicBlock* currBlock;
-  std::map<std::string, AllocaInst*> localScope;
+
+  // locals are SSA values from the start (Braun et al., "Simple and Efficient Construction of SSA Form"):
+  // every block remembers the last value written to a variable, a read in a block without one
+  // asks the predecessors and merges what they say with a phi, useless phis are folded away right after
+  struct Variable {
+    std::string name;
+    Type* type;
+    std::map<BasicBlock*, Value*> values;
+    DILocalVariable* debug = nullptr;
+  };
+  std::vector<std::unique_ptr<Variable>> variables;
+  std::map<std::string, Variable*> localScope;
+  std::map<PHINode*, Variable*> phiVariables;
+  std::set<BasicBlock*> sealedBlocks; // all of their predecessors are known
+  std::map<BasicBlock*, std::vector<PHINode*>> incompletePhis;
 
   Function* mainFunc;
+  bool finished = false;
+  int optLevel;
+  std::string outputPath; // empty to keep the module in memory
 
-  Function* printfFunc;
   std::map<std::string, GlobalVariable*> printFormats;
 
+  // runtime/output.c
+  std::map<ExprType, Function*> writeFuncs;
+  Function* writeLnFunc;
+
+  // runtime/string.c, strings are {i64, i64} values that go to the runtime by pointer
+  Type* strType;
+  Function* strConcatFunc;
+  Function* strFormatFunc;
+  Function* strEqualFunc;
+  Function* strCompareFunc;
+  std::map<std::string, GlobalVariable*> internedStrings; // bytes of the long literals
+  std::map<Constant*, GlobalVariable*> stringValues;      // literals the runtime needs the address of
+
+  // runtime/heap.c
+  Function* refAllocFunc;
+  Function* refRetainFunc;
+  Function* refReleaseFunc;
+  Function* refWeakRetainFunc;
+  Function* refWeakReleaseFunc;
+  Function* refAliveFunc;
+
+  // runtime/map.c, put, find and remove have a function for every kind of key
+  Function* mapNewFunc;
+  Function* mapSizeFunc;
+  Function* mapNextFunc;
+  Function* mapKeyFunc;
+  std::map<std::pair<std::string, ExprType>, Function*> mapFuncs;
+  std::map<Type*, GlobalVariable*> zeroValues; // what get reads when there is no such key
+
+  // runtime/memo.c
+  Function* memoNewFunc;
+  Function* memoFindFunc;
+  Function* memoStoreFunc;
+
+  // ref variables of the current function with their "have to release" flags
+  struct OwnedRef {
+    Variable* flag;
+    bool weak;
+  };
+  std::map<std::string, OwnedRef> ownedRefs;
+
+  // stack memory of values that don't escape holds a share of the strings put in it, until the same expression
+  // fills it again in the next round of a loop or the function ends
+  struct HeldStrings {
+    Variable* flag;                // the memory was filled
+    std::function<void()> release; // loads the strings from the memory and lets them go
+  };
+  std::vector<HeldStrings> heldStrings;
+
+  // the generator being emitted, a yield stores into the promise and suspends, see emitGenerator
+  struct Generator {
+    AllocaInst* promise = nullptr; // nullptr outside of generators
+    ExprType yieldType = VOID;
+    BasicBlock* suspend = nullptr; // gives the handle back to whoever called or resumed it
+    BasicBlock* cleanup = nullptr; // releases the refs and frees the frame when it is destroyed
+  };
+  Generator generator;
+  static const int promiseAlign = 8; // the biggest a yielded value needs, 'for' finds the promise with it
+
+  // user types: base struct goes first, own fields are ordered to leave no padding between them
+  std::map<TypeExpr*, StructType*> structs;
+  std::map<TypeExpr*, std::map<std::string, unsigned>> fieldIndex;
+  std::map<TypeExpr*, GlobalVariable*> vtables;
+  std::map<FuncExpr*, Function*> functions;
+  // top level ones without captures, seen from everywhere; the units emitted on other threads share it
+  std::shared_ptr<std::map<std::string, FuncExpr*>> globalFuncs = std::make_shared<std::map<std::string, FuncExpr*>>();
+  // a function value points to its environment: the function itself, then copies of the captured variables
+  std::map<FuncExpr*, StructType*> environments;
+  std::map<FuncExpr*, GlobalVariable*> emptyEnvironments;
+  std::map<Function*, std::vector<std::pair<Function*, bool>>> calls; // direct calls and if they are tail ones
+  Value* currentThis = nullptr;
+  TypeExpr* currentOwner = nullptr;
+
+  // profile guided optimization: the training build counts how often every function and branch runs,
+  // the next build reads the counts back as entry counts and branch weights
+  std::string profileGenerate;             // where the instrumented program writes the profile
+  GlobalVariable* counters = nullptr;      // one i64 per name, sized when the module is finished
+  std::vector<std::string> counterNames;   // "function:block"
+  std::map<std::string, uint64_t> profile; // read from the training run
+  int profileMatched = 0;
+  std::string profileScope = "main"; // function the blocks are named after
+  int branchIndex = 0;
+  int lambdaIndex = 0;
+
+  // --profile-calls: every function tells the runtime when it is entered and left,
+  // the runtime sums up self and total time per function and the stacks at exit
+  std::string callsPath;              // where the instrumented program writes the stacks
+  std::vector<std::string> callNames; // "function:line", main is 0
+  Function* callsEnterFunc = nullptr;
+  Function* callsExitFunc = nullptr;
+
+  // incremental builds: every top level function is a unit, optimized on its own and kept as bitcode named after
+  // the hash of everything its code depends on; the ones with objects or generators stay in the module of main,
+  // which is a unit too, with the statements, and only the names and signatures of the others
+  std::string cacheDir;
+  static const int codegenVersion = 6; // goes up when the same tree compiles to other code or hashes differ
+  std::map<FuncExpr*, std::string> unitPaths;               // cacheable units and their files
+  std::map<FuncExpr*, std::unique_ptr<Module>> cachedUnits; // only declared in the module, linked in the end
+  std::map<FuncExpr*, std::vector<Function*>> freshUnits;   // the function and the lambdas inside of it
+  std::string mainPath;
+  std::unique_ptr<Module> cachedMain; // nothing of main is emitted then, only the units that aren't cached
+  int jobs = 1; // threads that emit and optimize the units, every one into a context of its own
+  std::vector<std::unique_ptr<Module>> sharedUnits; // of the -jN threads, with all the functions one emitted
+  std::set<FuncExpr*> sharedFuncs;                  // in them, only declared in the module
+
+  Session* session = nullptr;
+  std::map<std::string, GlobalVariable*> sessionScope; // top level variables of the REPL
+
+  // DWARF for profilers and debuggers, only when asked for with -g
+  DIBuilder* debugBuilder = nullptr;
+  DIFile* debugFile = nullptr;
+  DISubprogram* debugScope = nullptr; // of the function being emitted
+
 public:
-  InterpreterWalker() {
+  InterpreterWalker(
+    int optLevel = 0, std::string outputPath = "output.ir", std::string profileGenerate = "",
+    std::string profileUse = "", std::string cacheDir = ""
+  )
+    : optLevel(optLevel), outputPath(outputPath), profileGenerate(profileGenerate), cacheDir(cacheDir) {
     llvmContext = new LLVMContext();
     irModule = new Module("my module", *llvmContext);
     irBuilder = new IRBuilder<>(*llvmContext);
+    strType = StructType::get(*llvmContext, {irBuilder->getInt64Ty(), irBuilder->getInt64Ty()});
+
+    std::pair<ExprType, const char*> writers[] = {
+      {BOOL, "write_bool"}, {I32, "write_i32"}, {I64, "write_i64"}, {U64, "write_u64"},
+      {R64, "write_f64"},   {FUNC, "write_ptr"},
+    };
+    for (auto [type, name] : writers) {
+      auto writeSign = FunctionType::get(irBuilder->getVoidTy(), ExprToLLVMType(type), false);
+      writeFuncs[type] = Function::Create(writeSign, Function::ExternalLinkage, name, irModule);
+    }
+    writeFuncs[STR] = declareRuntime("write_str", irBuilder->getVoidTy(), {irBuilder->getPtrTy()});
+    writeFuncs[UNIQ_REF] = writeFuncs[SHAR_REF] = writeFuncs[WEAK_REF] = writeFuncs[FUNC];
+    writeFuncs[OBJ] = writeFuncs[GEN] = writeFuncs[MAP] = writeFuncs[FUNC];
+    auto writeLnSign = FunctionType::get(irBuilder->getInt32Ty(), false);
+    writeLnFunc = Function::Create(writeLnSign, Function::ExternalLinkage, "write_ln", irModule);
+
+    auto ptrType = PointerType::get(irBuilder->getInt8Ty(), 0);
+    auto voidType = irBuilder->getVoidTy();
+    refAllocFunc = declareRuntime("ref_alloc", ptrType, {irBuilder->getInt64Ty(), irBuilder->getInt32Ty()});
+    refRetainFunc = declareRuntime("ref_retain", voidType, {ptrType});
+    refReleaseFunc = declareRuntime("ref_release", voidType, {ptrType});
+    refWeakRetainFunc = declareRuntime("ref_weak_retain", voidType, {ptrType});
+    refWeakReleaseFunc = declareRuntime("ref_weak_release", voidType, {ptrType});
+    refAliveFunc = declareRuntime("ref_alive", irBuilder->getInt1Ty(), {ptrType});
+
+    auto int32Type = irBuilder->getInt32Ty();
+    auto int64Type = irBuilder->getInt64Ty();
+    mapNewFunc = declareRuntime("map_new", ptrType, {int32Type, int32Type});
+    mapSizeFunc = declareRuntime("map_size", int64Type, {ptrType});
+    mapNextFunc = declareRuntime("map_next", int64Type, {ptrType, int64Type});
+    mapKeyFunc = declareRuntime("map_key", ptrType, {ptrType, int64Type});
+    std::pair<ExprType, Type*> mapKeys[] = {{I32, int32Type}, {R64, irBuilder->getDoubleTy()}, {STR, ptrType}};
+    for (auto [keyType, keyLLVMType] : mapKeys) {
+      auto suffix = keyType == STR ? "_str" : keyType == R64 ? "_f64" : "_i32";
+      mapFuncs[{"put", keyType}] = declareRuntime("map_put" + std::string(suffix), ptrType, {ptrType, keyLLVMType});
+      mapFuncs[{"find", keyType}] = declareRuntime("map_find" + std::string(suffix), ptrType, {ptrType, keyLLVMType});
+      mapFuncs[{"remove", keyType}] =
+        declareRuntime("map_remove" + std::string(suffix), irBuilder->getInt1Ty(), {ptrType, keyLLVMType});
+    }
+
+    memoNewFunc = declareRuntime("memo_new", ptrType, {ptrType, int32Type, irBuilder->getInt1Ty()});
+    memoFindFunc = declareRuntime("memo_find", irBuilder->getInt1Ty(), {ptrType, ptrType, ptrType});
+    memoStoreFunc = declareRuntime("memo_store", voidType, {ptrType, ptrType, int64Type});
 
-    auto printfSign = FunctionType::get(irBuilder->getInt32Ty(), PointerType::get(irBuilder->getInt8Ty(), 0), true);
-    printfFunc = Function::Create(printfSign, Function::ExternalLinkage, "printf", irModule);
+    strConcatFunc = declareRuntime("str_concat", voidType, {ptrType, ptrType, ptrType});
+    auto strFormatSign = FunctionType::get(voidType, {ptrType, ptrType}, true);
+    strFormatFunc = Function::Create(strFormatSign, Function::ExternalLinkage, "str_format", irModule);
+    strEqualFunc = declareRuntime("str_equal", irBuilder->getInt1Ty(), {ptrType, ptrType});
+    strCompareFunc = declareRuntime("str_compare", irBuilder->getInt32Ty(), {ptrType, ptrType});
 
     auto mainSign = FunctionType::get(irBuilder->getInt32Ty(), false);
     mainFunc = Function::Create(mainSign, Function::ExternalLinkage, "main", irModule);
 
     currBlock = BasicBlock::Create(*llvmContext, "entry", mainFunc);
-    irBuilder->SetInsertPoint(currBlock);
+    enterBlock(currBlock);
+
+    if (!profileGenerate.empty()) {
+      counters = new GlobalVariable(
+        *irModule, irBuilder->getInt64Ty(), false, GlobalValue::InternalLinkage, irBuilder->getInt64(0),
+        "profile.counters"
+      );
+    }
+    if (!profileUse.empty())
+      readProfile(profileUse);
+    countEntry(mainFunc);
+    if (!profileGenerate.empty() || !profileUse.empty())
+      this->cacheDir = ""; // counters and weights are not a part of the hash
   }
 
-  void Do(std::vector<Expr*> syntax) {
-    for (auto expr : syntax) {
-      expr->visit(this);
+  // the module becomes the next line of the session, main is called "line.<number>" then
+  void join(Session* session) {
+    this->session = session;
+    cacheDir = "";
+    mainFunc->setName("line." + std::to_string(++session->line));
+    for (auto [name, func] : session->functions) {
+      (*globalFuncs)[name] = func;
+      declareFunction(func, name, nullptr);
+    }
+    for (auto [name, type] : session->variables) {
+      sessionScope[name] = new GlobalVariable(
+        *irModule, ExprToLLVMType(type), false, GlobalValue::ExternalLinkage, nullptr, "session." + name
+      );
     }
   }
 
-  ~InterpreterWalker() {
-    irBuilder->CreateRet(irBuilder->getInt32(0));
+  // a subprogram for every function, a source location for every instruction and the variables,
+  // the optimizer keeps them up to date, so -O2 builds can be profiled down to the line too
+  void emitDebugInfo(std::string sourcePath) {
+    cacheDir = ""; // the cached units have no debug info
+    irModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+    irModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+    debugBuilder = new DIBuilder(*irModule);
+
+    SmallString<256> path(sourcePath);
+    sys::fs::make_absolute(path);
+    debugFile = debugBuilder->createFile(sys::path::filename(path), sys::path::parent_path(path));
+    // there is no code for the language, C is the closest one debuggers know
+    debugBuilder->createCompileUnit(dwarf::DW_LANG_C, debugFile, "diploma", optLevel > 0, "", 0);
+    debugScope = debugSubprogram(mainFunc, "main", 0, I32, {});
+    irBuilder->SetCurrentDebugLocation(DILocation::get(*llvmContext, 0, 0, debugScope));
+  }
+
+  // main is entered here, before anything else it does, and left in finish
+  void profileCalls(std::string path) {
+    cacheDir = ""; // the hooks are not a part of the hash
+    callsPath = path;
+    auto int32Type = irBuilder->getInt32Ty();
+    callsEnterFunc = declareRuntime("calls_enter", irBuilder->getVoidTy(), {int32Type});
+    callsExitFunc = declareRuntime("calls_exit", irBuilder->getVoidTy(), {int32Type});
+    callNames.emplace_back("main");
+    irBuilder->CreateCall(callsEnterFunc, {irBuilder->getInt32(0)});
+  }
+
+  // -j: the top level functions that can be cached can also be compiled on other threads,
+  // the results are linked in like cached units; the type check before it stays on one thread;
+  // calls between the modules are inlined after the link, but what gets inlined isn't vectorized or unrolled again
+  void useThreads(int jobs) {
+    this->jobs = jobs;
+  }
 
-    if (verifyFunction(*mainFunc, &errs())) {
-      errs() << "Error verifying function!\n";
+  // with the lambdas inside, which make a unit with it when it is cached
+  void emitFunction(FuncExpr* funcExpr, Function* function) {
+    auto last = &irModule->getFunctionList().back();
+    emitBody(funcExpr, function, nullptr);
+    if (unitPaths.count(funcExpr) != 0) { // lambdas inside are declared after the last function
+      auto& unit = freshUnits[funcExpr] = {function};
+      for (auto f = std::next(last->getIterator()); f != irModule->end(); f++) {
+        if (!f->isDeclaration()) // intrinsics and malloc of the generators
+          unit.emplace_back(&*f);
+      }
     }
+  }
 
-    std::error_code EC;
-    ToolOutputFile out("output.ir", EC, sys::fs::OF_None);
-    if (EC) {
-      std::cout << EC.message() << std::endl;
+  void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) { // declared first, so calls to the ones below are direct
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      auto func = newVar != nullptr ? dynamic_cast<FuncExpr*>(newVar->value) : nullptr;
+      if (func != nullptr && func->captures.empty()) {
+        (*globalFuncs)[newVar->identifier.value] = func;
+        declareFunction(func, newVar->identifier.value, nullptr);
+        if (session != nullptr)
+          session->functions[newVar->identifier.value] = func;
+      }
+    }
+    if (!cacheDir.empty())
+      loadCachedUnits(syntax);
+    auto instrumented = counters != nullptr || !profile.empty() || !callsPath.empty();
+    if (jobs > 1 && session == nullptr && debugBuilder == nullptr && !instrumented)
+      emitUnitsInParallel();
+    if (cachedMain != nullptr) {
+      for (auto [name, func] : *globalFuncs) {
+        if (unitPaths.count(func) != 0 && cachedUnits.count(func) == 0)
+          emitFunction(func, globalFunction(name));
+      }
+    } else {
+      for (auto expr : syntax) {
+        emitStatement(expr);
+      }
     }
-    out.keep();
-    irModule->print(out.os(), nullptr);
+    reportTailRecursion();
+  }
 
+  ~InterpreterWalker() {
+    finish();
     delete irBuilder;
     delete irModule;
     delete llvmContext;
   }
 
+  // the finished module for somebody else to run, the context has to outlive it
+  std::unique_ptr<Module> takeModule(std::unique_ptr<LLVMContext>& context) {
+    finish();
+    context.reset(llvmContext);
+    auto module = std::unique_ptr<Module>(irModule);
+    irModule = nullptr;
+    llvmContext = nullptr;
+    return module;
+  }
+
+  // ends main, optimizes and writes the module, the destructor does it if nobody did before
+  void finish() {
+    if (finished)
+      return;
+    finished = true;
+    if (cachedMain != nullptr)
+      mainFunc->deleteBody();
+    else {
+      releaseOwnedRefs(nullptr);
+      irBuilder->CreateRet(irBuilder->getInt32(0));
+    }
+    if (!callsPath.empty())
+      registerCalls();
+    if (debugBuilder != nullptr) {
+      debugBuilder->finalize();
+      delete debugBuilder;
+      debugBuilder = nullptr;
+    }
+
+    if (counters != nullptr)
+      registerProfile();
+    if (!profile.empty()) {
+      if (profileMatched != profile.size())
+        diagnostics() << "the profile is from another version of the program, " << profile.size() - profileMatched
+                      << " of " << profile.size() << " counts don't match\n";
+      attachProfileSummary();
+    }
+
+    if (cachedMain == nullptr) {
+      ScopedTimer timer("verify");
+      if (verifyFunction(*mainFunc, &errs())) {
+        errs() << "Error verifying function!\n";
+      }
+    }
+
+    if (session != nullptr)
+      internalizeLine();
+    countModule("");
+    auto units = extractFreshUnits();
+    auto coroutines = hasCoroutines(*irModule);
+    for (auto& [path, unit] : units) {
+      coroutines = coroutines || hasCoroutines(*unit);
+    }
+    if (optLevel > 0 || coroutines) {
+      ScopedTimer timer("optimize -O" + std::to_string(optLevel));
+      if (cachedMain == nullptr)
+        optimize(*irModule);
+      for (auto& [path, unit] : units) {
+        optimize(*unit);
+      }
+    }
+    if (!mainPath.empty() && cachedMain == nullptr) {
+      ScopedTimer timer("write cache");
+      writeUnit(*irModule, mainPath);
+    }
+    if (!units.empty() || !cachedUnits.empty() || !sharedUnits.empty() || cachedMain != nullptr) {
+      linkUnits(units);
+      if (optLevel > 0) {
+        ScopedTimer timer("optimize linked");
+        optimize(*irModule, true);
+      }
+    }
+    if (optLevel > 0)
+      countModule(" after -O" + std::to_string(optLevel));
+
+    if (!outputPath.empty()) {
+      ScopedTimer timer("print module");
+      std::error_code EC;
+      ToolOutputFile out(outputPath, EC, sys::fs::OF_None);
+      if (EC) {
+        diagnostics() << EC.message() << std::endl;
+      }
+      out.keep();
+      irModule->print(out.os(), nullptr);
+    }
+  }
+
+  Module* getModule() {
+    return irModule;
+  }
+
   std::any visitBool(BoolExpr* boolExpr) {
     return (Value*)(boolExpr->value ? irBuilder->getTrue() : irBuilder->getFalse());
   }
 
-  std::any visitInt32(Int32Expr* int32Expr) {
-    return (Value*)(irBuilder->getInt32(int32Expr->value));
+  std::any visitInt(IntExpr* intExpr) {
+    auto type = ExprToLLVMType(intExpr->type);
+    if (isFloat(intExpr->type)) // met a real one
+      return (Value*)ConstantFP::get(type, (double)(int64_t)intExpr->value);
+    return (Value*)ConstantInt::get(type, intExpr->value, !isUnsigned(intExpr->type));
   }
 
-  std::any visitReal64(Real64Expr* real64Expr) {
-    return (Value*)(ConstantFP::get(irBuilder->getDoubleTy(), real64Expr->value));
+  std::any visitReal(RealExpr* realExpr) {
+    return (Value*)ConstantFP::get(ExprToLLVMType(realExpr->type), realExpr->value);
   }
 
   std::any visitStr(StrExpr* strExpr) {
-    return (Value*)(irBuilder->CreateGlobalString(strExpr->value));
+    return (Value*)stringConstant(strExpr->value);
+  }
+
+  // constant parts are baked into the format, the rest is printed once into a string of the size it needs
+  std::any visitFormat(FormatExpr* formatExpr) {
+    ConstWalker constWalker;
+    std::string text = "";
+    std::string format = "";
+    std::vector<Value*> args;
+    std::vector<std::pair<Expr*, Value*>> parts; // the strings printed into it
+    for (auto part : formatExpr->parts) {
+      auto constant = part->visit(&constWalker);
+      if (constant.has_value()) {
+        auto partText = ConstWalker::toText(constant);
+        text += partText;
+        for (auto c : partText) {
+          format += c;
+          if (c == '%')
+            format += '%';
+        }
+      } else {
+        parts.emplace_back(part, appendFormat(part, format, args));
+      }
+    }
+    if (args.empty())
+      return (Value*)stringConstant(text);
+
+    auto result = createEntryAlloca(strType, "format");
+    args.insert(args.begin(), {result, getFormat(format)});
+    irBuilder->CreateCall(strFormatFunc, args);
+    for (auto [part, value] : parts) {
+      releaseTemporary(part, value);
+    }
+    return (Value*)irBuilder->CreateLoad(strType, result);
   }
 
   std::any visitNewVar(NewVarExpr* newVarExpr) {
-    auto value = std::any_cast<Value*>(newVarExpr->value->visit(this));
+    auto value = std::any_cast<Value*>(emit(newVarExpr->value));
     auto valueType = value->getType();
     auto name = newVarExpr->identifier.value;
     auto newVar = (Value*)nullptr;
-    newVar = localScope[name] = irBuilder->CreateAlloca(valueType, nullptr, name);
-    irBuilder->CreateStore(value, newVar);
-    return newVar;
+    if (session != nullptr && irBuilder->GetInsertBlock()->getParent() == mainFunc) { // lives as long as the session
+      if (globalFuncs->count(name) != 0 && globalFuncs->at(name) == newVarExpr->value)
+        return value;
+      newVar = sessionScope[name] = new GlobalVariable(
+        *irModule, valueType, false, GlobalValue::ExternalLinkage, Constant::getNullValue(valueType), "session." + name
+      );
+      session->variables[name] = newVarExpr->type;
+      storeKept(newVar, value, newVarExpr->value);
+      return newVar;
+    }
+    auto variable = localScope[name] = newVariable(name, valueType);
+    declareVariable(variable, newVarExpr->type, 0);
+    writeVariable(variable, value);
+    if (isOwnable(newVarExpr->type))
+      own(name, newVarExpr->value, value);
+    return value;
   }
 
   std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
     auto name = varAssignExpr->identifier.value;
-    auto newValue = std::any_cast<Value*>(varAssignExpr->value->visit(this));
-    irBuilder->CreateStore(newValue, localScope[name]);
+    auto newValue = std::any_cast<Value*>(emit(varAssignExpr->value));
+    if (localScope.count(name) == 0 && currentOwner != nullptr) { // a field inside of a method
+      storeKept(fieldPtr(currentOwner, currentThis, name), newValue, varAssignExpr->value);
+      return newValue;
+    }
+    if (localScope.count(name) == 0 && sessionScope.count(name) != 0) {
+      storeKept(sessionScope[name], newValue, varAssignExpr->value);
+      return newValue;
+    }
+    auto owned = ownedRefs.find(name);
+    auto oldValue = (Value*)nullptr, hadIt = (Value*)nullptr;
+    if (owned != ownedRefs.end()) {
+      oldValue = readVariable(localScope[name]);
+      hadIt = readVariable(owned->second.flag);
+    }
+    if (oldValue != nullptr && varAssignExpr->type != STR)
+      releaseIf(irBuilder->CreateAnd(hadIt, irBuilder->CreateICmpNE(oldValue, newValue)), oldValue, owned->second.weak);
+    writeVariable(localScope[name], newValue);
+    if (isOwnable(varAssignExpr->type))
+      own(name, varAssignExpr->value, newValue);
+    if (oldValue != nullptr && varAssignExpr->type == STR) // after the new one took its share, it may be the same
+      releaseIf(hadIt, oldValue, false);
     return newValue;
   }
 
   std::any visitVar(VarExpr* varExpr) {
     auto name = varExpr->identifier.value;
-    auto varPtr = (Value*)nullptr;
-    auto varType = (Type*)nullptr;
-    auto lv = localScope[name];
-    varPtr = lv;
-    varType = lv->getAllocatedType();
-    return (Value*)irBuilder->CreateLoad(varType, varPtr, name);
+    if (localScope.count(name) == 0 && currentOwner != nullptr && hasField(currentOwner, name)) {
+      auto field = fieldPtr(currentOwner, currentThis, name);
+      return (Value*)irBuilder->CreateLoad(fieldType(currentOwner, name), field, name);
+    }
+    if (localScope.count(name) == 0 && sessionScope.count(name) != 0) {
+      auto global = sessionScope[name];
+      return (Value*)irBuilder->CreateLoad(global->getValueType(), global, name);
+    }
+    if (localScope.count(name) == 0 && globalFuncs->count(name) != 0) {
+      globalFunction(name);
+      return (Value*)getEmptyEnvironment(globalFuncs->at(name));
+    }
+    return readVariable(localScope[name]);
   }
 
   std::any visitUnary(UnaryExpr* unaryExpr) {
-    auto value = std::any_cast<Value*>(unaryExpr->value->visit(this));
+    auto value = std::any_cast<Value*>(emit(unaryExpr->value));
     if (unaryExpr->oper.grapheme == PLUS) {
       return value;
     } else if (unaryExpr->oper.grapheme == MINUS) {
@@ -135,72 +610,125 @@ public:
     }
   }
 
+  std::any visitCast(CastExpr* castExpr) {
+    auto value = std::any_cast<Value*>(emit(castExpr->value));
+    return convert(value, castExpr->value->type, castExpr->type);
+  }
+
+  // both sides are converted to the type the type checker picked for the operation
   Value* createBinOperation(
-    Value* left, Value* right, std::function<Value*(Value*, Value*)> binOperI,
-    std::function<Value*(Value*, Value*)> binOperF
+    Value* left, Value* right, ExprType type, std::function<Value*(Value*, Value*)> binOperI,
+    std::function<Value*(Value*, Value*)> binOperU, std::function<Value*(Value*, Value*)> binOperF
   ) {
-    auto leftType = left->getType();
-    auto rightType = right->getType();
-    auto leftIsFloating = leftType->isFloatingPointTy();
-    auto rightIsFloating = rightType->isFloatingPointTy();
-
-    auto binOper = binOperI;
-    if (leftIsFloating || rightIsFloating) {
-      if (!leftIsFloating) {
-        left = irBuilder->CreateSIToFP(left, rightType);
-      } else if (!rightIsFloating) {
-        right = irBuilder->CreateSIToFP(right, leftType);
-      }
-      binOper = binOperF;
-    }
-
-    return binOper(left, right);
+    if (isFloat(type))
+      return binOperF(left, right);
+    return isUnsigned(type) ? binOperU(left, right) : binOperI(left, right);
   }
 
-#define createUsing(i32, r32) \
+#define createUsing(i, u, f) \
   createBinOperation( \
     left, \
     right, \
-    [&](Value* l, Value* r) { return irBuilder->i32(l, r); }, \
-    [&](Value* l, Value* r) { return irBuilder->r32(l, r); } \
+    type, \
+    [&](Value* l, Value* r) { return irBuilder->i(l, r); }, \
+    [&](Value* l, Value* r) { return irBuilder->u(l, r); }, \
+    [&](Value* l, Value* r) { return irBuilder->f(l, r); } \
   )
 
   std::any visitComparison(ComparisonExpr* comparisonExpr) {
-    auto left = std::any_cast<Value*>(comparisonExpr->left->visit(this));
-    auto right = std::any_cast<Value*>(comparisonExpr->right->visit(this));
+    if (comparisonExpr->left->type == STR && comparisonExpr->right->type == STR)
+      return compareStrings(comparisonExpr);
+    auto type = promote(comparisonExpr->left->type, comparisonExpr->right->type);
+    auto left = convert(std::any_cast<Value*>(emit(comparisonExpr->left)), comparisonExpr->left->type, type);
+    auto right = convert(std::any_cast<Value*>(emit(comparisonExpr->right)), comparisonExpr->right->type, type);
     if (comparisonExpr->oper.grapheme == EQUAL_EQUAL) {
-      return createUsing(CreateICmpEQ, CreateFCmpOEQ);
+      return createUsing(CreateICmpEQ, CreateICmpEQ, CreateFCmpOEQ);
     } else if (comparisonExpr->oper.grapheme == BANG_EQUAL) {
-      return createUsing(CreateICmpNE, CreateFCmpONE);
+      return createUsing(CreateICmpNE, CreateICmpNE, CreateFCmpONE);
     } else if (comparisonExpr->oper.grapheme == LESS) {
-      return createUsing(CreateICmpSLT, CreateFCmpOLT);
+      return createUsing(CreateICmpSLT, CreateICmpULT, CreateFCmpOLT);
     } else if (comparisonExpr->oper.grapheme == LESS_EQUAL) {
-      return createUsing(CreateICmpSLE, CreateFCmpOLE);
+      return createUsing(CreateICmpSLE, CreateICmpULE, CreateFCmpOLE);
     } else if (comparisonExpr->oper.grapheme == GREATER) {
-      return createUsing(CreateICmpSGT, CreateFCmpOGT);
+      return createUsing(CreateICmpSGT, CreateICmpUGT, CreateFCmpOGT);
     } else if (comparisonExpr->oper.grapheme == GREATER_EQUAL) {
-      return createUsing(CreateICmpSGE, CreateFCmpOGE);
+      return createUsing(CreateICmpSGE, CreateICmpUGE, CreateFCmpOGE);
     }
     return nullptr;
   }
 
   std::any visitBinary(BinaryExpr* binaryExpr) {
-    auto left = std::any_cast<Value*>(binaryExpr->left->visit(this));
-    auto right = std::any_cast<Value*>(binaryExpr->right->visit(this));
+    if (binaryExpr->type == STR)
+      return joinStrings(binaryExpr);
+    auto type = binaryExpr->type;
+    auto left = convert(std::any_cast<Value*>(emit(binaryExpr->left)), binaryExpr->left->type, type);
+    auto right = convert(std::any_cast<Value*>(emit(binaryExpr->right)), binaryExpr->right->type, type);
     if (binaryExpr->oper.grapheme == STAR) {
-      return createUsing(CreateMul, CreateFMul);
+      return createUsing(CreateMul, CreateMul, CreateFMul);
     } else if (binaryExpr->oper.grapheme == SLASH) {
-      return createUsing(CreateSDiv, CreateFDiv);
+      return createUsing(CreateSDiv, CreateUDiv, CreateFDiv);
     } else if (binaryExpr->oper.grapheme == PLUS) {
-      return createUsing(CreateAdd, CreateFAdd);
+      return createUsing(CreateAdd, CreateAdd, CreateFAdd);
     } else if (binaryExpr->oper.grapheme == MINUS) {
-      return createUsing(CreateSub, CreateFSub);
+      return createUsing(CreateSub, CreateSub, CreateFSub);
     }
     return nullptr;
   }
 
 #undef createUsing
 
+  // == against a short literal is a compare of the words, everything else goes to the runtime
+  Value* compareStrings(ComparisonExpr* comparisonExpr) {
+    ConstWalker constWalker;
+    auto known = comparisonExpr->visit(&constWalker);
+    if (known.type() == typeid(bool))
+      return irBuilder->getInt1(std::any_cast<bool>(known));
+    auto left = std::any_cast<Value*>(emit(comparisonExpr->left));
+    auto right = std::any_cast<Value*>(emit(comparisonExpr->right));
+    auto oper = comparisonExpr->oper.grapheme;
+    if (oper == EQUAL_EQUAL || oper == BANG_EQUAL) {
+      auto equal = (Value*)nullptr;
+      if (isShortString(left) || isShortString(right)) {
+        auto sameWord = [&](unsigned i) {
+          auto l = irBuilder->CreateExtractValue(left, i), r = irBuilder->CreateExtractValue(right, i);
+          return irBuilder->CreateICmpEQ(l, r);
+        };
+        equal = irBuilder->CreateAnd(sameWord(0), sameWord(1));
+      } else {
+        equal = irBuilder->CreateCall(strEqualFunc, {stringPointer(left), stringPointer(right)});
+      }
+      releaseTemporary(comparisonExpr->left, left);
+      releaseTemporary(comparisonExpr->right, right);
+      return oper == EQUAL_EQUAL ? equal : irBuilder->CreateNot(equal);
+    }
+    auto order = irBuilder->CreateCall(strCompareFunc, {stringPointer(left), stringPointer(right)});
+    releaseTemporary(comparisonExpr->left, left);
+    releaseTemporary(comparisonExpr->right, right);
+    auto zero = irBuilder->getInt32(0);
+    if (oper == LESS)
+      return irBuilder->CreateICmpSLT(order, zero);
+    if (oper == LESS_EQUAL)
+      return irBuilder->CreateICmpSLE(order, zero);
+    if (oper == GREATER)
+      return irBuilder->CreateICmpSGT(order, zero);
+    return irBuilder->CreateICmpSGE(order, zero);
+  }
+
+  // literals are joined here, the rest by the runtime into a string of the exact size
+  Value* joinStrings(BinaryExpr* binaryExpr) {
+    ConstWalker constWalker;
+    auto known = binaryExpr->visit(&constWalker);
+    if (known.type() == typeid(std::string))
+      return stringConstant(std::any_cast<std::string>(known));
+    auto left = std::any_cast<Value*>(emit(binaryExpr->left));
+    auto right = std::any_cast<Value*>(emit(binaryExpr->right));
+    auto result = createEntryAlloca(strType, "joined");
+    irBuilder->CreateCall(strConcatFunc, {result, stringPointer(left), stringPointer(right)});
+    releaseTemporary(binaryExpr->left, left); // a + b + c lets a + b go
+    releaseTemporary(binaryExpr->right, right);
+    return irBuilder->CreateLoad(strType, result);
+  }
+
   std::any visitLogical(LogicalExpr* logicalExpr) {
     auto oper = logicalExpr->oper.grapheme;
     auto currFunc = irBuilder->GetInsertBlock()->getParent();
@@ -216,19 +744,32 @@ public:
 
     irBuilder->CreateBr(leftBlock); // enter
 
-    irBuilder->SetInsertPoint(leftBlock);
-    auto left = std::any_cast<Value*>(logicalExpr->left->visit(this));
+    auto id = std::to_string(branchIndex++);
+    enterBlock(leftBlock);
+    auto leftCount = countBlock(leftName + id);
+    auto left = std::any_cast<Value*>(emit(logicalExpr->left));
+    leftBlock = irBuilder->GetInsertBlock(); // the left side may have branched on its own
+    auto branch = (BranchInst*)nullptr;
     if (oper == OR) {
-      irBuilder->CreateCondBr(left, endBlock, rightBlock);
+      branch = irBuilder->CreateCondBr(left, endBlock, rightBlock);
     } else {
-      irBuilder->CreateCondBr(left, rightBlock, endBlock);
+      branch = irBuilder->CreateCondBr(left, rightBlock, endBlock);
     }
 
-    irBuilder->SetInsertPoint(rightBlock);
-    auto right = std::any_cast<Value*>(logicalExpr->right->visit(this));
+    enterBlock(rightBlock);
+    auto rightCount = countBlock(rightName + id);
+    auto right = std::any_cast<Value*>(emit(logicalExpr->right));
+    rightBlock = irBuilder->GetInsertBlock();
     irBuilder->CreateBr(endBlock);
 
-    irBuilder->SetInsertPoint(endBlock);
+    auto skipped = leftCount > rightCount ? leftCount - rightCount : 0;
+    if (oper == OR) {
+      weighBranch(branch, skipped, rightCount);
+    } else {
+      weighBranch(branch, rightCount, skipped);
+    }
+
+    enterBlock(endBlock);
     auto res = irBuilder->CreatePHI(irBuilder->getInt1Ty(), 2, resName);
     res->addIncoming(left, leftBlock);
     res->addIncoming(right, rightBlock);
@@ -237,148 +778,2034 @@ public:
   }
 
   std::any visitIfElse(IfElseExpr* ifElseExpr) {
-    auto condition = std::any_cast<Value*>(ifElseExpr->condition->visit(this));
+    auto condition = std::any_cast<Value*>(emit(ifElseExpr->condition));
     auto currFunc = irBuilder->GetInsertBlock()->getParent();
 
     auto thenBlock = BasicBlock::Create(irBuilder->getContext(), "then", currFunc);
     auto elseBlock = BasicBlock::Create(irBuilder->getContext(), "else", currFunc);
     auto endifBlock = BasicBlock::Create(irBuilder->getContext(), "endIf", currFunc);
 
-    irBuilder->CreateCondBr(condition, thenBlock, elseBlock);
+    auto id = std::to_string(branchIndex++);
+    auto branch = irBuilder->CreateCondBr(condition, thenBlock, elseBlock);
 
-    irBuilder->SetInsertPoint(thenBlock);
-    ifElseExpr->thenBlock->visit(this);
+    enterBlock(thenBlock);
+    auto thenCount = countBlock("then" + id);
+    emit(ifElseExpr->thenBlock);
     irBuilder->CreateBr(endifBlock);
 
-    irBuilder->SetInsertPoint(elseBlock);
-    ifElseExpr->elseBlock->visit(this);
+    enterBlock(elseBlock);
+    auto elseCount = countBlock("else" + id);
+    if (ifElseExpr->elseBlock != nullptr)
+      emit(ifElseExpr->elseBlock);
     irBuilder->CreateBr(endifBlock);
+    weighBranch(branch, thenCount, elseCount);
 
-    irBuilder->SetInsertPoint(endifBlock);
+    enterBlock(endifBlock);
 
     return (Value*)nullptr;
   }
 
+  // only bodies are blocks, the last expression of a function is returned by emitReturn instead
   std::any visitBlock(BlockExpr* blockExpr) {
-    auto lastValue = (Value*)nullptr;
     for (auto expr : blockExpr->list) {
-      lastValue = std::any_cast<Value*>(expr->visit(this));
+      emitStatement(expr);
     }
-    return lastValue;
+    return (Value*)nullptr;
   }
 
   std::any visitFunc(FuncExpr* funcExpr) {
-    std::vector<Type*> paramTypes;
+    std::vector<Value*> captured;
+    std::vector<Type*> elements = {irBuilder->getPtrTy()};
+    for (auto name : funcExpr->captures) {
+      auto var = new VarExpr(Token(IDENTIFIER, name)); // freed with the tree
+      captured.emplace_back(std::any_cast<Value*>(emit(var)));
+      elements.emplace_back(captured.back()->getType());
+    }
+    auto environment = environments[funcExpr] = StructType::get(*llvmContext, elements);
+
+    auto function = functions.count(funcExpr) != 0 ? functions[funcExpr] : declareFunction(funcExpr, "", nullptr);
+    if (cachedUnits.count(funcExpr) == 0 && sharedFuncs.count(funcExpr) == 0)
+      emitFunction(funcExpr, function);
+    if (captured.empty())
+      return (Value*)getEmptyEnvironment(funcExpr);
+
+    std::vector<unsigned> strings; // the variable can get another one while the copy lives
+    for (auto i = 0; i < captured.size(); i++) {
+      if (captured[i]->getType() == strType)
+        strings.emplace_back(i + 1);
+    }
+    auto env = (Value*)nullptr;
+    auto held = (Variable*)nullptr;
+    if (funcExpr->escapes) {
+      auto size = irBuilder->getInt64(irModule->getDataLayout().getTypeAllocSize(environment));
+      env = irBuilder->CreateCall(refAllocFunc, {size, irBuilder->getInt32(0)}, "env");
+    } else {
+      env = createEntryAlloca(environment, "env");
+      if (!strings.empty())
+        held = holdStrings([this, environment, env, strings] {
+          for (auto i : strings) {
+            auto copy = irBuilder->CreateLoad(strType, irBuilder->CreateStructGEP(environment, env, i));
+            releaseIf(irBuilder->getTrue(), copy, false);
+          }
+        });
+    }
+    irBuilder->CreateStore(function, irBuilder->CreateStructGEP(environment, env, 0));
+    for (auto i = 0; i < captured.size(); i++) {
+      if (captured[i]->getType() == strType)
+        retainString(captured[i]);
+      irBuilder->CreateStore(captured[i], irBuilder->CreateStructGEP(environment, env, i + 1));
+    }
+    if (held != nullptr)
+      writeVariable(held, irBuilder->getTrue());
+    return env;
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    return (Value*)emitCall(callExpr, false);
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    for (auto i = 0; i < printlnExpr->values.size(); i++) {
+      auto v = printlnExpr->values[i];
+      auto value = std::any_cast<Value*>(emit(v));
+      auto type = v->type == VOID ? I32 : v->type;
+      auto printed = printedAs(type);
+      auto printedValue = printed == STR ? stringPointer(value) : convert(value, type, printed);
+      irBuilder->CreateCall(writeFuncs[printed], {printedValue});
+      releaseTemporary(v, value);
+      if (i != printlnExpr->values.size() - 1)
+        irBuilder->CreateCall(writeFuncs[STR], {stringPointer(stringConstant(", "))});
+    }
+
+    return (Value*)(irBuilder->CreateCall(writeLnFunc));
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    auto value = std::any_cast<Value*>(emit(refExpr->value));
+    if (refExpr->kind == WEAK) {
+      irBuilder->CreateCall(refWeakRetainFunc, {value});
+      return value;
+    }
+
+    keepString(refExpr->value, value);
+    auto valueType = value->getType();
+    auto ref = (Value*)nullptr;
+    auto held = (Variable*)nullptr;
+    if (refExpr->escapes) {
+      auto size = irBuilder->getInt64(irModule->getDataLayout().getTypeAllocSize(valueType));
+      auto flags = irBuilder->getInt32(refExpr->atomic ? 1 : 0); // REF_ATOMIC
+      ref = irBuilder->CreateCall(refAllocFunc, {size, flags}, "ref");
+    } else {
+      ref = createEntryAlloca(valueType, "ref");
+      if (valueType == strType)
+        held = holdStrings([this, ref] { releaseIf(irBuilder->getTrue(), irBuilder->CreateLoad(strType, ref), false); });
+    }
+    irBuilder->CreateStore(value, ref);
+    if (held != nullptr)
+      writeVariable(held, irBuilder->getTrue());
+    return ref;
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    auto ref = std::any_cast<Value*>(emit(derefExpr->ref));
+    auto type = ExprToLLVMType(derefExpr->type);
+    auto value = (Value*)irBuilder->CreateLoad(type, ref, "deref");
+    if (derefExpr->ref->type == WEAK_REF) { // the memory stays until the last weak ref is gone
+      auto alive = irBuilder->CreateCall(refAliveFunc, {ref});
+      value = irBuilder->CreateSelect(alive, value, Constant::getNullValue(type));
+    }
+    return value;
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    return (Value*)nullptr; // methods are emitted on first use, structs on first construction
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    std::vector<Value*> args;
+    for (auto a : newObjExpr->args) {
+      args.emplace_back(std::any_cast<Value*>(emit(a)));
+    }
+
+    auto type = newObjExpr->objType;
+    auto structType = structOf(type);
+    auto obj = (Value*)nullptr;
+    auto held = (Variable*)nullptr;
+    if (newObjExpr->escapes) {
+      auto size = irBuilder->getInt64(irModule->getDataLayout().getTypeAllocSize(structType));
+      obj = irBuilder->CreateCall(refAllocFunc, {size, irBuilder->getInt32(0)}, type->name.value);
+    } else {
+      obj = createEntryAlloca(structType, type->name.value);
+      auto strings = stringFields(type);
+      if (!strings.empty())
+        held = holdStrings([this, type, obj, strings] {
+          for (auto name : strings) {
+            auto field = irBuilder->CreateLoad(strType, fieldPtr(type, obj, name));
+            releaseIf(irBuilder->getTrue(), field, false);
+          }
+        });
+    }
+    construct(type, obj, args);
+    for (auto i = 0; i < args.size(); i++) {
+      releaseTemporary(newObjExpr->args[i], args[i]);
+    }
+    if (held != nullptr)
+      writeVariable(held, irBuilder->getTrue());
+    if (type->root()->polymorphic)
+      irBuilder->CreateStore(getVtable(type), obj); // vtable pointer is the first field of the root
+    return obj;
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    auto object = std::any_cast<Value*>(emit(memberExpr->object));
+    auto type = memberExpr->object->objType;
+    auto name = memberExpr->member.value;
+    return (Value*)irBuilder->CreateLoad(fieldType(type, name), fieldPtr(type, object, name), name);
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    auto object = std::any_cast<Value*>(emit(memberAssignExpr->object));
+    auto value = std::any_cast<Value*>(emit(memberAssignExpr->value));
+    auto field = fieldPtr(memberAssignExpr->object->objType, object, memberAssignExpr->member.value);
+    storeKept(field, value, memberAssignExpr->value);
+    return value;
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    auto self = methodCallExpr->throughBase ? currentThis
+                                            : std::any_cast<Value*>(emit(methodCallExpr->object));
+    if (methodCallExpr->map != nullptr)
+      return emitMapMethod(methodCallExpr, self);
+    if (methodCallExpr->target == nullptr) // the type checker told about it
+      return (Value*)UndefValue::get(fieldLLVMType(methodCallExpr->type));
+    std::vector<Value*> args = {self};
+    for (auto a : methodCallExpr->args) {
+      args.emplace_back(std::any_cast<Value*>(emit(a)));
+    }
+
+    auto target = emitMethod(methodCallExpr->target, methodCallExpr->targetOwner);
+    auto call = (Value*)nullptr;
+    if (!methodCallExpr->dynamic) {
+      call = irBuilder->CreateCall(target, args);
+    } else {
+      auto root = methodCallExpr->receiverType->root();
+      auto& slots = root->vtable;
+      auto slot = std::find(slots.begin(), slots.end(), methodCallExpr->method.value) - slots.begin();
+      auto vtableType = ArrayType::get(irBuilder->getPtrTy(), slots.size());
+      auto vtable = irBuilder->CreateLoad(irBuilder->getPtrTy(), self, "vtable");
+      auto slotPtr = irBuilder->CreateConstInBoundsGEP2_32(vtableType, vtable, 0, slot);
+      auto method = irBuilder->CreateLoad(irBuilder->getPtrTy(), slotPtr, methodCallExpr->method.value);
+      call = irBuilder->CreateCall(target->getFunctionType(), method, args);
+    }
+    for (auto i = 0; i < methodCallExpr->args.size(); i++) {
+      releaseTemporary(methodCallExpr->args[i], args[i + 1]);
+    }
+    return call;
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    auto value = std::any_cast<Value*>(emit(yieldExpr->value));
+    if (generator.promise == nullptr) // in a method, the type checker told about it
+      return value;
+    irBuilder->CreateStore(convert(value, yieldExpr->value->type, generator.yieldType), generator.promise);
+    suspend("resume");
+    releaseTemporary(yieldExpr->value, value); // the loop over the generator is done with it
+    return value;
+  }
+
+  // resumes the generator for every value and destroys it when it is done, the frame is freed with it;
+  // a map gives its keys, map_next finds the full slot the next round starts from
+  std::any visitFor(ForExpr* forExpr) {
+    auto source = std::any_cast<Value*>(emit(forExpr->source));
+    auto overMap = forExpr->source->type == MAP;
+    if (!overMap && forExpr->source->type != GEN) // the type checker told about it
+      return (Value*)nullptr;
+    auto currFunc = irBuilder->GetInsertBlock()->getParent();
+
+    auto nextBlock = BasicBlock::Create(irBuilder->getContext(), "forNext", currFunc);
+    auto bodyBlock = BasicBlock::Create(irBuilder->getContext(), "forBody", currFunc);
+    auto endBlock = BasicBlock::Create(irBuilder->getContext(), "endFor", currFunc);
+
+    auto id = std::to_string(branchIndex++);
+    auto name = forExpr->item.value;
+    auto position = overMap ? newVariable(name + ".position", irBuilder->getInt64Ty()) : nullptr;
+    if (overMap)
+      writeVariable(position, irBuilder->getInt64(0));
+    irBuilder->CreateBr(nextBlock);
+    irBuilder->SetInsertPoint(nextBlock); // sealed after the edge back, see emitLoopBody
+    auto branch = (BranchInst*)nullptr;
+    auto found = (Value*)nullptr;
+    if (overMap) {
+      found = irBuilder->CreateCall(mapNextFunc, {source, readVariable(position)}, "position");
+      branch = irBuilder->CreateCondBr(irBuilder->CreateICmpSLT(found, irBuilder->getInt64(0)), endBlock, bodyBlock);
+    } else {
+      irBuilder->CreateIntrinsic(Intrinsic::coro_resume, {}, {source});
+      auto done = irBuilder->CreateIntrinsic(Intrinsic::coro_done, {}, {source});
+      branch = irBuilder->CreateCondBr(done, endBlock, bodyBlock);
+    }
+
+    enterBlock(bodyBlock);
+    auto bodyCount = countBlock("forBody" + id);
+    auto shadowed = localScope.find(name);
+    auto outer = shadowed != localScope.end() ? shadowed->second : nullptr;
+    auto itemType = fieldLLVMType(forExpr->itemType);
+    auto itemPtr = (Value*)nullptr;
+    if (overMap) {
+      writeVariable(position, irBuilder->CreateAdd(found, irBuilder->getInt64(1)));
+      itemPtr = irBuilder->CreateCall(mapKeyFunc, {source, found});
+    } else {
+      itemPtr = irBuilder->CreateIntrinsic(
+        Intrinsic::coro_promise, {}, {source, irBuilder->getInt32(promiseAlign), irBuilder->getFalse()}
+      );
+    }
+    auto item = localScope[name] = newVariable(name, itemType);
+    declareVariable(item, forExpr->itemType, 0);
+    writeVariable(item, irBuilder->CreateLoad(itemType, itemPtr, name));
+    emitLoopBody(forExpr->body, nextBlock);
+
+    enterBlock(endBlock);
+    auto endCount = countBlock("endFor" + id);
+    if (!overMap)
+      irBuilder->CreateIntrinsic(Intrinsic::coro_destroy, {}, {source});
+    else if (isFresh(forExpr->source)) // nobody else has it
+      irBuilder->CreateCall(refReleaseFunc, {source});
+    weighBranch(branch, endCount, bodyCount);
+    if (outer != nullptr)
+      localScope[name] = outer;
+    else
+      localScope.erase(name);
+    return (Value*)nullptr;
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    auto currFunc = irBuilder->GetInsertBlock()->getParent();
+
+    auto conditionBlock = BasicBlock::Create(irBuilder->getContext(), "while", currFunc);
+    auto bodyBlock = BasicBlock::Create(irBuilder->getContext(), "whileBody", currFunc);
+    auto endBlock = BasicBlock::Create(irBuilder->getContext(), "endWhile", currFunc);
+
+    auto id = std::to_string(branchIndex++);
+    irBuilder->CreateBr(conditionBlock);
+    irBuilder->SetInsertPoint(conditionBlock); // sealed after the edge back, see emitLoopBody
+    auto condition = std::any_cast<Value*>(emit(whileExpr->condition));
+    auto branch = irBuilder->CreateCondBr(condition, bodyBlock, endBlock);
+
+    enterBlock(bodyBlock);
+    auto bodyCount = countBlock("whileBody" + id);
+    emitLoopBody(whileExpr->body, conditionBlock);
+
+    enterBlock(endBlock);
+    auto endCount = countBlock("endWhile" + id);
+    weighBranch(branch, bodyCount, endCount);
+    return (Value*)nullptr;
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    auto valueType = fieldLLVMType(mapExpr->valueType);
+    auto keyKind = mapKeyType(mapExpr) == STR ? MAP_STR : mapKeyType(mapExpr) == R64 ? MAP_F64 : MAP_I32;
+    auto valueSize = irModule->getDataLayout().getTypeAllocSize(valueType);
+    if (mapExpr->valueType == STR)
+      keyKind |= MAP_STR_VALUES;
+    auto map = irBuilder->CreateCall(mapNewFunc, {irBuilder->getInt32(keyKind), irBuilder->getInt32(valueSize)}, "map");
+    for (auto [key, value] : mapExpr->entries) {
+      auto keyValue = std::any_cast<Value*>(emit(key));
+      auto converted = convert(std::any_cast<Value*>(emit(value)), value->type, mapExpr->valueType);
+      storeKept(callMap("put", mapExpr, map, key, keyValue), converted, value);
+      releaseTemporary(key, keyValue);
+    }
+    return (Value*)map;
+  }
+
+private:
+  // the instructions of the expression get its source line, the ones after it get the outer line back
+  std::any emit(Expr* expr) {
+    if (debugBuilder == nullptr || expr->line < 0)
+      return expr->visit(this);
+    auto outer = irBuilder->getCurrentDebugLocation();
+    locate(expr);
+    auto value = expr->visit(this);
+    irBuilder->SetCurrentDebugLocation(outer);
+    return value;
+  }
+
+  void locate(Expr* expr) {
+    if (debugBuilder != nullptr && expr->line >= 0)
+      irBuilder->SetCurrentDebugLocation(DILocation::get(*llvmContext, expr->line + 1, expr->column + 1, debugScope));
+  }
+
+  DISubprogram* debugSubprogram(
+    Function* function, std::string name, int line, ExprType retType, std::vector<ExprType> argsTypes
+  ) {
+    std::vector<Metadata*> types = {debugType(retType)};
+    for (auto type : argsTypes) {
+      types.emplace_back(debugType(type));
+    }
+    auto sign = debugBuilder->createSubroutineType(debugBuilder->getOrCreateTypeArray(types));
+    auto flags = DISubprogram::SPFlagDefinition;
+    if (optLevel > 0)
+      flags |= DISubprogram::SPFlagOptimized;
+    auto subprogram = debugBuilder->createFunction(
+      debugFile, name, function->getName(), debugFile, line, sign, line, DINode::FlagPrototyped, flags
+    );
+    function->setSubprogram(subprogram);
+    return subprogram;
+  }
+
+  // a parameter when argNo is its place among the arguments, counted from 1
+  // the values are described where they are written, see writeVariable
+  void declareVariable(Variable* variable, ExprType type, int argNo) {
+    if (debugBuilder == nullptr)
+      return;
+    auto location = irBuilder->getCurrentDebugLocation();
+    auto line = location ? location.getLine() : 0;
+    auto name = variable->name;
+    if (argNo > 0)
+      variable->debug =
+        debugBuilder->createParameterVariable(debugScope, name, argNo, debugFile, line, debugType(type), true);
+    else
+      variable->debug = debugBuilder->createAutoVariable(debugScope, name, debugFile, line, debugType(type), true);
+  }
+
+  DIType* debugType(ExprType type) {
+    auto pointerSize = irModule->getDataLayout().getPointerSizeInBits();
+    switch (type) {
+    case VOID:
+      return nullptr;
+    case BOOL:
+      return debugBuilder->createBasicType("bool", 8, dwarf::DW_ATE_boolean);
+    case I8:
+    case I16:
+    case I32:
+    case I64:
+      return debugBuilder->createBasicType(typeName(type), bitWidth(type), dwarf::DW_ATE_signed);
+    case U32:
+    case U64:
+      return debugBuilder->createBasicType(typeName(type), bitWidth(type), dwarf::DW_ATE_unsigned);
+    case F32:
+    case R64:
+      return debugBuilder->createBasicType(typeName(type), bitWidth(type), dwarf::DW_ATE_float);
+    case STR: { // short ones show their bytes
+      auto byte = debugBuilder->createBasicType("char", 8, dwarf::DW_ATE_signed_char);
+      auto bytes = debugBuilder->createArrayType(
+        128, 64, byte, debugBuilder->getOrCreateArray({debugBuilder->getOrCreateSubrange(0, 16)})
+      );
+      return debugBuilder->createTypedef(bytes, "str", debugFile, 0, nullptr);
+    }
+    case FUNC:
+      return debugBuilder->createBasicType("func", pointerSize, dwarf::DW_ATE_address);
+    case GEN:
+      return debugBuilder->createBasicType("generator", pointerSize, dwarf::DW_ATE_address);
+    case UNIQ_REF:
+      return debugBuilder->createBasicType("uniq ref", pointerSize, dwarf::DW_ATE_address);
+    case SHAR_REF:
+      return debugBuilder->createBasicType("shar ref", pointerSize, dwarf::DW_ATE_address);
+    case WEAK_REF:
+      return debugBuilder->createBasicType("weak ref", pointerSize, dwarf::DW_ATE_address);
+    case OBJ:
+      return debugBuilder->createBasicType("object", pointerSize, dwarf::DW_ATE_address);
+    case MAP:
+      return debugBuilder->createBasicType("map", pointerSize, dwarf::DW_ATE_address);
+    }
+    return nullptr;
+  }
+
+  // other lines only see the line itself, its top level functions and variables,
+  // methods and lambdas are emitted again by every line that needs them
+  void internalizeLine() {
+    for (auto& function : *irModule) {
+      auto shared = &function == mainFunc || session->functions.count(function.getName().str()) != 0;
+      if (!function.isDeclaration() && !shared)
+        function.setLinkage(GlobalValue::InternalLinkage);
+    }
+  }
+
+  // linked: the units and main were optimized without the bodies of each other, only the calls between them are
+  // inlined now and what that leaves is cleaned up; the loops inlined into others aren't optimized again
+  void optimize(Module& module, bool linked = false) {
+    LoopAnalysisManager loopAnalysis;
+    FunctionAnalysisManager functionAnalysis;
+    CGSCCAnalysisManager cgsccAnalysis;
+    ModuleAnalysisManager moduleAnalysis;
+    PassBuilder passBuilder;
+    passBuilder.registerModuleAnalyses(moduleAnalysis);
+    passBuilder.registerCGSCCAnalyses(cgsccAnalysis);
+    passBuilder.registerFunctionAnalyses(functionAnalysis);
+    passBuilder.registerLoopAnalyses(loopAnalysis);
+    passBuilder.crossRegisterProxies(loopAnalysis, functionAnalysis, cgsccAnalysis, moduleAnalysis);
+
+    OptimizationLevel levels[] = {
+      OptimizationLevel::O0, OptimizationLevel::O1, OptimizationLevel::O2, OptimizationLevel::O3
+    };
+    auto level = levels[std::min(optLevel, 3)];
+    ModulePassManager passes;
+    if (linked) {
+      FunctionPassManager cleanup;
+      cleanup.addPass(InstCombinePass());
+      cleanup.addPass(SimplifyCFGPass());
+      cleanup.addPass(EarlyCSEPass());
+      CGSCCPassManager inliner;
+      inliner.addPass(InlinerPass());
+      inliner.addPass(createCGSCCToFunctionPassAdaptor(std::move(cleanup)));
+      passes.addPass(createModuleToPostOrderCGSCCPassAdaptor(std::move(inliner)));
+      passes.addPass(GlobalDCEPass());
+    } else {
+      passes = optLevel == 0 ? passBuilder.buildO0DefaultPipeline(OptimizationLevel::O0)
+                             : passBuilder.buildPerModuleDefaultPipeline(level);
+    }
+    passes.run(module, moduleAnalysis);
+  }
+
+  // generators are split into their resume and destroy functions by the passes, even at -O0
+  static bool hasCoroutines(Module& module) {
+    for (auto& function : module) {
+      if (function.isPresplitCoroutine())
+        return true;
+    }
+    return false;
+  }
+
+  // units whose bitcode is in the cache are only declared, the rest is emitted and saved at the end;
+  // main comes last, it declares the units
+  void loadCachedUnits(std::vector<Expr*> syntax) {
+    ScopedTimer timer("load cache");
+    sys::fs::create_directories(cacheDir);
+    for (auto [name, func] : *globalFuncs) {
+      HashWalker hashWalker(*globalFuncs);
+      auto hash = HashWalker::mix(hashWalker.hash(func), name);
+      if (hashWalker.usesObjects || hashWalker.usesGenerators)
+        continue;
+      unitPaths[func] = unitPath(hash);
+      auto unit = readUnit(unitPaths[func]);
+      if (unit != nullptr)
+        cachedUnits[func] = std::move(unit);
+    }
+
+    HashWalker hashWalker(*globalFuncs);
+    auto hash = HashWalker::mix((uint64_t)0, std::string("main"));
+    for (auto expr : syntax) {
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      auto func = newVar != nullptr ? dynamic_cast<FuncExpr*>(newVar->value) : nullptr;
+      if (func != nullptr && unitPaths.count(func) != 0)
+        hash = HashWalker::signature(HashWalker::mix(hash, newVar->identifier.value), func);
+      else
+        hash = HashWalker::mix(hash, hashWalker.hash(expr));
+    }
+    mainPath = unitPath(hash);
+    cachedMain = readUnit(mainPath);
+    TimeReport::get().count("cached functions", cachedUnits.size());
+    TimeReport::get().count("compiled functions", unitPaths.size() - cachedUnits.size());
+    TimeReport::get().count("cached main", cachedMain != nullptr);
+  }
+
+  std::string unitPath(uint64_t hash) {
+    hash = HashWalker::mix(HashWalker::mix(hash, optLevel), std::string(LLVM_VERSION_STRING));
+    hash = HashWalker::mix(hash, codegenVersion);
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    return cacheDir + "/" + key + ".bc";
+  }
+
+  // nullptr if it isn't there, was written by another version, or is broken
+  std::unique_ptr<Module> readUnit(std::string path) {
+    auto buffer = MemoryBuffer::getFile(path);
+    if (!buffer)
+      return nullptr;
+    auto unit = parseBitcodeFile((*buffer)->getMemBufferRef(), *llvmContext);
+    if (!unit) {
+      consumeError(unit.takeError());
+      return nullptr;
+    }
+    return std::move(*unit);
+  }
+
+  struct EmittedUnit {
+    std::vector<std::pair<FuncExpr*, std::string>> bitcode; // a unit of every cached function, then the rest
+    std::string messages; // diagnostics of the thread, printed in the order of the threads
+    MemoryCounters memory; // taken from the thread, the bitcode is freed on the main one
+    std::vector<TimeReport::Event> phases; // timed on the thread, added to the report in the order of the threads
+    int thread = 0;
+  };
+
+  // every thread emits a share of the functions into a module of its own and optimizes it at once, the shares are
+  // runs of functions next to each other, the same ones every time for the same -jN
+  void emitUnitsInParallel() {
+    ScopedTimer timer("codegen units");
+    std::vector<std::pair<std::string, FuncExpr*>> todo;
+    for (auto [name, func] : *globalFuncs) {
+      HashWalker hashWalker(*globalFuncs);
+      hashWalker.hash(func);
+      if (cachedUnits.count(func) == 0 && !hashWalker.usesObjects && !hashWalker.usesGenerators)
+        todo.emplace_back(name, func);
+    }
+
+    auto threadCount = std::min<size_t>(jobs, todo.size());
+    std::vector<EmittedUnit> emitted(threadCount);
+    auto work = [&](int thread) {
+      auto since = memoryCounters();
+      auto first = todo.begin() + todo.size() * thread / threadCount;
+      auto last = todo.begin() + todo.size() * (thread + 1) / threadCount;
+      std::map<FuncExpr*, std::string> paths; // of the ones to cache
+      for (auto it = first; it != last; it++) {
+        if (unitPaths.count(it->second) != 0)
+          paths[it->second] = unitPaths[it->second];
+      }
+      {
+        InterpreterWalker unit(optLevel, "");
+        emitted[thread] = unit.emitShare({first, last}, globalFuncs, paths);
+      }
+      emitted[thread].memory = takeMemory(since); // with what the walker freed when it was deleted
+      emitted[thread].thread = thread;
+    };
+    std::vector<std::thread> threads;
+    for (auto i = 1; i < threadCount; i++) {
+      threads.emplace_back(work, i);
+    }
+    if (threadCount > 0)
+      work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto [name, func] : todo) {
+      if (unitPaths.count(func) == 0)
+        sharedFuncs.insert(func);
+    }
+
+    for (auto& share : emitted) { // back into this context, in the same order every time
+      diagnostics() << share.messages;
+      addMemory(share.memory);
+      TimeReport::get().add(share.phases, share.thread);
+      for (auto& [func, bitcode] : share.bitcode) {
+        auto unit = parseBitcodeFile(MemoryBufferRef(bitcode, "unit"), *llvmContext);
+        if (!unit) {
+          diagnostics() << "can't read a unit of thread " << share.thread << ": " << toString(unit.takeError()) << "\n";
+          continue;
+        }
+        if (func == nullptr) {
+          sharedUnits.emplace_back(std::move(*unit));
+          continue;
+        }
+        writeUnit(**unit, unitPaths[func]);
+        cachedUnits[func] = std::move(*unit);
+      }
+    }
+    TimeReport::get().count("codegen threads", threadCount);
+    TimeReport::get().count("parallel functions", todo.size());
+  }
+
+  // runs on a thread of its own: the functions of the share and the lambdas inside of them go to the module of this
+  // walker, the other top level functions are only declared; the ones with a path are split into units for the cache
+  EmittedUnit emitShare(
+    std::vector<std::pair<std::string, FuncExpr*>> share, std::shared_ptr<std::map<std::string, FuncExpr*>> globals,
+    std::map<FuncExpr*, std::string> paths
+  ) {
+    auto& callerMessages = diagnostics(); // the main thread emits a share too
+    auto firstPhase = TimeReport::get().mark();
+    std::stringstream messages;
+    setDiagnostics(&messages);
+    globalFuncs = globals;
+    unitPaths = paths;
+    std::set<Function*> emitted;
+    for (auto [name, func] : share) {
+      ScopedTimer timer("emit unit");
+      auto function = globalFunction(name);
+      emitFunction(func, function);
+      emitted.insert(function);
+    }
+    reportTailRecursion();
+
+    finished = true; // main stays in the module of the caller
+    mainFunc->eraseFromParent();
+    auto units = extractFreshUnits();
+    for (auto& other : *irModule) {
+      if (!other.isDeclaration() && emitted.count(&other) == 0)
+        other.setLinkage(GlobalValue::InternalLinkage);
+    }
+    std::map<std::string, FuncExpr*> cached;
+    for (auto [func, path] : paths) {
+      cached[path] = func;
+    }
+
+    EmittedUnit result;
+    auto write = [&](Module& module, FuncExpr* func) {
+      if (optLevel > 0 || hasCoroutines(module)) {
+        ScopedTimer timer("optimize -O" + std::to_string(optLevel));
+        optimize(module);
+      }
+      ScopedTimer timer("write bitcode");
+      SmallVector<char, 0> bitcode;
+      raw_svector_ostream out(bitcode);
+      WriteBitcodeToFile(module, out);
+      result.bitcode.emplace_back(func, std::string(bitcode.begin(), bitcode.end()));
+    };
+    for (auto& [path, unit] : units) {
+      write(*unit, cached[path]);
+    }
+    if (units.size() < share.size())
+      write(*irModule, nullptr);
+    setDiagnostics(&callerMessages);
+    result.messages = messages.str();
+    result.phases = TimeReport::get().take(firstPhase);
+    return result;
+  }
+
+  // moves every unit emitted now into a module of its own, the main module keeps declarations of them
+  std::vector<std::pair<std::string, std::unique_ptr<Module>>> extractFreshUnits() {
+    std::vector<std::pair<std::string, std::unique_ptr<Module>>> units;
+    if (freshUnits.empty())
+      return units;
+    ScopedTimer timer("split units");
+    for (auto [name, func] : *globalFuncs) {
+      if (freshUnits.count(func) != 0)
+        units.emplace_back(unitPaths[func], extractUnit(freshUnits[func]));
+    }
+
+    std::vector<GlobalVariable*> unused; // strings and environments only the units used
+    for (auto& global : irModule->globals()) {
+      if (global.hasLocalLinkage() && global.use_empty())
+        unused.emplace_back(&global);
+    }
+    for (auto global : unused) {
+      global->eraseFromParent();
+    }
+    for (auto& [func, unitFunctions] : freshUnits) {
+      for (auto i = 1; i < unitFunctions.size(); i++) {
+        if (unitFunctions[i]->use_empty())
+          unitFunctions[i]->eraseFromParent();
+      }
+    }
+    return units;
+  }
+
+  std::unique_ptr<Module> extractUnit(std::vector<Function*>& unitFunctions) {
+    auto unit = std::make_unique<Module>(unitFunctions[0]->getName(), *llvmContext);
+    std::set<Function*> inside(unitFunctions.begin(), unitFunctions.end());
+
+    // everything the functions refer to, through constants and initializers too
+    std::vector<GlobalValue*> globals;
+    std::set<Value*> seen;
+    std::function<void(Value*)> collect = [&](Value* value) {
+      if (!isa<Constant>(value) || !seen.insert(value).second)
+        return;
+      if (auto global = dyn_cast<GlobalValue>(value)) {
+        globals.emplace_back(global);
+        auto variable = dyn_cast<GlobalVariable>(global);
+        if (variable != nullptr && variable->hasInitializer())
+          collect(variable->getInitializer());
+        return;
+      }
+      for (auto& operand : cast<Constant>(value)->operands()) {
+        collect(operand);
+      }
+    };
+    for (auto function : unitFunctions) {
+      collect(function);
+      for (auto& instruction : instructions(*function)) {
+        for (auto& operand : instruction.operands()) {
+          collect(operand);
+        }
+      }
+    }
+
+    ValueToValueMapTy map;
+    for (auto global : globals) {
+      if (auto function = dyn_cast<Function>(global)) {
+        auto linkage = inside.count(function) != 0 && function != unitFunctions[0] ? GlobalValue::InternalLinkage
+                                                                                   : GlobalValue::ExternalLinkage;
+        auto copy = Function::Create(function->getFunctionType(), linkage, function->getName(), *unit);
+        copy->copyAttributesFrom(function);
+        copy->setLinkage(linkage);
+        map[function] = copy;
+      } else if (auto variable = dyn_cast<GlobalVariable>(global)) {
+        auto copy = new GlobalVariable(
+          *unit, variable->getValueType(), variable->isConstant(), variable->getLinkage(), nullptr, variable->getName()
+        );
+        copy->copyAttributesFrom(variable);
+        map[variable] = copy;
+      }
+    }
+    for (auto global : globals) {
+      auto variable = dyn_cast<GlobalVariable>(global);
+      if (variable != nullptr && variable->hasInitializer())
+        cast<GlobalVariable>(map[variable])->setInitializer(MapValue(variable->getInitializer(), map));
+    }
+    for (auto function : unitFunctions) {
+      auto copy = cast<Function>(map[function]);
+      for (auto i = 0; i < function->arg_size(); i++) {
+        copy->getArg(i)->setName(function->getArg(i)->getName());
+        map[function->getArg(i)] = copy->getArg(i);
+      }
+      SmallVector<ReturnInst*, 8> returns;
+      CloneFunctionInto(copy, function, map, CloneFunctionChangeType::DifferentModule, returns);
+    }
+    auto compileUnits = unit->getNamedMetadata("llvm.dbg.cu"); // added by the cloning even without debug info
+    if (compileUnits != nullptr && compileUnits->getNumOperands() == 0)
+      unit->eraseNamedMetadata(compileUnits);
+
+    unitFunctions[0]->deleteBody();
+    for (auto i = 1; i < unitFunctions.size(); i++) {
+      unitFunctions[i]->dropAllReferences();
+    }
+    return unit;
+  }
+
+  void linkUnits(std::vector<std::pair<std::string, std::unique_ptr<Module>>>& units) {
+    {
+      ScopedTimer timer("write cache");
+      for (auto& [path, unit] : units) {
+        writeUnit(*unit, path);
+      }
+    }
+
+    ScopedTimer timer("link units");
+    Linker linker(*irModule);
+    for (auto& [path, unit] : units) {
+      if (linker.linkInModule(std::move(unit)))
+        diagnostics() << "can't link " << path << "\n";
+    }
+    for (auto [name, func] : *globalFuncs) { // by name, the linked module doesn't depend on where the trees live
+      if (cachedUnits.count(func) != 0 && linker.linkInModule(std::move(cachedUnits[func])))
+        diagnostics() << "can't link the unit of " << name << "\n";
+    }
+    for (auto& unit : sharedUnits) {
+      if (linker.linkInModule(std::move(unit)))
+        diagnostics() << "can't link the unit of a thread\n";
+    }
+    if (cachedMain != nullptr && linker.linkInModule(std::move(cachedMain)))
+      diagnostics() << "can't link the unit of main\n";
+  }
+
+  // through a temporary file, so a build running at the same time never reads half of it
+  void writeUnit(Module& unit, std::string path) {
+    auto writer = std::to_string(sys::Process::getProcessId()) + "-" + std::to_string(get_threadid());
+    auto temporary = path + "." + writer + ".tmp";
+    std::error_code error;
+    {
+      raw_fd_ostream out(temporary, error, sys::fs::OF_None);
+      if (!error)
+        WriteBitcodeToFile(unit, out);
+    }
+    if (!error)
+      error = sys::fs::rename(temporary, path);
+    if (error)
+      diagnostics() << "can't write " << path << ": " << error.message() << "\n";
+  }
+
+  void countModule(std::string suffix) {
+    auto functionCount = 0, instructionCount = 0;
+    for (auto& function : *irModule) {
+      if (function.isDeclaration())
+        continue;
+      functionCount++;
+      instructionCount += function.getInstructionCount();
+    }
+    TimeReport::get().count("llvm functions" + suffix, functionCount);
+    TimeReport::get().count("llvm instructions" + suffix, instructionCount);
+    if (TimeReport::get().measureSizes) {
+      SmallVector<char, 0> bitcode;
+      raw_svector_ostream out(bitcode);
+      WriteBitcodeToFile(*irModule, out);
+      TimeReport::get().size("llvm module bitcode" + suffix, instructionCount, bitcode.size());
+    }
+  }
+
+  // the first argument is the object for methods and the environment for functions
+  Function* declareFunction(FuncExpr* funcExpr, std::string name, TypeExpr* thisType) {
+    std::vector<Type*> paramTypes = {irBuilder->getPtrTy()};
     for (auto type : funcExpr->argsTypes) {
       paramTypes.emplace_back(ExprToLLVMType(type));
     }
 
     auto funcSign = FunctionType::get(ExprToLLVMType(funcExpr->retType), paramTypes, false);
-    auto function = Function::Create(funcSign, Function::ExternalLinkage, "", *irModule);
+    return functions[funcExpr] = Function::Create(funcSign, Function::ExternalLinkage, name, *irModule);
+  }
 
-    auto prevBlock = currBlock;
+  void emitBody(FuncExpr* funcExpr, Function* function, TypeExpr* thisType) {
+    if (funcExpr->memo && !funcExpr->generator)
+      function = emitMemo(funcExpr, function);
+    auto prevBlock = irBuilder->GetInsertBlock();
+    auto prevPoint = irBuilder->GetInsertPoint();
     currBlock = BasicBlock::Create(irBuilder->getContext(), "entry", function);
-    irBuilder->SetInsertPoint(currBlock);
+    enterBlock(currBlock);
 
     auto oldScope = localScope;
+    auto oldOwnedRefs = ownedRefs;
+    auto oldHeldStrings = heldStrings;
+    auto oldVariables = variables.size();
+    auto oldThis = currentThis;
+    auto oldOwner = currentOwner;
+    auto oldScopeName = profileScope;
+    auto oldBranchIndex = branchIndex;
+    auto oldGenerator = generator;
     localScope.clear();
+    ownedRefs.clear();
+    heldStrings.clear();
+    generator = {};
+    currentThis = nullptr;
+    currentOwner = thisType;
+    profileScope = function->hasName() ? function->getName().str() : "lambda" + std::to_string(lambdaIndex++);
+    branchIndex = 0;
+    auto oldDebugScope = debugScope;
+    auto oldLocation = irBuilder->getCurrentDebugLocation();
+    if (debugBuilder != nullptr) {
+      auto argsTypes = funcExpr->argsTypes;
+      argsTypes.insert(argsTypes.begin(), thisType != nullptr ? OBJ : FUNC); // this or the environment
+      debugScope = debugSubprogram(function, profileScope, funcExpr->line + 1, funcExpr->retType, argsTypes);
+      locate(funcExpr);
+    }
+    countEntry(function);
+    auto callId = (int32_t)callNames.size();
+    auto profiled = !callsPath.empty() && !funcExpr->generator; // a generator is left at every yield
+    if (profiled) {
+      callNames.emplace_back(profileScope + ":" + std::to_string(funcExpr->line + 1));
+      irBuilder->CreateCall(callsEnterFunc, {irBuilder->getInt32(callId)});
+    }
+    if (thisType != nullptr) {
+      currentThis = function->getArg(0);
+      currentThis->setName("this");
+    } else if (!funcExpr->captures.empty()) { // the copies can be changed without touching the environment
+      auto env = function->getArg(0);
+      env->setName("env");
+      auto environment = environments[funcExpr];
+      for (auto i = 0; i < funcExpr->captures.size(); i++) {
+        auto name = funcExpr->captures[i];
+        auto type = environment->getElementType(i + 1);
+        auto value = irBuilder->CreateLoad(type, irBuilder->CreateStructGEP(environment, env, i + 1), name);
+        writeVariable(localScope[name] = newVariable(name, type), value);
+      }
+    }
     for (auto i = 0; i < funcExpr->args.size(); i++) {
-      auto arg = function->getArg(i);
+      auto arg = function->getArg(i + 1);
 
       auto name = funcExpr->args[i].value;
       arg->setName(name);
 
-      auto alloca = irBuilder->CreateAlloca(arg->getType(), nullptr, name);
-      irBuilder->CreateStore(arg, alloca);
-      localScope[name] = alloca;
+      auto variable = localScope[name] = newVariable(name, arg->getType());
+      declareVariable(variable, funcExpr->argsTypes[i], i + 1);
+      writeVariable(variable, arg);
     }
 
-    auto ret = std::any_cast<Value*>(funcExpr->body->visit(this));
-    irBuilder->CreateRet(ret);
+    if (funcExpr->generator)
+      emitGenerator(funcExpr, function);
+    else
+      emitReturn(funcExpr->body);
+    if (profiled)
+      leaveOnReturns(function, callId);
+
+    if (debugBuilder != nullptr)
+      debugBuilder->finalizeSubprogram(debugScope);
+    {
+      ScopedTimer timer("verify");
+      if (verifyFunction(*function, &errs())) {
+        errs() << "Error verifying function!\n";
+      }
+    }
 
-    if (verifyFunction(*function, &errs())) {
-      errs() << "Error verifying function!\n";
+    // nothing reads the variables of the function anymore, its blocks may be freed by the passes
+    for (auto& block : *function) {
+      sealedBlocks.erase(&block);
     }
+    std::erase_if(phiVariables, [&](auto& entry) { return entry.first->getFunction() == function; });
 
     currBlock = prevBlock;
-    irBuilder->SetInsertPoint(currBlock);
+    irBuilder->SetInsertPoint(currBlock, prevPoint);
     localScope = oldScope;
+    ownedRefs = oldOwnedRefs;
+    heldStrings = oldHeldStrings;
+    variables.resize(oldVariables);
+    currentThis = oldThis;
+    currentOwner = oldOwner;
+    profileScope = oldScopeName;
+    branchIndex = oldBranchIndex;
+    generator = oldGenerator;
+    debugScope = oldDebugScope;
+    irBuilder->SetCurrentDebugLocation(oldLocation);
+  }
+
+  // 'memo': the function only looks the args up in its cache, a miss calls the body and stores what it returns;
+  // the calls inside of the body go through the lookup too, so every result is computed once;
+  // the cache is made by the first call, the args and the result are kept as 64 bit words
+  Function* emitMemo(FuncExpr* funcExpr, Function* function) {
+    auto name = function->getName().str();
+    auto body = Function::Create(function->getFunctionType(), Function::InternalLinkage, name + ".body", *irModule);
+    auto ptrType = irBuilder->getPtrTy();
+    auto int64Type = irBuilder->getInt64Ty();
+    auto cache = new GlobalVariable(
+      *irModule, ptrType, false, GlobalValue::InternalLinkage, ConstantPointerNull::get(ptrType), name + ".memo"
+    );
+
+    auto entry = BasicBlock::Create(*llvmContext, "entry", function);
+    auto create = BasicBlock::Create(*llvmContext, "create", function);
+    auto lookup = BasicBlock::Create(*llvmContext, "lookup", function);
+    auto hit = BasicBlock::Create(*llvmContext, "hit", function);
+    auto miss = BasicBlock::Create(*llvmContext, "miss", function);
+    IRBuilder<> builder(entry);
+    auto argCount = (int)funcExpr->args.size();
+    auto argsType = ArrayType::get(int64Type, std::max(argCount, 1));
+    auto args = builder.CreateAlloca(argsType, nullptr, "args");
+    auto result = builder.CreateAlloca(int64Type, nullptr, "result");
+    for (auto i = 0; i < argCount; i++) {
+      auto word = toMemoWord(builder, function->getArg(i + 1), funcExpr->argsTypes[i]);
+      builder.CreateStore(word, builder.CreateConstInBoundsGEP2_64(argsType, args, 0, i));
+    }
+    auto existing = builder.CreateLoad(ptrType, cache, "memo");
+    builder.CreateCondBr(builder.CreateIsNull(existing), create, lookup);
+
+    builder.SetInsertPoint(create);
+    auto integerArg = argCount == 1 && funcExpr->argsTypes[0] >= BOOL && funcExpr->argsTypes[0] <= U64;
+    auto memoName = builder.CreateGlobalString(name, name + ".name");
+    auto made = builder.CreateCall(memoNewFunc, {memoName, builder.getInt32(argCount), builder.getInt1(integerArg)});
+    builder.CreateStore(made, cache);
+    builder.CreateBr(lookup);
+
+    builder.SetInsertPoint(lookup);
+    auto memo = builder.CreatePHI(ptrType, 2, "memo");
+    memo->addIncoming(existing, entry);
+    memo->addIncoming(made, create);
+    builder.CreateCondBr(builder.CreateCall(memoFindFunc, {memo, args, result}), hit, miss);
+
+    builder.SetInsertPoint(hit);
+    builder.CreateRet(fromMemoWord(builder, builder.CreateLoad(int64Type, result), function->getReturnType()));
+
+    builder.SetInsertPoint(miss);
+    std::vector<Value*> callArgs;
+    for (auto& arg : function->args()) {
+      callArgs.emplace_back(&arg);
+    }
+    auto value = builder.CreateCall(body, callArgs);
+    builder.CreateCall(memoStoreFunc, {memo, args, toMemoWord(builder, value, funcExpr->retType)});
+    builder.CreateRet(value);
+    return body;
+  }
 
-    return (Value*)function;
+  // reals keep their bits, the signed integers are extended with their sign
+  Value* toMemoWord(IRBuilder<>& builder, Value* value, ExprType type) {
+    if (type == F32 || type == R64)
+      value = builder.CreateBitCast(value, builder.getIntNTy(value->getType()->getPrimitiveSizeInBits()));
+    return builder.CreateIntCast(value, builder.getInt64Ty(), type == I8 || type == I16 || type == I32);
   }
 
-  std::any visitCall(CallExpr* callExpr) {
-    std::vector<Value*> args;
+  Value* fromMemoWord(IRBuilder<>& builder, Value* word, Type* type) {
+    if (!type->isFloatingPointTy())
+      return builder.CreateTrunc(word, type);
+    return builder.CreateBitCast(builder.CreateTrunc(word, builder.getIntNTy(type->getPrimitiveSizeInBits())), type);
+  }
+
+  // the last expression of a function, a call there reuses the frame of the caller,
+  // so recursion in tail position works as a loop
+  void emitReturn(Expr* expr) {
+    auto function = irBuilder->GetInsertBlock()->getParent();
+    locate(expr); // the return goes to the line of the last expression
+    auto block = dynamic_cast<BlockExpr*>(expr);
+    if (block != nullptr && !block->list.empty()) {
+      for (auto i = 0; i + 1 < block->list.size(); i++) {
+        emitStatement(block->list[i]);
+      }
+      emitReturn(block->list.back());
+      return;
+    }
+
+    auto ifElse = dynamic_cast<IfElseExpr*>(expr);
+    if (ifElse != nullptr && ifElse->elseBlock != nullptr) { // both branches return on their own
+      auto condition = std::any_cast<Value*>(emit(ifElse->condition));
+      auto thenBlock = BasicBlock::Create(irBuilder->getContext(), "then", function);
+      auto elseBlock = BasicBlock::Create(irBuilder->getContext(), "else", function);
+      auto id = std::to_string(branchIndex++);
+      auto branch = irBuilder->CreateCondBr(condition, thenBlock, elseBlock);
+
+      enterBlock(thenBlock);
+      auto thenCount = countBlock("then" + id);
+      emitReturn(ifElse->thenBlock);
+      enterBlock(elseBlock);
+      auto elseCount = countBlock("else" + id);
+      emitReturn(ifElse->elseBlock);
+      weighBranch(branch, thenCount, elseCount);
+      return;
+    }
+
+    auto call = dynamic_cast<CallExpr*>(expr);
+    auto ret = (Value*)nullptr;
+    if (call != nullptr && ownedRefs.empty() && heldStrings.empty()) { // nothing has to be released after the call
+      ret = emitCall(call, true);
+    } else {
+      ret = std::any_cast<Value*>(emit(expr));
+      if (ret != nullptr && function->getReturnType() == strType) // the caller gets a share of its own
+        keepString(expr, ret);
+      else if (ret != nullptr)
+        releaseTemporary(expr, ret);
+      releaseOwnedRefs(ret);
+    }
+    if (function->getReturnType()->isVoidTy())
+      irBuilder->CreateRetVoid();
+    else
+      irBuilder->CreateRet(ret);
+  }
+
+  // coroutine of the switch lowering: the call allocates the frame and suspends before the body,
+  // every resume runs it to the next yield; when the frame is created and destroyed in the same function
+  // after inlining, CoroElide puts it on the stack of that function and the pipeline allocates nothing
+  void emitGenerator(FuncExpr* funcExpr, Function* function) {
+    function->addFnAttr(Attribute::PresplitCoroutine);
+    auto ptrType = irBuilder->getPtrTy();
+    auto none = ConstantTokenNone::get(*llvmContext);
+    auto null = ConstantPointerNull::get(ptrType);
+    auto promise = createEntryAlloca(fieldLLVMType(funcExpr->yieldType), "promise");
+    promise->setAlignment(Align(promiseAlign));
+    auto align = irBuilder->getInt32(promiseAlign);
+    auto id = irBuilder->CreateIntrinsic(Intrinsic::coro_id, {}, {align, promise, null, null});
+    auto needsFrame = irBuilder->CreateIntrinsic(Intrinsic::coro_alloc, {}, {id});
+
+    auto allocBlock = BasicBlock::Create(irBuilder->getContext(), "allocFrame", function);
+    auto beginBlock = BasicBlock::Create(irBuilder->getContext(), "begin", function);
+    auto entryBlock = irBuilder->GetInsertBlock();
+    irBuilder->CreateCondBr(needsFrame, allocBlock, beginBlock);
+    enterBlock(allocBlock);
+    auto size = irBuilder->CreateIntrinsic(Intrinsic::coro_size, {irBuilder->getInt64Ty()}, {});
+    auto mallocFunc = irModule->getOrInsertFunction("malloc", ptrType, irBuilder->getInt64Ty());
+    auto allocated = irBuilder->CreateCall(mallocFunc, {size}, "frame");
+    irBuilder->CreateBr(beginBlock);
+    enterBlock(beginBlock);
+    auto frame = irBuilder->CreatePHI(ptrType, 2, "frame");
+    frame->addIncoming(null, entryBlock);
+    frame->addIncoming(allocated, allocBlock);
+    auto handle = irBuilder->CreateIntrinsic(Intrinsic::coro_begin, {}, {id, frame});
+
+    generator = {
+      promise, funcExpr->yieldType, BasicBlock::Create(irBuilder->getContext(), "suspend", function),
+      BasicBlock::Create(irBuilder->getContext(), "cleanup", function)
+    };
+    suspend("start");
+    emit(funcExpr->body);
+    auto final = irBuilder->CreateIntrinsic(Intrinsic::coro_suspend, {}, {none, irBuilder->getTrue()});
+    irBuilder->CreateSwitch(final, generator.suspend, 1)->addCase(irBuilder->getInt8(1), generator.cleanup);
+
+    enterBlock(generator.cleanup); // after the last edge into it, the refs are read on every path
+    releaseOwnedRefs(nullptr);
+    auto freed = irBuilder->CreateIntrinsic(Intrinsic::coro_free, {}, {id, handle});
+    irBuilder->CreateCall(irModule->getOrInsertFunction("free", irBuilder->getVoidTy(), ptrType), {freed});
+    irBuilder->CreateBr(generator.suspend);
+
+    enterBlock(generator.suspend);
+    irBuilder->CreateIntrinsic(Intrinsic::coro_end, {}, {handle, irBuilder->getFalse(), none});
+    irBuilder->CreateRet(handle);
+  }
+
+  // the code after it runs on the next resume, a destroy goes to the cleanup instead
+  void suspend(std::string resumeName) {
+    auto currFunc = irBuilder->GetInsertBlock()->getParent();
+    auto resumeBlock = BasicBlock::Create(irBuilder->getContext(), resumeName, currFunc);
+    auto none = ConstantTokenNone::get(*llvmContext);
+    auto state = irBuilder->CreateIntrinsic(Intrinsic::coro_suspend, {}, {none, irBuilder->getFalse()});
+    auto cases = irBuilder->CreateSwitch(state, generator.suspend, 2);
+    cases->addCase(irBuilder->getInt8(0), resumeBlock);
+    cases->addCase(irBuilder->getInt8(1), generator.cleanup);
+    enterBlock(resumeBlock);
+  }
+
+  // the refs the body owns are released at the end of every round, the next one owns new ones;
+  // the header of the loop is sealed here, once the edge back to it is there
+  void emitLoopBody(BlockExpr* body, BasicBlock* header) {
+    auto outerRefs = ownedRefs;
+    emit(body);
+    std::vector<std::tuple<Value*, Value*, bool>> releases;
+    for (auto [name, owned] : ownedRefs) {
+      if (outerRefs.count(name) == 0)
+        releases.emplace_back(readVariable(owned.flag), readVariable(localScope[name]), owned.weak);
+    }
+    for (auto [condition, ref, weak] : releases) {
+      releaseIf(condition, ref, weak);
+    }
+    ownedRefs = outerRefs;
+    irBuilder->CreateBr(header);
+    sealBlock(header);
+  }
+
+  // top level functions without captures are called directly,
+  // other function values are environments that hold the function to call
+  CallInst* emitCall(CallExpr* callExpr, bool tail) {
+    std::vector<Value*> args = {nullptr};
     for (auto a : callExpr->args) {
-      args.emplace_back(std::any_cast<Value*>(a->visit(this)));
+      args.emplace_back(std::any_cast<Value*>(emit(a)));
     }
 
-    auto func = std::any_cast<Value*>(callExpr->func->visit(this));
-    if (isa<Function>(func)) {
-      return (Value*)irBuilder->CreateCall(cast<Function>(func), args);
+    auto caller = irBuilder->GetInsertBlock()->getParent();
+    auto var = dynamic_cast<VarExpr*>(callExpr->func);
+    auto name = var != nullptr ? var->identifier.value : "";
+    auto call = (CallInst*)nullptr;
+    if (var != nullptr && localScope.count(name) == 0 && globalFuncs->count(name) != 0) {
+      auto function = globalFunction(name);
+      args[0] = ConstantPointerNull::get(irBuilder->getPtrTy());
+      call = irBuilder->CreateCall(function, args);
+      calls[caller].emplace_back(function, tail);
     } else {
-      std::vector<Type*> paramTypes;
+      std::vector<Type*> paramTypes = {irBuilder->getPtrTy()};
       for (auto a : callExpr->args) {
         paramTypes.emplace_back(ExprToLLVMType(a->type));
       }
-      auto funcSign = FunctionType::get(ExprToLLVMType(callExpr->type), paramTypes, false); // TODO !
-      return (Value*)irBuilder->CreateCall(funcSign, func, args);
+      auto funcSign = FunctionType::get(ExprToLLVMType(callExpr->type), paramTypes, false);
+      auto env = std::any_cast<Value*>(emit(callExpr->func));
+      args[0] = env;
+      auto function = irBuilder->CreateLoad(irBuilder->getPtrTy(), env, "func");
+      call = irBuilder->CreateCall(funcSign, function, args);
+      tail = false; // the environment can be on the stack of the caller
+    }
+
+    for (auto i = 0; i < callExpr->args.size(); i++) {
+      if (ownsString(callExpr->args[i])) // the callee only borrows it, it is let go after the call
+        tail = false;
+      releaseTemporary(callExpr->args[i], args[i + 1]);
+    }
+    for (auto lent : callExpr->lent) {
+      if (isOnStack(lent))
+        tail = false;
+    }
+    if (tail) { // musttail needs the same signature, otherwise it is only a hint
+      auto sameSign = call->getFunctionType() == caller->getFunctionType();
+      call->setTailCallKind(sameSign ? CallInst::TCK_MustTail : CallInst::TCK_Tail);
     }
+    return call;
   }
 
-  std::any visitPrintln(PrintlnExpr* printlnExpr) {
-    std::string format = "";
+  // the main module declares all of them up front, a unit only the ones it uses
+  Function* globalFunction(std::string name) {
+    auto func = globalFuncs->at(name);
+    return functions.count(func) != 0 ? functions[func] : declareFunction(func, name, nullptr);
+  }
+
+  GlobalVariable* getEmptyEnvironment(FuncExpr* funcExpr) {
+    if (emptyEnvironments.count(funcExpr) != 0)
+      return emptyEnvironments[funcExpr];
+    auto function = functions[funcExpr];
+    auto environment = ConstantStruct::getAnon({function});
+    return emptyEnvironments[funcExpr] = new GlobalVariable(
+             *irModule, environment->getType(), true, GlobalValue::PrivateLinkage, environment,
+             function->getName() + ".env"
+           );
+  }
+
+  // how many times the current block runs: counted by the instrumented program, read from the profile of it
+  uint64_t countBlock(std::string label) {
+    auto name = profileScope + ":" + label;
+    if (counters != nullptr) {
+      auto counter = irBuilder->CreateConstInBoundsGEP1_64(irBuilder->getInt64Ty(), counters, counterNames.size());
+      counterNames.emplace_back(name);
+      auto count = irBuilder->CreateLoad(irBuilder->getInt64Ty(), counter, "count");
+      irBuilder->CreateStore(irBuilder->CreateAdd(count, irBuilder->getInt64(1)), counter);
+    }
+    auto found = profile.find(name);
+    if (found == profile.end())
+      return 0;
+    profileMatched++;
+    return found->second;
+  }
+
+  // hot functions get inlined, the ones that never ran are cold
+  void countEntry(Function* function) {
+    auto count = countBlock("entry");
+    if (profile.count(profileScope + ":entry") != 0)
+      function->setEntryCount(count);
+  }
+
+  void weighBranch(BranchInst* branch, uint64_t onTrue, uint64_t onFalse) {
+    if (profile.empty() || onTrue + onFalse == 0)
+      return;
+    while (std::max(onTrue, onFalse) > UINT32_MAX) {
+      onTrue >>= 1;
+      onFalse >>= 1;
+    }
+    branch->setMetadata(LLVMContext::MD_prof, MDBuilder(*llvmContext).createBranchWeights(onTrue, onFalse));
+  }
+
+  // "function:block count" per line, written by profile_register of the runtime
+  void readProfile(std::string path) {
+    std::ifstream in(path);
+    if (!in) {
+      diagnostics() << "can't read the profile " << path << "\n";
+      return;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      auto space = line.rfind(' ');
+      if (line.empty() || line[0] == '#' || space == std::string::npos)
+        continue;
+      profile[line.substr(0, space)] = std::strtoull(line.c_str() + space + 1, nullptr, 10);
+    }
+  }
+
+  // the counters get their size once every block is emitted, main hands them to the runtime to write at exit
+  void registerProfile() {
+    auto type = ArrayType::get(irBuilder->getInt64Ty(), counterNames.size());
+    auto array = new GlobalVariable(
+      *irModule, type, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(type), ""
+    );
+    counters->replaceAllUsesWith(array);
+    array->takeName(counters);
+    counters->eraseFromParent();
+    counters = array;
+
+    std::string names = "";
+    for (auto name : counterNames) {
+      names += name + "\n";
+    }
+    auto ptrType = irBuilder->getPtrTy();
+    auto registerFunc =
+      declareRuntime("profile_register", irBuilder->getVoidTy(), {ptrType, ptrType, ptrType, irBuilder->getInt32Ty()});
+    auto& entry = mainFunc->getEntryBlock();
+    IRBuilder<> entryBuilder(&entry, entry.begin());
+    entryBuilder.CreateCall(
+      registerFunc, {entryBuilder.CreateGlobalString(profileGenerate), entryBuilder.CreateGlobalString(names), counters,
+                     entryBuilder.getInt32(counterNames.size())}
+    );
+  }
+
+  // every return leaves the function first, a tail call leaves before it jumps, so it still reuses the frame
+  void leaveOnReturns(Function* function, int32_t callId) {
+    for (auto& block : *function) {
+      auto ret = dyn_cast<ReturnInst>(block.getTerminator());
+      if (ret == nullptr)
+        continue;
+      auto call = dyn_cast_or_null<CallInst>(ret->getPrevNode());
+      IRBuilder<> exitBuilder(call != nullptr && call->isTailCall() ? (Instruction*)call : ret);
+      exitBuilder.CreateCall(callsExitFunc, {exitBuilder.getInt32(callId)});
+    }
+  }
+
+  void registerCalls() {
+    leaveOnReturns(mainFunc, 0);
+    std::string names = "";
+    for (auto name : callNames) {
+      names += name + "\n";
+    }
+    auto ptrType = irBuilder->getPtrTy();
+    auto registerFunc =
+      declareRuntime("calls_register", irBuilder->getVoidTy(), {ptrType, ptrType, irBuilder->getInt32Ty()});
+    auto& entry = mainFunc->getEntryBlock();
+    IRBuilder<> entryBuilder(&entry, entry.begin());
+    entryBuilder.CreateCall(
+      registerFunc, {entryBuilder.CreateGlobalString(callsPath), entryBuilder.CreateGlobalString(names),
+                     entryBuilder.getInt32(callNames.size())}
+    );
+  }
+
+  // tells the optimizer which counts are hot, with the cutoffs llvm-profdata uses
+  void attachProfileSummary() {
+    std::vector<uint64_t> counts;
+    auto total = (uint64_t)0, maxFunctionCount = (uint64_t)0;
+    auto functionCount = 0;
+    for (auto [name, count] : profile) {
+      counts.emplace_back(count);
+      total += count;
+      if (name.size() > 6 && name.compare(name.size() - 6, 6, ":entry") == 0) {
+        maxFunctionCount = std::max(maxFunctionCount, count);
+        functionCount++;
+      }
+    }
+    if (total == 0)
+      return;
+    std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+
+    SummaryEntryVector detailed;
+    uint32_t cutoffs[] = {10000,  100000, 200000, 300000, 400000, 500000, 600000, 700000,
+                          800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999};
+    auto covered = (uint64_t)0;
+    auto taken = 0;
+    for (auto cutoff : cutoffs) { // the fewest biggest counts that sum up to the cutoff part of the total
+      while (taken < counts.size() && covered < total * (cutoff / 1e6)) {
+        covered += counts[taken++];
+      }
+      detailed.push_back({cutoff, counts[std::max(taken, 1) - 1], (uint64_t)taken});
+    }
+    ProfileSummary summary(
+      ProfileSummary::PSK_Instr, detailed, total, counts[0], counts[0], maxFunctionCount, counts.size(), functionCount
+    );
+    irModule->setProfileSummary(summary.getMD(*llvmContext), ProfileSummary::PSK_Instr);
+  }
+
+  static bool isOnStack(Expr* allocation) {
+    if (auto refExpr = dynamic_cast<RefExpr*>(allocation))
+      return !refExpr->escapes;
+    if (auto newObjExpr = dynamic_cast<NewObjExpr*>(allocation))
+      return !newObjExpr->escapes;
+    if (auto funcExpr = dynamic_cast<FuncExpr*>(allocation))
+      return !funcExpr->escapes;
+    return false;
+  }
+
+  // a 'tail' function that can reach itself through a call not in tail position
+  void reportTailRecursion() {
+    for (auto [funcExpr, function] : functions) {
+      if (!funcExpr->tail)
+        continue;
+
+      std::set<std::pair<Function*, bool>> visited;
+      std::vector<std::pair<Function*, bool>> stack = {{function, false}};
+      auto grows = false;
+      while (!stack.empty() && !grows) {
+        auto [caller, notTail] = stack.back();
+        stack.pop_back();
+        for (auto [callee, tail] : calls[caller]) {
+          auto state = std::pair(callee, notTail || !tail);
+          if (callee == function && state.second)
+            grows = true;
+          if (visited.insert(state).second)
+            stack.emplace_back(state);
+        }
+      }
+      if (grows) {
+        diagnostics() << "'" << function->getName().str() << "' is tail, but calls itself not in tail position, "
+                      << "deep recursion will overflow the stack\n";
+      }
+    }
+  }
+
+  Function* emitMethod(FuncExpr* method, TypeExpr* owner) {
+    if (functions.count(method) != 0)
+      return functions[method];
+    auto name = owner->name.value;
+    for (auto& [methodName, m] : owner->methods) {
+      if (m == method)
+        name += "." + methodName;
+    }
+    auto function = declareFunction(method, name, owner); // before the body, it can call itself
+    emitBody(method, function, owner);
+    return function;
+  }
+
+  // big fields first, so smaller ones fill the space that alignment would waste
+  StructType* structOf(TypeExpr* type) {
+    if (structs.count(type) != 0)
+      return structs[type];
+
+    auto& layout = irModule->getDataLayout();
+    std::vector<Type*> elements;
+    if (type->base != nullptr)
+      elements.emplace_back(structOf(type->base));
+    else if (type->polymorphic)
+      elements.emplace_back(irBuilder->getPtrTy()); // vtable
+
+    auto fields = type->ownFields;
+    std::stable_sort(fields.begin(), fields.end(), [&](auto& a, auto& b) {
+      auto aType = fieldLLVMType(a.second), bType = fieldLLVMType(b.second);
+      auto aAlign = layout.getABITypeAlign(aType), bAlign = layout.getABITypeAlign(bType);
+      if (aAlign != bAlign)
+        return aAlign > bAlign;
+      return layout.getTypeAllocSize(aType) > layout.getTypeAllocSize(bType);
+    });
+    for (auto [name, fieldType] : fields) {
+      fieldIndex[type][name] = elements.size();
+      elements.emplace_back(fieldLLVMType(fieldType));
+    }
+
+    return structs[type] = StructType::create(*llvmContext, elements, type->name.value);
+  }
+
+  // a base type is at the start of the derived one, so the same pointer works for both
+  Value* fieldPtr(TypeExpr* type, Value* object, std::string name) {
+    for (auto t = type; t != nullptr; t = t->base) {
+      structOf(t);
+      if (fieldIndex[t].count(name) != 0)
+        return irBuilder->CreateStructGEP(structs[t], object, fieldIndex[t][name], name + ".ptr");
+    }
+    diagnostics() << "no field '" << name << "' in " << type->name.value << "\n";
+    return object;
+  }
+
+  // with the ones of the bases
+  static std::vector<std::string> stringFields(TypeExpr* type) {
+    std::vector<std::string> names;
+    for (auto t = type; t != nullptr; t = t->base) {
+      for (auto [fieldName, fieldType] : t->ownFields) {
+        if (fieldType == STR)
+          names.emplace_back(fieldName);
+      }
+    }
+    return names;
+  }
+
+  bool hasField(TypeExpr* type, std::string name) {
+    for (auto t = type; t != nullptr; t = t->base) {
+      for (auto [fieldName, fieldType] : t->ownFields) {
+        if (fieldName == name)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  Type* fieldType(TypeExpr* type, std::string name) {
+    for (auto t = type; t != nullptr; t = t->base) {
+      for (auto [fieldName, fieldType] : t->ownFields) {
+        if (fieldName == name)
+          return fieldLLVMType(fieldType);
+      }
+    }
+    return irBuilder->getInt32Ty();
+  }
+
+  Type* fieldLLVMType(ExprType type) {
+    return type == VOID ? irBuilder->getInt32Ty() : ExprToLLVMType(type);
+  }
+
+  // runs the initializers of the type and its bases on the memory of the object
+  void construct(TypeExpr* type, Value* object, std::vector<Value*> args) {
+    auto oldScope = localScope;
+    auto oldThis = currentThis;
+    auto oldOwner = currentOwner;
+    localScope.clear();
+    currentThis = object;
+    currentOwner = type;
+
+    structOf(type);
+    for (auto i = 0; i < args.size() && i < type->params.size(); i++) {
+      auto name = type->params[i].value;
+      if (fieldIndex[type].count(name) != 0) {
+        if (args[i]->getType() == strType) // the caller lets go of a fresh one after
+          retainString(args[i]);
+        irBuilder->CreateStore(args[i], fieldPtr(type, object, name));
+      } else { // only passed to the base
+        writeVariable(localScope[name] = newVariable(name, args[i]->getType()), args[i]);
+      }
+    }
+
+    if (type->base != nullptr) {
+      std::vector<Value*> baseArgs;
+      for (auto a : type->baseArgs) {
+        baseArgs.emplace_back(std::any_cast<Value*>(emit(a)));
+      }
+      construct(type->base, object, baseArgs);
+      for (auto i = 0; i < baseArgs.size(); i++) {
+        releaseTemporary(type->baseArgs[i], baseArgs[i]);
+      }
+    }
+
+    for (auto field : type->fields) {
+      auto value = std::any_cast<Value*>(emit(field->value));
+      keepString(field->value, value);
+      irBuilder->CreateStore(value, fieldPtr(type, object, field->identifier.value));
+    }
+
+    localScope = oldScope;
+    currentThis = oldThis;
+    currentOwner = oldOwner;
+  }
+
+  // one slot per dynamically called method of the hierarchy
+  GlobalVariable* getVtable(TypeExpr* type) {
+    if (vtables.count(type) != 0)
+      return vtables[type];
+
+    auto& slots = type->root()->vtable;
+    std::vector<Constant*> entries;
+    for (auto slot : slots) {
+      auto [owner, method] = type->findMethod(slot);
+      if (method == nullptr || method->type != FUNC) // never called on this type
+        entries.emplace_back(ConstantPointerNull::get(irBuilder->getPtrTy()));
+      else
+        entries.emplace_back(emitMethod(method, owner));
+    }
+    auto vtableType = ArrayType::get(irBuilder->getPtrTy(), slots.size());
+    return vtables[type] = new GlobalVariable(
+             *irModule, vtableType, true, GlobalValue::PrivateLinkage, ConstantArray::get(vtableType, entries),
+             type->name.value + ".vtable"
+           );
+  }
+
+  // put and get go through the slot the runtime gives, get reads a zero value when there is no such key
+  Value* emitMapMethod(MethodCallExpr* methodCallExpr, Value* map) {
     std::vector<Value*> args;
-    for (auto i = 0; i < printlnExpr->values.size(); i++) {
-      auto v = printlnExpr->values[i];
-      auto value = std::any_cast<Value*>(v->visit(this));
-      switch (v->type) {
-      case BOOL:
-        format += "%i";
-        value = irBuilder->CreateZExt(value, irBuilder->getInt32Ty());
-        break;
-      case VOID:
-      case I32:
-        format += "%i";
-        break;
-      case R64:
-        format += "%f";
-        break;
-      case STR:
-        format += "%s";
-        break;
-      case FUNC:
-        format += "%i";
-        break;
+    for (auto a : methodCallExpr->args) {
+      args.emplace_back(std::any_cast<Value*>(emit(a)));
+    }
+    auto mapExpr = methodCallExpr->map;
+    auto name = methodCallExpr->method.value;
+    if (name == "size")
+      return irBuilder->CreateCall(mapSizeFunc, {map}, "size");
+    auto key = methodCallExpr->args[0];
+    auto result = (Value*)nullptr;
+    if (name == "put") {
+      result = convert(args[1], methodCallExpr->args[1]->type, mapExpr->valueType);
+      storeKept(callMap("put", mapExpr, map, key, args[0]), result, methodCallExpr->args[1]);
+    } else if (name == "remove") {
+      result = callMap("remove", mapExpr, map, key, args[0]);
+    } else {
+      auto slot = callMap("find", mapExpr, map, key, args[0]);
+      result = irBuilder->CreateICmpNE(slot, ConstantPointerNull::get(irBuilder->getPtrTy()), "found");
+      if (name != "has") { // get lends the string in the slot
+        auto valueType = fieldLLVMType(mapExpr->valueType);
+        auto from = irBuilder->CreateSelect(result, slot, zeroValue(valueType));
+        result = irBuilder->CreateLoad(valueType, from, name);
       }
-      if (i != printlnExpr->values.size() - 1)
-        format += ", ";
-      args.emplace_back(value);
     }
-    format += '\n';
+    releaseTemporary(key, args[0]); // a new key took a share of its own
+    return result;
+  }
+
+  // the runtime has functions for i32, f64 and str keys, strings go by pointer
+  Value* callMap(std::string function, MapExpr* mapExpr, Value* map, Expr* keyExpr, Value* key) {
+    auto keyType = mapKeyType(mapExpr);
+    auto arg = keyType == STR ? stringPointer(key) : convert(key, keyExpr->type, keyType);
+    return irBuilder->CreateCall(mapFuncs[{function, keyType}], {map, arg});
+  }
+
+  // keys of other types were reported by the type checker
+  static ExprType mapKeyType(MapExpr* mapExpr) {
+    return mapExpr->keyType == STR || mapExpr->keyType == R64 ? mapExpr->keyType : I32;
+  }
+
+  GlobalVariable* zeroValue(Type* type) {
+    auto& global = zeroValues[type];
+    if (global == nullptr)
+      global = new GlobalVariable(
+        *irModule, type, true, GlobalValue::PrivateLinkage, Constant::getNullValue(type), "zero.value"
+      );
+    return global;
+  }
+
+  // made right there for whoever uses it, not kept by a variable
+  static bool isFresh(Expr* expr) {
+    auto call = dynamic_cast<CallExpr*>(expr);
+    return dynamic_cast<MapExpr*>(expr) != nullptr || (call != nullptr && call->ownsResult);
+  }
+
+  // what the part evaluated to, before it was widened for printf
+  Value* appendFormat(Expr* v, std::string& format, std::vector<Value*>& args) {
+    auto emitted = std::any_cast<Value*>(emit(v));
+    auto value = emitted;
+    switch (v->type) {
+    case BOOL:
+      format += "%i";
+      value = irBuilder->CreateZExt(value, irBuilder->getInt32Ty());
+      break;
+    case VOID:
+      format += "%i";
+      break;
+    case I8:
+    case I16:
+    case I32:
+    case I64:
+    case U32:
+    case U64:
+    case F32:
+    case R64: {
+      auto printed = printedAs(v->type);
+      format += printed == I32 ? "%i" : printed == I64 ? "%lld" : printed == U64 ? "%llu" : "%f";
+      value = convert(value, v->type, printed);
+      break;
+    }
+    case STR: {
+      format += "%.*s";
+      auto [size, data] = stringView(value);
+      args.emplace_back(irBuilder->CreateTrunc(size, irBuilder->getInt32Ty()));
+      value = data;
+      break;
+    }
+    case FUNC:
+      format += "%i";
+      break;
+    case UNIQ_REF:
+    case SHAR_REF:
+    case WEAK_REF:
+    case OBJ:
+    case GEN:
+    case MAP:
+      format += "%p";
+      break;
+    }
+    args.emplace_back(value);
+    return emitted;
+  }
+
+  // the runtime writes i32, i64, u64 and f64, the rest is widened to one of them
+  static ExprType printedAs(ExprType type) {
+    switch (type) {
+    case I8:
+    case I16:
+      return I32;
+    case U32:
+      return I64;
+    case F32:
+      return R64;
+    default:
+      return type;
+    }
+  }
 
+  // numbers of any width into each other, bool is 0 or 1
+  Value* convert(Value* value, ExprType from, ExprType to) {
+    if (from == to || !(isNumber(from) || from == BOOL) || !(isNumber(to) || to == BOOL))
+      return value;
+    auto type = ExprToLLVMType(to);
+    if (to == BOOL) {
+      auto zero = Constant::getNullValue(value->getType());
+      return isFloat(from) ? irBuilder->CreateFCmpUNE(value, zero) : irBuilder->CreateICmpNE(value, zero);
+    }
+    if (isFloat(from) && isFloat(to))
+      return irBuilder->CreateFPCast(value, type);
+    if (isFloat(from))
+      return isUnsigned(to) ? irBuilder->CreateFPToUI(value, type) : irBuilder->CreateFPToSI(value, type);
+    auto fromSigned = from != BOOL && !isUnsigned(from);
+    if (isFloat(to))
+      return fromSigned ? irBuilder->CreateSIToFP(value, type) : irBuilder->CreateUIToFP(value, type);
+    return irBuilder->CreateIntCast(value, type, fromSigned);
+  }
+
+  static bool isRef(ExprType type) {
+    return type == UNIQ_REF || type == SHAR_REF || type == WEAK_REF;
+  }
+
+  // values that can point to memory from ref_alloc
+  static bool isOwnable(ExprType type) {
+    return isRef(type) || type == OBJ || type == FUNC || type == MAP || type == STR;
+  }
+
+  Function* declareRuntime(std::string name, Type* retType, std::vector<Type*> paramTypes) {
+    auto sign = FunctionType::get(retType, paramTypes, false);
+    return Function::Create(sign, Function::ExternalLinkage, name, irModule);
+  }
+
+  // allocas outside of the entry block are not promoted to registers and can't be seen from other branches
+  AllocaInst* createEntryAlloca(Type* type, std::string name) {
+    auto& entry = irBuilder->GetInsertBlock()->getParent()->getEntryBlock();
+    IRBuilder<> entryBuilder(&entry, entry.begin());
+    return entryBuilder.CreateAlloca(type, nullptr, name);
+  }
+
+  Variable* newVariable(std::string name, Type* type) {
+    variables.emplace_back(new Variable{name, type});
+    return variables.back().get();
+  }
+
+  // every block is entered once all the edges into it are made, only loop headers wait for the edge back
+  void enterBlock(BasicBlock* block) {
+    irBuilder->SetInsertPoint(block);
+    sealBlock(block);
+  }
+
+  void writeVariable(Variable* variable, Value* value) {
+    auto block = irBuilder->GetInsertBlock();
+    variable->values[block] = value;
+    auto location = irBuilder->getCurrentDebugLocation();
+    if (variable->debug != nullptr && location)
+      debugBuilder->insertDbgValueIntrinsic(value, variable->debug, debugBuilder->createExpression(), location, block);
+  }
+
+  Value* readVariable(Variable* variable) {
+    return readVariable(variable, irBuilder->GetInsertBlock());
+  }
+
+  Value* readVariable(Variable* variable, BasicBlock* block) {
+    auto found = variable->values.find(block);
+    if (found != variable->values.end())
+      return found->second;
+    auto value = (Value*)nullptr;
+    if (sealedBlocks.count(block) == 0) { // the operands come when the last edge is there
+      auto phi = createPhi(variable, block);
+      incompletePhis[block].emplace_back(phi);
+      value = phi;
+    } else if (pred_empty(block)) {
+      value = UndefValue::get(variable->type);
+    } else if (auto single = block->getSinglePredecessor()) {
+      value = readVariable(variable, single);
+    } else {
+      auto phi = createPhi(variable, block);
+      variable->values[block] = phi; // a loop back to the block finds the phi and stops there
+      value = addPhiOperands(phi);
+    }
+    variable->values[block] = value;
+    return value;
+  }
+
+  PHINode* createPhi(Variable* variable, BasicBlock* block) {
+    IRBuilder<> phiBuilder(block, block->begin());
+    auto phi = phiBuilder.CreatePHI(variable->type, 2, variable->name);
+    phiVariables[phi] = variable;
+    return phi;
+  }
+
+  Value* addPhiOperands(PHINode* phi) {
+    auto variable = phiVariables[phi];
+    for (auto pred : predecessors(phi->getParent())) {
+      phi->addIncoming(readVariable(variable, pred), pred);
+    }
+    return removeTrivialPhi(phi);
+  }
+
+  // a phi that merges one value with itself is that value, the phis that used it may become trivial then too
+  Value* removeTrivialPhi(PHINode* phi) {
+    auto same = (Value*)nullptr;
+    for (auto& operand : phi->incoming_values()) {
+      if (operand == same || operand == phi)
+        continue;
+      if (same != nullptr)
+        return phi;
+      same = operand;
+    }
+    if (same == nullptr)
+      same = UndefValue::get(phi->getType()); // only reachable from itself
+    std::set<PHINode*> users;
+    for (auto user : phi->users()) {
+      auto userPhi = dyn_cast<PHINode>(user);
+      if (userPhi != nullptr && userPhi != phi && phiVariables.count(userPhi) != 0)
+        users.insert(userPhi);
+    }
+    phi->replaceAllUsesWith(same);
+    for (auto& [block, value] : phiVariables[phi]->values) {
+      if (value == phi)
+        value = same;
+    }
+    phiVariables.erase(phi);
+    phi->eraseFromParent();
+    for (auto user : users) {
+      if (phiVariables.count(user) != 0) // not removed by an earlier one
+        removeTrivialPhi(user);
+    }
+    return same;
+  }
+
+  void sealBlock(BasicBlock* block) {
+    sealedBlocks.insert(block);
+    auto phis = incompletePhis[block];
+    incompletePhis.erase(block);
+    for (auto phi : phis) {
+      addPhiOperands(phi);
+    }
+  }
+
+  // a variable owns its ref if it got a fresh one or took a share of shar/weak,
+  // otherwise it just borrows; a string variable always has a share of its bytes
+  void own(std::string name, Expr* source, Value* value) {
+    auto ref = dynamic_cast<RefExpr*>(source);
+    auto call = dynamic_cast<CallExpr*>(source);
+    auto obj = dynamic_cast<NewObjExpr*>(source);
+    auto func = dynamic_cast<FuncExpr*>(source);
+    auto owning = (ref != nullptr && (ref->escapes || ref->kind == WEAK)) || (call != nullptr && call->ownsResult) ||
+                  (obj != nullptr && obj->escapes) || (func != nullptr && func->escapes && !func->captures.empty()) ||
+                  dynamic_cast<MapExpr*>(source) != nullptr;
+    if (source->type == STR) {
+      keepString(source, value);
+      owning = true;
+    } else if (ref == nullptr && !owning && (source->type == SHAR_REF || source->type == WEAK_REF)) {
+      irBuilder->CreateCall(source->type == WEAK_REF ? refWeakRetainFunc : refRetainFunc, {value});
+      owning = true;
+    }
+
+    if (ownedRefs.find(name) == ownedRefs.end()) { // nothing is owned on the paths that didn't get here
+      auto flag = newVariable(name + ".owned", irBuilder->getInt1Ty());
+      flag->values[&irBuilder->GetInsertBlock()->getParent()->getEntryBlock()] = irBuilder->getFalse();
+      ownedRefs[name] = {flag, source->type == WEAK_REF};
+    }
+    writeVariable(ownedRefs[name].flag, irBuilder->getInt1(owning));
+  }
+
+  // a string lets go of its bytes only if they are counted
+  void releaseIf(Value* condition, Value* ref, bool weak) {
+    if (auto known = dyn_cast<ConstantInt>(condition); known != nullptr && known->isZero())
+      return; // never owned on any path here, the blocks would only make the next reads walk over them
+    if (ref->getType() != strType)
+      callIf(condition, weak ? refWeakReleaseFunc : refReleaseFunc, ref, "release");
+    else if (!isa<Constant>(ref)) // literals
+      callIf(irBuilder->CreateAnd(ownsBytes(ref), condition), refReleaseFunc, stringBytes(ref), "release");
+  }
+
+  void callIf(Value* condition, Function* function, Value* arg, std::string name) {
+    auto currFunc = irBuilder->GetInsertBlock()->getParent();
+    auto callBlock = BasicBlock::Create(irBuilder->getContext(), name, currFunc);
+    auto doneBlock = BasicBlock::Create(irBuilder->getContext(), name + "d", currFunc);
+    irBuilder->CreateCondBr(condition, callBlock, doneBlock);
+
+    enterBlock(callBlock);
+    irBuilder->CreateCall(function, {arg});
+    irBuilder->CreateBr(doneBlock);
+
+    enterBlock(doneBlock);
+  }
+
+  // made for whoever uses it: the caller gets a share of the string a function returns, map get only lends
+  // the one in the slot
+  static bool ownsString(Expr* expr) {
+    auto method = dynamic_cast<MethodCallExpr*>(expr);
+    auto made = dynamic_cast<BinaryExpr*>(expr) != nullptr || dynamic_cast<FormatExpr*>(expr) != nullptr ||
+                dynamic_cast<CallExpr*>(expr) != nullptr || (method != nullptr && method->map == nullptr);
+    return expr->type == STR && made;
+  }
+
+  // the copy of a string that is kept somewhere takes a share, a fresh one is handed over
+  void keepString(Expr* source, Value* value) {
+    if (source->type == STR && !ownsString(source))
+      retainString(value);
+  }
+
+  void retainString(Value* value) {
+    if (!isa<Constant>(value))
+      callIf(ownsBytes(value), refRetainFunc, stringBytes(value), "retain");
+  }
+
+  // a fresh string that was only looked at
+  void releaseTemporary(Expr* expr, Value* value) {
+    if (ownsString(expr))
+      releaseIf(irBuilder->getTrue(), value, false);
+  }
+
+  // a statement: what it made and nobody kept is let go right after it
+  void emitStatement(Expr* expr) {
+    auto value = std::any_cast<Value*>(emit(expr));
+    if (value != nullptr)
+      releaseTemporary(expr, value);
+  }
+
+  // fields, map slots and variables of the session keep a share of the string they get, the old one is let go
+  void storeKept(Value* pointer, Value* value, Expr* source) {
+    if (value->getType() != strType) {
+      irBuilder->CreateStore(value, pointer);
+      return;
+    }
+    auto old = irBuilder->CreateLoad(strType, pointer, "old");
+    keepString(source, value);
+    irBuilder->CreateStore(value, pointer);
+    releaseIf(irBuilder->getTrue(), old, false);
+  }
+
+  // the returned ref is handed over to the caller; everything is read before the first release block,
+  // a read after it would look through all of them for the value
+  void releaseOwnedRefs(Value* ret) {
+    std::vector<std::tuple<Value*, Value*, bool>> releases;
+    for (auto [name, owned] : ownedRefs) {
+      auto ref = readVariable(localScope[name]);
+      auto condition = readVariable(owned.flag);
+      if (ret != nullptr && ret->getType()->isPointerTy() && ref->getType() == ret->getType())
+        condition = irBuilder->CreateAnd(condition, irBuilder->CreateICmpNE(ref, ret));
+      releases.emplace_back(condition, ref, owned.weak);
+    }
+    std::vector<Value*> filled;
+    for (auto& held : heldStrings) {
+      filled.emplace_back(readVariable(held.flag));
+    }
+    for (auto [condition, ref, weak] : releases) {
+      releaseIf(condition, ref, weak);
+    }
+    for (auto i = 0; i < heldStrings.size(); i++) {
+      releaseHeld(filled[i], heldStrings[i].release);
+    }
+  }
+
+  // before the expression fills the memory again, the flag is set once it did
+  Variable* holdStrings(std::function<void()> release) {
+    auto flag = newVariable("held", irBuilder->getInt1Ty());
+    flag->values[&irBuilder->GetInsertBlock()->getParent()->getEntryBlock()] = irBuilder->getFalse();
+    releaseHeld(readVariable(flag), release);
+    heldStrings.push_back({flag, release});
+    return flag;
+  }
+
+  void releaseHeld(Value* condition, std::function<void()>& release) {
+    if (auto known = dyn_cast<ConstantInt>(condition); known != nullptr && known->isZero())
+      return;
+    auto currFunc = irBuilder->GetInsertBlock()->getParent();
+    auto releaseBlock = BasicBlock::Create(irBuilder->getContext(), "releaseHeld", currFunc);
+    auto releasedBlock = BasicBlock::Create(irBuilder->getContext(), "releasedHeld", currFunc);
+    irBuilder->CreateCondBr(condition, releaseBlock, releasedBlock);
+
+    enterBlock(releaseBlock);
+    release();
+    irBuilder->CreateBr(releasedBlock);
+
+    enterBlock(releasedBlock);
+  }
+
+  // short strings are the two words themselves, long ones point to their bytes, one copy for every text
+  Constant* stringConstant(const std::string& text) {
+    if (text.size() <= STR_INLINE) {
+      uint64_t words[2] = {0, (uint64_t)text.size() << 56};
+      for (auto i = 0; i < text.size(); i++) {
+        words[i / 8] |= (uint64_t)(uint8_t)text[i] << i % 8 * 8;
+      }
+      return ConstantStruct::get((StructType*)strType, {irBuilder->getInt64(words[0]), irBuilder->getInt64(words[1])});
+    }
+    auto& bytes = internedStrings[text];
+    if (bytes == nullptr)
+      bytes = irBuilder->CreateGlobalString(text, "str");
+    auto address = ConstantExpr::getPtrToInt(bytes, irBuilder->getInt64Ty());
+    auto tag = irBuilder->getInt64(text.size() | (uint64_t)STR_LONG << 56);
+    return ConstantStruct::get((StructType*)strType, {address, tag});
+  }
+
+  static bool isShortString(Value* value) {
+    auto constant = dyn_cast<ConstantStruct>(value);
+    auto high = constant != nullptr ? dyn_cast<ConstantInt>(constant->getOperand(1)) : nullptr;
+    return high != nullptr && (high->getZExtValue() >> 56 & STR_LONG) == 0;
+  }
+
+  // the runtime takes strings by pointer, the bytes of short ones are inside of the value
+  Value* stringPointer(Value* value) {
+    if (auto constant = dyn_cast<Constant>(value)) {
+      auto& global = stringValues[constant];
+      if (global == nullptr)
+        global = new GlobalVariable(*irModule, strType, true, GlobalValue::PrivateLinkage, constant, "str.value");
+      return global;
+    }
+    auto slot = createEntryAlloca(strType, "str");
+    irBuilder->CreateStore(value, slot);
+    return slot;
+  }
+
+  // size and bytes for printf's "%.*s"
+  // STR_OWNED: the bytes are from ref_alloc, the first word points to them
+  Value* ownsBytes(Value* value) {
+    auto high = irBuilder->CreateExtractValue(value, 1);
+    auto flag = irBuilder->CreateAnd(high, (uint64_t)STR_OWNED << 56);
+    return irBuilder->CreateICmpNE(flag, irBuilder->getInt64(0), "owned");
+  }
+
+  Value* stringBytes(Value* value) {
+    return irBuilder->CreateIntToPtr(irBuilder->CreateExtractValue(value, 0), irBuilder->getPtrTy());
+  }
+
+  std::pair<Value*, Value*> stringView(Value* value) {
+    auto pointer = stringPointer(value);
+    auto high = irBuilder->CreateExtractValue(value, 1);
+    auto tag = irBuilder->CreateLShr(high, 56);
+    auto isLong = irBuilder->CreateICmpNE(irBuilder->CreateAnd(tag, STR_LONG), irBuilder->getInt64(0));
+    auto size = irBuilder->CreateSelect(isLong, irBuilder->CreateAnd(high, ~((uint64_t)0xff << 56)), tag);
+    auto bytes = irBuilder->CreateIntToPtr(irBuilder->CreateExtractValue(value, 0), irBuilder->getPtrTy());
+    return {size, irBuilder->CreateSelect(isLong, bytes, pointer)};
+  }
+
+  GlobalVariable* getFormat(std::string format) {
     if (printFormats.find(format) == printFormats.end())
       printFormats[format] = irBuilder->CreateGlobalString(format);
-    args.emplace(args.begin(), printFormats[format]);
-
-    return (Value*)(irBuilder->CreateCall(printfFunc, args));
+    return printFormats[format];
   }
 
-private:
   Type* ExprToLLVMType(ExprType type) {
     switch (type) {
     case VOID:
       return irBuilder->getVoidTy();
     case BOOL:
       return irBuilder->getInt1Ty();
+    case I8:
+      return irBuilder->getInt8Ty();
+    case I16:
+      return irBuilder->getInt16Ty();
     case I32:
+    case U32:
       return irBuilder->getInt32Ty();
+    case I64:
+    case U64:
+      return irBuilder->getInt64Ty();
+    case F32:
+      return irBuilder->getFloatTy();
     case R64:
       return irBuilder->getDoubleTy();
     case STR:
-      return PointerType::get(irBuilder->getInt8Ty(), 0);
+      return strType;
     case FUNC:
       return irBuilder->getPtrTy(); // TODO FuncType
+    case UNIQ_REF:
+    case SHAR_REF:
+    case WEAK_REF:
+    case OBJ:
+    case GEN:
+    case MAP:
+      return irBuilder->getPtrTy();
     }
   }
 };
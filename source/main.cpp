@@ -1,30 +1,152 @@
+#include "escape_walker.cpp"
+#include "fold_walker.cpp"
 #include "llvm_walker.cpp"
+#include "reach_walker.cpp"
+#include "repl.hpp"
+#include "server.hpp"
+#include "size_walker.cpp"
+#include "timing.hpp"
 #include "type_walker.cpp"
 #include <fstream>
 #include <iostream>
 #include <streambuf>
+#include <thread>
 #include <vector>
 
 using namespace std;
 using namespace Diploma;
 
-int main() {
-  ifstream input("D:/GSU/diploma/input.txt");
+// diploma [input] [-O0..-O3] [-jN] [-g] [--time-report] [--time-trace[=file.json]] [--mem-report]
+//         [--profile-generate[=file.profile]] [--profile-use=file.profile] [--profile-calls[=file.folded]]
+//         [--cache[=dir]]
+// diploma --serve[=socket] [--workers=N] [--runtime=libdiploma_runtime.a]
+// diploma --repl [-O0..-O3]
+int main(int argc, char** argv) {
+  string inputPath = "D:/GSU/diploma/input.txt";
+  auto optLevel = 0;
+  auto jobs = 1;
+  auto timeReport = false;
+  auto interactive = false;
+  auto debugInfo = false;
+  string tracePath = "";
+  string profileGenerate = "", profileUse = "", callsPath = "";
+  string cacheDir = "";
+  string socketPath = "", runtimePath = "";
+  auto workers = (int)std::max(1u, thread::hardware_concurrency());
+  for (auto i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--time-report") {
+      timeReport = true;
+    } else if (arg == "-g") {
+      debugInfo = true;
+    } else if (arg == "--mem-report") {
+      TimeReport::get().measureSizes = true;
+    } else if (arg == "--time-trace") {
+      tracePath = "output.trace.json";
+    } else if (arg.rfind("--time-trace=", 0) == 0) {
+      tracePath = arg.substr(13);
+    } else if (arg == "--profile-generate") {
+      profileGenerate = "output.profile";
+    } else if (arg.rfind("--profile-generate=", 0) == 0) {
+      profileGenerate = arg.substr(19);
+    } else if (arg.rfind("--profile-use=", 0) == 0) {
+      profileUse = arg.substr(14);
+    } else if (arg == "--profile-calls") {
+      callsPath = "output.folded";
+    } else if (arg.rfind("--profile-calls=", 0) == 0) {
+      callsPath = arg.substr(16);
+    } else if (arg == "--cache") {
+      cacheDir = "diploma-cache";
+    } else if (arg.rfind("--cache=", 0) == 0) {
+      cacheDir = arg.substr(8);
+    } else if (arg == "--repl") {
+      interactive = true;
+    } else if (arg == "--serve") {
+      socketPath = defaultSocketPath();
+    } else if (arg.rfind("--serve=", 0) == 0) {
+      socketPath = arg.substr(8);
+    } else if (arg.rfind("--workers=", 0) == 0) {
+      workers = std::max(1, atoi(arg.c_str() + 10));
+    } else if (arg.rfind("--runtime=", 0) == 0) {
+      runtimePath = arg.substr(10);
+    } else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && isdigit(arg[2])) {
+      optLevel = arg[2] - '0';
+    } else if (arg.size() > 2 && arg.rfind("-j", 0) == 0 && isdigit(arg[2])) {
+      jobs = std::max(1, atoi(arg.c_str() + 2));
+    } else if (arg[0] != '-') {
+      inputPath = arg;
+    } else {
+      cout << "what is '" << arg << "'?\n";
+    }
+  }
+
+  if (!socketPath.empty())
+    return serve(socketPath, workers, runtimePath);
+  if (interactive)
+    return repl(optLevel);
 
-  auto tokens = performTokenization(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
-  auto syntaxTree = parseSyntaxTree(tokens);
+  TimeReport::get().begin("compile");
+  ifstream input(inputPath);
 
-  TreeWalker* walkers[] = {
-    new TypeWalker(),
-    new InterpreterWalker(),
+  auto tokens = vector<Token>();
+  {
+    ScopedTimer timer("tokenize");
+    tokens = performTokenization(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+  }
+  TimeReport::get().count("tokens", tokens.size());
+  if (TimeReport::get().measureSizes)
+    SizeWalker::reportTokens(tokens);
+
+  auto syntaxTree = vector<Expr*>();
+  {
+    ScopedTimer timer("parse");
+    syntaxTree = parseSyntaxTree(tokens);
+  }
+  TimeReport::get().count("ast nodes", Expr::created);
+  if (TimeReport::get().measureSizes)
+    SizeWalker::reportTree(syntaxTree);
+
+  {
+    ScopedTimer timer("reachability");
+    ReachWalker reach;
+    reach.Do(syntaxTree);
+    syntaxTree = reach.reachable;
+    TimeReport::get().count("elided nodes", reach.elided);
+  }
+
+  auto codegen = new InterpreterWalker(optLevel, "output.ir", profileGenerate, profileUse, cacheDir);
+  if (debugInfo)
+    codegen->emitDebugInfo(inputPath);
+  if (!callsPath.empty())
+    codegen->profileCalls(callsPath);
+  codegen->useThreads(jobs);
+  auto folder = new FoldWalker();
+  pair<string, TreeWalker*> walkers[] = {
+    {"type check", new TypeWalker()},
+    {"fold calls", folder},
+    {"escape analysis", new EscapeWalker()},
+    {"codegen", codegen},
   };
-  for (auto walker : walkers) {
+  for (auto [name, walker] : walkers) {
+    ScopedTimer timer(name);
     walker->Do(syntaxTree);
   }
+  TimeReport::get().count("folded calls", folder->folded);
 
-  for (auto walker : walkers) {
-    delete walker;
+  {
+    ScopedTimer timer("finish"); // codegen writes the module when it is deleted
+    for (auto [name, walker] : walkers) {
+      delete walker;
+    }
   }
+  TimeReport::get().end();
+
+  if (timeReport)
+    TimeReport::get().print(cout);
+  if (TimeReport::get().measureSizes)
+    TimeReport::get().printMemory(cout);
+  if (!tracePath.empty() && !TimeReport::get().writeTrace(tracePath))
+    cout << "can't write the trace to " << tracePath << "\n";
 
   cout << "done." << endl;
 }
@@ -0,0 +1,194 @@
+#include "memory.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace Diploma {
+
+// per thread, so the compile server workers don't fight over them
+static thread_local int64_t allocations = 0, allocated = 0, frees = 0, freed = 0, peak = 0;
+
+// the size and the start of what malloc gave are kept right before the block,
+// over-aligned types take a bit more to move the block to the right address
+static const size_t header = 16;
+
+static void* allocate(std::size_t size, std::size_t alignment = header) {
+  auto extra = alignment > header ? alignment : 0;
+  if (size > SIZE_MAX - header - extra) // it would wrap around to a tiny block
+    return nullptr;
+  auto raw = (char*)std::malloc(size + header + extra);
+  if (raw == nullptr)
+    return nullptr;
+  auto block = raw + header;
+  if (extra != 0)
+    block = (char*)(((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  ((size_t*)block)[-1] = size;
+  ((void**)block)[-2] = raw;
+  allocations++;
+  allocated += size;
+  if (allocated - freed > peak)
+    peak = allocated - freed;
+  return block;
+}
+
+static void release(void* block) {
+  if (block == nullptr)
+    return;
+  frees++;
+  freed += ((size_t*)block)[-1];
+  std::free(((void**)block)[-2]);
+}
+
+static void* allocateOrThrow(std::size_t size, std::size_t alignment = header) {
+  while (true) {
+    auto block = allocate(size, alignment);
+    if (block != nullptr)
+      return block;
+    auto handler = std::get_new_handler();
+    if (handler == nullptr)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+MemoryCounters memoryCounters() {
+  return {allocations, allocated, frees, freed, peak};
+}
+
+int64_t resetPeak(int64_t live) {
+  auto old = peak;
+  peak = live;
+  return old;
+}
+
+MemoryCounters takeMemory(const MemoryCounters& since) {
+  auto live = since.allocated - since.freed;
+  MemoryCounters taken = {
+    allocations - since.allocations, allocated - since.allocated, frees - since.frees, freed - since.freed,
+    std::max<int64_t>(0, peak - live)
+  };
+  allocations = since.allocations;
+  allocated = since.allocated;
+  frees = since.frees;
+  freed = since.freed;
+  peak = since.peak;
+  return taken;
+}
+
+void addMemory(const MemoryCounters& taken) {
+  peak = std::max(peak, allocated - freed + taken.peak);
+  allocations += taken.allocations;
+  allocated += taken.allocated;
+  frees += taken.frees;
+  freed += taken.freed;
+}
+
+int64_t peakResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss; // bytes there, kilobytes everywhere else
+#else
+  return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+} // namespace Diploma
+
+using Diploma::allocateOrThrow, Diploma::allocate, Diploma::release;
+
+void* operator new(std::size_t size) {
+  return allocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size) {
+  return allocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return allocateOrThrow(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocateOrThrow(size, (std::size_t)alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return allocate(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return allocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void* block) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block) noexcept {
+  release(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept {
+  release(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+  release(block);
+}
+
+void operator delete(void* block, std::align_val_t) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block, std::align_val_t) noexcept {
+  release(block);
+}
+
+void operator delete(void* block, std::size_t, std::align_val_t) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block, std::size_t, std::align_val_t) noexcept {
+  release(block);
+}
+
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept {
+  release(block);
+}
+
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept {
+  release(block);
+}
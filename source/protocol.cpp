@@ -0,0 +1,122 @@
+#include "protocol.hpp"
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+namespace Diploma {
+
+std::string defaultSocketPath() {
+  auto path = std::getenv("DIPLOMA_SOCKET");
+  if (path != nullptr)
+    return path;
+#ifdef _WIN32
+  return "diploma.sock";
+#else
+  return "/tmp/diploma-" + std::to_string(getuid()) + ".sock";
+#endif
+}
+
+static bool writeAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    auto written = write(fd, data.data() + sent, data.size() - sent);
+    if (written <= 0)
+      return false;
+    sent += written;
+  }
+  return true;
+}
+
+static bool readLine(int fd, std::string& line) {
+  line.clear();
+  char c;
+  while (read(fd, &c, 1) == 1) { // headers are short, the bodies are read in one go
+    if (c == '\n')
+      return true;
+    line += c;
+  }
+  return false;
+}
+
+static bool readBytes(int fd, std::string& data, size_t size) {
+  data.resize(size);
+  size_t received = 0;
+  while (received < size) {
+    auto count = read(fd, data.data() + received, size - received);
+    if (count <= 0)
+      return false;
+    received += count;
+  }
+  return true;
+}
+
+static bool readField(int fd, std::string& key, std::string& value) {
+  std::string line;
+  if (!readLine(fd, line))
+    return false;
+  auto space = line.find(' ');
+  key = line.substr(0, space);
+  value = space == std::string::npos ? "" : line.substr(space + 1);
+  return true;
+}
+
+static std::string field(std::string key, std::string value) {
+  return key + " " + value + "\n";
+}
+
+static std::string blob(std::string key, const std::string& data) {
+  return field(key, std::to_string(data.size())) + data;
+}
+
+bool sendRequest(int fd, const CompileRequest& request) {
+  auto message = field("mode", request.mode) + field("opt", std::to_string(request.optLevel));
+  if (!request.cacheDir.empty())
+    message += field("cache", request.cacheDir);
+  message += field("time-report", request.timeReport ? "1" : "0");
+  return writeAll(fd, message + blob("source", request.source));
+}
+
+bool receiveRequest(int fd, CompileRequest& request) {
+  std::string key, value;
+  while (readField(fd, key, value)) {
+    if (key == "mode")
+      request.mode = value;
+    else if (key == "opt")
+      request.optLevel = std::atoi(value.c_str());
+    else if (key == "cache")
+      request.cacheDir = value;
+    else if (key == "time-report")
+      request.timeReport = value == "1";
+    else if (key == "source")
+      return readBytes(fd, request.source, std::strtoull(value.c_str(), nullptr, 10));
+  }
+  return false;
+}
+
+bool sendReply(int fd, const CompileReply& reply) {
+  auto message = field("status", std::to_string(reply.status)) + blob("diagnostics", reply.diagnostics);
+  return writeAll(fd, message + blob("output", reply.output));
+}
+
+bool receiveReply(int fd, CompileReply& reply) {
+  std::string key, value;
+  while (readField(fd, key, value)) {
+    if (key == "status") {
+      reply.status = std::atoi(value.c_str());
+    } else if (key == "diagnostics") {
+      if (!readBytes(fd, reply.diagnostics, std::strtoull(value.c_str(), nullptr, 10)))
+        return false;
+    } else if (key == "output") {
+      return readBytes(fd, reply.output, std::strtoull(value.c_str(), nullptr, 10));
+    }
+  }
+  return false;
+}
+
+} // namespace Diploma
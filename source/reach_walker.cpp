@@ -0,0 +1,286 @@
+#include "syntax_tree.hpp"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Diploma {
+
+// drops what the program can't reach before anything looks at the types: a top level variable is kept
+// when some reachable code uses its name or its value can do something (a call, println, a ref...),
+// everything else starts from the statements of main and the types; inside of the functions that are left
+// a variable nobody uses is dropped too if it can't do anything, unless it is the value of its block;
+// runs first, the walkers after it only get reachable
+class ReachWalker : public TreeWalker {
+  std::set<std::string> used;
+  std::vector<std::string> waiting; // used, the variables with the name are not walked yet
+  std::multimap<std::string, NewVarExpr*> unreached;
+  bool pruning = false; // the last walk, the names are known
+  int64_t nodes = 0;
+
+public:
+  std::vector<Expr*> reachable;
+  int64_t elided = 0; // nodes that were dropped
+
+  void Do(std::vector<Expr*> syntax) {
+    std::vector<Expr*> roots;
+    for (auto expr : syntax) {
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      if (newVar != nullptr && !hasEffects(newVar->value))
+        unreached.emplace(newVar->identifier.value, newVar);
+      else
+        roots.emplace_back(expr);
+    }
+
+    std::set<Expr*> live(roots.begin(), roots.end());
+    walk(roots);
+    while (!waiting.empty()) {
+      auto name = waiting.back();
+      waiting.pop_back();
+      auto [begin, end] = unreached.equal_range(name);
+      for (auto it = begin; it != end; it++) {
+        live.insert(it->second);
+        walk(it->second->value);
+      }
+      unreached.erase(begin, end);
+    }
+
+    pruning = true;
+    for (auto expr : syntax) {
+      if (live.count(expr) != 0) {
+        reachable.emplace_back(expr);
+        walk(expr);
+      }
+    }
+    pruning = false;
+    for (auto [name, newVar] : unreached) {
+      elided += count(newVar);
+    }
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return {};
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    return {};
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    return {};
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return {};
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    walk(formatExpr->parts);
+    return {};
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    walk(newVarExpr->value);
+    return {};
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    use(varAssignExpr->identifier.value);
+    walk(varAssignExpr->value);
+    return {};
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    use(varExpr->identifier.value);
+    return {};
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    walk(unaryExpr->value);
+    return {};
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    walk(castExpr->value);
+    return {};
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    walk(comparisonExpr->left);
+    walk(comparisonExpr->right);
+    return {};
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    walk(binaryExpr->left);
+    walk(binaryExpr->right);
+    return {};
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    walk(logicalExpr->left);
+    walk(logicalExpr->right);
+    return {};
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    walk(ifElseExpr->condition);
+    walk(ifElseExpr->thenBlock);
+    walk(ifElseExpr->elseBlock);
+    return {};
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    if (pruning && !blockExpr->list.empty()) {
+      auto value = blockExpr->list.back();
+      std::erase_if(blockExpr->list, [&](Expr* expr) {
+        auto newVar = dynamic_cast<NewVarExpr*>(expr);
+        auto dead = expr != value && newVar != nullptr && used.count(newVar->identifier.value) == 0 &&
+                    !hasEffects(newVar->value);
+        if (dead)
+          elided += count(newVar);
+        return dead;
+      });
+    }
+    walk(blockExpr->list);
+    return {};
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    walk(funcExpr->body);
+    return {};
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    walk(callExpr->func);
+    walk(callExpr->args);
+    return {};
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    walk(printlnExpr->values);
+    return {};
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    walk(refExpr->value);
+    return {};
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    walk(derefExpr->ref);
+    return {};
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    walk(typeExpr->baseArgs);
+    for (auto field : typeExpr->fields) {
+      walk(field->value);
+    }
+    for (auto& [name, method] : typeExpr->methods) {
+      walk(method);
+    }
+    return {};
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    walk(newObjExpr->args);
+    return {};
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    walk(memberExpr->object);
+    return {};
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    walk(memberAssignExpr->object);
+    walk(memberAssignExpr->value);
+    return {};
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    walk(methodCallExpr->object);
+    walk(methodCallExpr->args);
+    return {};
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    walk(yieldExpr->value);
+    return {};
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    walk(forExpr->source);
+    walk(forExpr->body);
+    return {};
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    walk(whileExpr->condition);
+    walk(whileExpr->body);
+    return {};
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    for (auto [key, value] : mapExpr->entries) {
+      walk(key);
+      walk(value);
+    }
+    return {};
+  }
+
+private:
+  void walk(Expr* expr) {
+    if (expr == nullptr)
+      return;
+    nodes++;
+    expr->visit(this);
+  }
+
+  template <typename T> void walk(const std::vector<T*>& exprs) {
+    for (auto expr : exprs) {
+      walk(expr);
+    }
+  }
+
+  void use(const std::string& name) {
+    if (used.insert(name).second)
+      waiting.emplace_back(name);
+  }
+
+  int64_t count(Expr* expr) {
+    auto before = nodes;
+    walk(expr);
+    return nodes - before;
+  }
+
+  // a value that can be computed and thrown away without anyone noticing
+  static bool hasEffects(Expr* expr) {
+    if (expr == nullptr)
+      return true;
+    if (dynamic_cast<BoolExpr*>(expr) || dynamic_cast<IntExpr*>(expr) || dynamic_cast<RealExpr*>(expr) ||
+        dynamic_cast<StrExpr*>(expr) || dynamic_cast<VarExpr*>(expr) || dynamic_cast<FuncExpr*>(expr))
+      return false;
+    if (auto format = dynamic_cast<FormatExpr*>(expr)) {
+      for (auto part : format->parts) {
+        if (hasEffects(part))
+          return true;
+      }
+      return false;
+    }
+    if (auto unary = dynamic_cast<UnaryExpr*>(expr))
+      return hasEffects(unary->value);
+    if (auto cast = dynamic_cast<CastExpr*>(expr))
+      return hasEffects(cast->value);
+    if (auto comparison = dynamic_cast<ComparisonExpr*>(expr))
+      return hasEffects(comparison->left) || hasEffects(comparison->right);
+    if (auto binary = dynamic_cast<BinaryExpr*>(expr))
+      return hasEffects(binary->left) || hasEffects(binary->right);
+    if (auto logical = dynamic_cast<LogicalExpr*>(expr))
+      return hasEffects(logical->left) || hasEffects(logical->right);
+    return true;
+  }
+};
+
+} // namespace Diploma
@@ -0,0 +1,188 @@
+#include "repl.hpp"
+#include "diagnostics.hpp"
+#include "escape_walker.cpp"
+#include "fold_walker.cpp"
+#include "llvm_walker.cpp"
+#include "runtime.h"
+#include "type_walker.cpp"
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/TargetSelect.h>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace Diploma {
+
+// the generated code calls into the runtime linked with the compiler, the rest comes from the C library
+static Error addRuntime(orc::LLJIT& jit) {
+  std::pair<const char*, void*> functions[] = {
+    {"write_i32", (void*)&write_i32},
+    {"write_i64", (void*)&write_i64},
+    {"write_u64", (void*)&write_u64},
+    {"write_f64", (void*)&write_f64},
+    {"write_bool", (void*)&write_bool},
+    {"write_str", (void*)&write_str},
+    {"write_ptr", (void*)&write_ptr},
+    {"write_ln", (void*)&write_ln},
+    {"ref_alloc", (void*)&ref_alloc},
+    {"ref_retain", (void*)&ref_retain},
+    {"ref_release", (void*)&ref_release},
+    {"ref_weak_retain", (void*)&ref_weak_retain},
+    {"ref_weak_release", (void*)&ref_weak_release},
+    {"ref_alive", (void*)&ref_alive},
+    {"str_concat", (void*)&str_concat},
+    {"str_format", (void*)&str_format},
+    {"str_equal", (void*)&str_equal},
+    {"str_compare", (void*)&str_compare},
+    {"map_new", (void*)&map_new},
+    {"map_size", (void*)&map_size},
+    {"map_put_i32", (void*)&map_put_i32},
+    {"map_put_f64", (void*)&map_put_f64},
+    {"map_put_str", (void*)&map_put_str},
+    {"map_find_i32", (void*)&map_find_i32},
+    {"map_find_f64", (void*)&map_find_f64},
+    {"map_find_str", (void*)&map_find_str},
+    {"map_remove_i32", (void*)&map_remove_i32},
+    {"map_remove_f64", (void*)&map_remove_f64},
+    {"map_remove_str", (void*)&map_remove_str},
+    {"map_next", (void*)&map_next},
+    {"map_key", (void*)&map_key},
+    {"memo_new", (void*)&memo_new},
+    {"memo_find", (void*)&memo_find},
+    {"memo_store", (void*)&memo_store},
+  };
+  orc::MangleAndInterner mangle(jit.getExecutionSession(), jit.getDataLayout());
+  orc::SymbolMap symbols;
+  for (auto [name, address] : functions) {
+    symbols[mangle(name)] = orc::ExecutorSymbolDef(orc::ExecutorAddr::fromPtr(address), JITSymbolFlags::Exported);
+  }
+  auto& library = jit.getMainJITDylib();
+  auto process = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit.getDataLayout().getGlobalPrefix());
+  if (!process)
+    return process.takeError();
+  library.addGenerator(std::move(*process));
+  return library.define(orc::absoluteSymbols(symbols));
+}
+
+// a line that opens a block ("->", "if", "for", "while", a type) goes on until an empty one
+static bool readEntry(std::string& entry) {
+  entry.clear();
+  std::string line;
+  std::cout << "> " << std::flush;
+  if (!std::getline(std::cin, line))
+    return false;
+  entry = line + "\n";
+  auto trimmed = line.substr(0, line.find_last_not_of(" \t") + 1);
+  auto opensBlock = trimmed.size() >= 2 && trimmed.substr(trimmed.size() - 2) == "->";
+  opensBlock = opensBlock || trimmed.rfind("if ", 0) == 0 || trimmed.find(" type") != std::string::npos;
+  opensBlock = opensBlock || trimmed.rfind("for ", 0) == 0 || trimmed.rfind("while ", 0) == 0;
+  while (opensBlock) {
+    std::cout << "| " << std::flush;
+    if (!std::getline(std::cin, line) || line.find_first_not_of(" \t") == std::string::npos)
+      break;
+    entry += line + "\n";
+  }
+  return true;
+}
+
+int repl(int optLevel) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  auto jit = orc::LLJITBuilder().create();
+  if (!jit) {
+    std::cout << "can't start the JIT: " << toString(jit.takeError()) << "\n";
+    return 1;
+  }
+  if (auto error = addRuntime(**jit)) {
+    std::cout << "can't give the JIT the runtime: " << toString(std::move(error)) << "\n";
+    return 1;
+  }
+
+  // the front end keeps what it learned about the earlier lines, their trees are never freed
+  Session session;
+  TypeWalker types;
+  EscapeWalker escapes;
+  escapes.keepTopLevel = true;
+  // the types of a function come from its first call, so it is compiled with the line that makes it
+  std::vector<Expr*> pending;
+  auto isReady = [&](Expr* expr) {
+    auto newVar = dynamic_cast<NewVarExpr*>(expr);
+    auto func = newVar != nullptr ? dynamic_cast<FuncExpr*>(newVar->value) : nullptr;
+    return func == nullptr || types.wasCalled(func);
+  };
+
+  using clock = std::chrono::steady_clock;
+  auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+  std::string entry;
+  while (readEntry(entry)) {
+    if (entry == ":quit\n" || entry == ":q\n")
+      break;
+    if (entry.find_first_not_of(" \t\n") == std::string::npos)
+      continue;
+
+    auto start = clock::now();
+    std::stringstream messages; // anything the front end says drops the line
+    setDiagnostics(&messages);
+    std::stringstream input(entry);
+    auto tokens = performTokenization(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    auto syntaxTree = parseSyntaxTree(tokens, true);
+    if (messages.str().empty())
+      types.Do(syntaxTree);
+    setDiagnostics(nullptr);
+    if (!messages.str().empty()) {
+      std::cout << messages.str();
+      continue;
+    }
+
+    auto unit = std::vector<Expr*>();
+    for (auto held : pending) {
+      if (isReady(held))
+        unit.emplace_back(held);
+    }
+    std::erase_if(pending, isReady);
+    for (auto expr : syntaxTree) {
+      (isReady(expr) ? unit : pending).emplace_back(expr);
+    }
+    if (unit.empty()) {
+      std::cout << "(compiled with the first line that calls it)\n";
+      continue;
+    }
+    FoldWalker().Do(unit); // also tells why a 'memo' function stays a plain one, the line still runs
+    escapes.Do(unit);
+
+    auto context = std::unique_ptr<LLVMContext>();
+    auto module = std::unique_ptr<Module>();
+    auto name = std::string();
+    {
+      InterpreterWalker codegen(optLevel, "");
+      codegen.join(&session);
+      codegen.Do(unit);
+      module = codegen.takeModule(context);
+      name = "line." + std::to_string(session.line);
+    }
+    if (auto error = (*jit)->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+      std::cout << toString(std::move(error)) << "\n";
+      continue;
+    }
+    auto line = (*jit)->lookup(name); // compiles the module to machine code
+    if (!line) {
+      std::cout << toString(line.takeError()) << "\n";
+      continue;
+    }
+    auto compiled = clock::now();
+
+    line->toPtr<int32_t (*)()>()();
+    flush_output();
+    auto done = clock::now();
+    char timing[96];
+    auto compileTime = ms(compiled - start), runTime = ms(done - compiled);
+    std::snprintf(timing, sizeof(timing), "(compiled in %.2f ms, ran in %.2f ms)\n", compileTime, runTime);
+    std::cout << timing << std::flush;
+  }
+  return 0;
+}
+
+} // namespace Diploma
@@ -0,0 +1,287 @@
+#include "server.hpp"
+#include "diagnostics.hpp"
+#include "escape_walker.cpp"
+#include "fold_walker.cpp"
+#include "llvm_walker.cpp"
+#include "reach_walker.cpp"
+#include "timing.hpp"
+#include "type_walker.cpp"
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace Diploma {
+
+// created once per worker, it is the slow part of setting up the back end
+static TargetMachine* nativeMachine() {
+  static thread_local std::unique_ptr<TargetMachine> machine;
+  if (machine == nullptr) {
+    auto triple = sys::getDefaultTargetTriple();
+    std::string error;
+    auto target = TargetRegistry::lookupTarget(triple, error);
+    if (target == nullptr) {
+      diagnostics() << error << "\n";
+      return nullptr;
+    }
+    machine.reset(target->createTargetMachine(triple, "generic", "", TargetOptions(), Reloc::PIC_));
+  }
+  return machine.get();
+}
+
+static bool emitObject(Module& module, std::string& object) {
+  auto machine = nativeMachine();
+  if (machine == nullptr)
+    return false;
+  module.setTargetTriple(machine->getTargetTriple().str());
+  module.setDataLayout(machine->createDataLayout());
+
+  SmallVector<char, 0> buffer;
+  raw_svector_ostream out(buffer);
+  legacy::PassManager passes;
+  if (machine->addPassesToEmitFile(passes, out, nullptr, CodeGenFileType::ObjectFile)) {
+    diagnostics() << "can't emit an object file for " << machine->getTargetTriple().str() << "\n";
+    return false;
+  }
+  passes.run(module);
+  object.assign(buffer.begin(), buffer.end());
+  return true;
+}
+
+// "2>&1" of the command, and its exit code
+static int runCommand(std::string command, std::string& output) {
+#ifdef _WIN32
+  return -1;
+#else
+  auto pipe = popen((command + " 2>&1").c_str(), "r");
+  if (pipe == nullptr)
+    return -1;
+  char chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+    output.append(chunk, count);
+  }
+  auto status = pclose(pipe);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+}
+
+// in a process of its own, so a crashing program doesn't take the server down
+static int runProgram(const std::string& object, std::string runtimePath, std::string& output) {
+  SmallString<128> objectPath, programPath;
+  sys::fs::createTemporaryFile("diploma", "o", objectPath);
+  sys::fs::createTemporaryFile("diploma", "", programPath);
+  {
+    std::error_code error;
+    raw_fd_ostream out(objectPath, error, sys::fs::OF_None);
+    out << object;
+  }
+
+  std::string linkOutput;
+  auto status = runCommand(
+    "cc " + objectPath.str().str() + " " + runtimePath + " -lm -o " + programPath.str().str(), linkOutput
+  );
+  if (status != 0)
+    diagnostics() << "can't link the program:\n" << linkOutput;
+  else
+    status = runCommand(programPath.str().str(), output);
+  sys::fs::remove(objectPath);
+  sys::fs::remove(programPath);
+  return status;
+}
+
+CompileReply compile(const CompileRequest& request, std::string runtimePath) {
+  CompileReply reply;
+  std::stringstream messages;
+  std::vector<Expr*> nodes;
+  setDiagnostics(&messages);
+  Expr::owned = &nodes;
+  TimeReport::get().clear();
+
+  TimeReport::get().begin("compile");
+  std::stringstream input(request.source);
+  auto tokens = std::vector<Token>();
+  {
+    ScopedTimer timer("tokenize");
+    tokens = performTokenization(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+  }
+  auto syntaxTree = std::vector<Expr*>();
+  {
+    ScopedTimer timer("parse");
+    syntaxTree = parseSyntaxTree(tokens);
+  }
+  // whatever the parser complains about leaves a hole in the tree, the walkers would crash on it
+  auto broken = !messages.str().empty() || std::count(syntaxTree.begin(), syntaxTree.end(), nullptr) > 0;
+  if (broken) {
+    reply.status = 1;
+  } else {
+    {
+      ScopedTimer timer("reachability");
+      ReachWalker reach;
+      reach.Do(syntaxTree);
+      syntaxTree = reach.reachable;
+      TimeReport::get().count("elided nodes", reach.elided);
+    }
+    {
+      ScopedTimer timer("type check");
+      TypeWalker().Do(syntaxTree);
+    }
+    {
+      ScopedTimer timer("fold calls");
+      FoldWalker().Do(syntaxTree);
+    }
+    {
+      ScopedTimer timer("escape analysis");
+      EscapeWalker().Do(syntaxTree);
+    }
+
+    InterpreterWalker codegen(request.optLevel, "", "", "", request.cacheDir);
+    {
+      ScopedTimer timer("codegen");
+      codegen.Do(syntaxTree);
+    }
+    {
+      ScopedTimer timer("finish");
+      codegen.finish();
+    }
+
+    if (request.mode == "ir") {
+      raw_string_ostream out(reply.output);
+      codegen.getModule()->print(out, nullptr);
+    } else if (!emitObject(*codegen.getModule(), reply.output)) {
+      reply.status = 1;
+    } else if (request.mode == "run") {
+      auto object = std::move(reply.output);
+      reply.output.clear();
+      reply.status = runProgram(object, runtimePath, reply.output);
+    }
+  }
+  TimeReport::get().end();
+  if (request.timeReport)
+    TimeReport::get().print(messages);
+
+  for (auto node : nodes) {
+    delete node;
+  }
+  Expr::owned = nullptr;
+  setDiagnostics(nullptr);
+  reply.diagnostics = messages.str();
+  return reply;
+}
+
+int serve(std::string socketPath, int workers, std::string runtimePath) {
+#ifdef _WIN32
+  std::cout << "the compile server needs Unix sockets\n";
+  return 1;
+#else
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  signal(SIGPIPE, SIG_IGN); // a client that went away is not a reason to stop
+  if (runtimePath.empty()) {
+    SmallString<128> path(sys::path::parent_path(sys::fs::getMainExecutable(nullptr, (void*)&serve)));
+    sys::path::append(path, "libdiploma_runtime.a");
+    runtimePath = path.str().str();
+  }
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::cout << "the socket path " << socketPath << " is too long\n";
+    return 1;
+  }
+  std::strcpy(address.sun_path, socketPath.c_str());
+  auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath.c_str()); // left by a server that was killed
+  auto oldMask = umask(0077); // only the owner can connect, the server runs the programs it gets
+  auto bound = bind(listener, (sockaddr*)&address, sizeof(address)) == 0;
+  umask(oldMask);
+  if (!bound || listen(listener, 64) != 0) {
+    std::cout << "can't listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+    return 1;
+  }
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::queue<int> connections;
+  auto stopping = false;
+  std::vector<std::thread> pool;
+  for (auto i = 0; i < workers; i++) {
+    pool.emplace_back([&]() {
+      while (true) {
+        auto client = -1;
+        {
+          std::unique_lock lock(mutex);
+          ready.wait(lock, [&]() { return stopping || !connections.empty(); });
+          if (connections.empty())
+            return;
+          client = connections.front();
+          connections.pop();
+        }
+
+        CompileRequest request;
+        if (receiveRequest(client, request)) {
+          if (request.mode == "stop") {
+            std::unique_lock lock(mutex);
+            stopping = true;
+            shutdown(listener, SHUT_RDWR); // wakes up accept
+          }
+          sendReply(client, request.mode == "stop" ? CompileReply() : compile(request, runtimePath));
+        }
+        close(client);
+      }
+    });
+  }
+
+  std::cout << "compiling on " << socketPath << " with " << workers << " workers" << std::endl;
+  while (true) {
+    auto client = accept(listener, nullptr, nullptr);
+    std::unique_lock lock(mutex);
+    if (stopping) {
+      if (client >= 0)
+        close(client);
+      break;
+    }
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cout << "can't accept: " << std::strerror(errno) << "\n";
+      stopping = true;
+      break;
+    }
+    connections.push(client);
+    ready.notify_one();
+  }
+
+  ready.notify_all();
+  for (auto& worker : pool) {
+    worker.join();
+  }
+  close(listener);
+  unlink(socketPath.c_str());
+  return 0;
+#endif
+}
+
+} // namespace Diploma
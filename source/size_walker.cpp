@@ -0,0 +1,256 @@
+#include "syntax_tree.hpp"
+#include "timing.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Diploma {
+
+// how many nodes of every kind the tree has and the bytes they hold: the node itself,
+// the strings and vectors it owns; for the memory report
+class SizeWalker : public TreeWalker {
+public:
+  struct Size {
+    int64_t count = 0;
+    int64_t bytes = 0;
+  };
+  std::map<std::string, Size> kinds;
+
+  void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) {
+      walk(expr);
+    }
+  }
+
+  std::any visitBool(BoolExpr* boolExpr) {
+    return add("BoolExpr", sizeof(*boolExpr));
+  }
+
+  std::any visitInt(IntExpr* intExpr) {
+    return add("IntExpr", sizeof(*intExpr));
+  }
+
+  std::any visitReal(RealExpr* realExpr) {
+    return add("RealExpr", sizeof(*realExpr));
+  }
+
+  std::any visitStr(StrExpr* strExpr) {
+    return add("StrExpr", sizeof(*strExpr) + heap(strExpr->value));
+  }
+
+  std::any visitFormat(FormatExpr* formatExpr) {
+    walk(formatExpr->parts);
+    return add("FormatExpr", sizeof(*formatExpr) + heap(formatExpr->parts));
+  }
+
+  std::any visitNewVar(NewVarExpr* newVarExpr) {
+    walk(newVarExpr->value);
+    return add("NewVarExpr", sizeof(*newVarExpr) + heap(newVarExpr->identifier.value));
+  }
+
+  std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
+    walk(varAssignExpr->value);
+    return add("VarAssignExpr", sizeof(*varAssignExpr) + heap(varAssignExpr->identifier.value));
+  }
+
+  std::any visitVar(VarExpr* varExpr) {
+    return add("VarExpr", sizeof(*varExpr) + heap(varExpr->identifier.value));
+  }
+
+  std::any visitUnary(UnaryExpr* unaryExpr) {
+    walk(unaryExpr->value);
+    return add("UnaryExpr", sizeof(*unaryExpr) + heap(unaryExpr->oper.value));
+  }
+
+  std::any visitCast(CastExpr* castExpr) {
+    walk(castExpr->value);
+    return add("CastExpr", sizeof(*castExpr) + heap(castExpr->target.value));
+  }
+
+  std::any visitComparison(ComparisonExpr* comparisonExpr) {
+    walk(comparisonExpr->left);
+    walk(comparisonExpr->right);
+    return add("ComparisonExpr", sizeof(*comparisonExpr) + heap(comparisonExpr->oper.value));
+  }
+
+  std::any visitBinary(BinaryExpr* binaryExpr) {
+    walk(binaryExpr->left);
+    walk(binaryExpr->right);
+    return add("BinaryExpr", sizeof(*binaryExpr) + heap(binaryExpr->oper.value));
+  }
+
+  std::any visitLogical(LogicalExpr* logicalExpr) {
+    walk(logicalExpr->left);
+    walk(logicalExpr->right);
+    return add("LogicalExpr", sizeof(*logicalExpr) + heap(logicalExpr->oper.value));
+  }
+
+  std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    walk(ifElseExpr->condition);
+    walk(ifElseExpr->thenBlock);
+    walk(ifElseExpr->elseBlock);
+    return add("IfElseExpr", sizeof(*ifElseExpr));
+  }
+
+  std::any visitBlock(BlockExpr* blockExpr) {
+    walk(blockExpr->list);
+    return add("BlockExpr", sizeof(*blockExpr) + heap(blockExpr->list));
+  }
+
+  std::any visitFunc(FuncExpr* funcExpr) {
+    walk(funcExpr->body);
+    auto bytes = sizeof(*funcExpr) + heap(funcExpr->args) + heap(funcExpr->argsTypes) + heap(funcExpr->captures);
+    return add("FuncExpr", bytes + funcExpr->argsEscape.capacity() / 8);
+  }
+
+  std::any visitCall(CallExpr* callExpr) {
+    walk(callExpr->func);
+    walk(callExpr->args);
+    return add("CallExpr", sizeof(*callExpr) + heap(callExpr->args) + heap(callExpr->lent));
+  }
+
+  std::any visitPrintln(PrintlnExpr* printlnExpr) {
+    walk(printlnExpr->values);
+    return add("PrintlnExpr", sizeof(*printlnExpr) + heap(printlnExpr->values));
+  }
+
+  std::any visitRef(RefExpr* refExpr) {
+    walk(refExpr->value);
+    return add("RefExpr", sizeof(*refExpr));
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    walk(derefExpr->ref);
+    return add("DerefExpr", sizeof(*derefExpr));
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    walk(typeExpr->baseArgs);
+    auto bytes = sizeof(*typeExpr) + heap(typeExpr->name.value) + heap(typeExpr->params) + heap(typeExpr->baseArgs);
+    walk(typeExpr->fields);
+    for (auto& [name, method] : typeExpr->methods) {
+      walk(method);
+      bytes += heap(name);
+    }
+    for (auto& [name, type] : typeExpr->ownFields) {
+      bytes += heap(name);
+    }
+    bytes += heap(typeExpr->fields) + heap(typeExpr->methods) + heap(typeExpr->derived);
+    return add("TypeExpr", bytes + heap(typeExpr->ownFields) + heap(typeExpr->vtable));
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    walk(newObjExpr->args);
+    return add("NewObjExpr", sizeof(*newObjExpr) + heap(newObjExpr->args));
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    walk(memberExpr->object);
+    return add("MemberExpr", sizeof(*memberExpr) + heap(memberExpr->member.value));
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    walk(memberAssignExpr->object);
+    walk(memberAssignExpr->value);
+    return add("MemberAssignExpr", sizeof(*memberAssignExpr) + heap(memberAssignExpr->member.value));
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    walk(methodCallExpr->object);
+    walk(methodCallExpr->args);
+    auto bytes = sizeof(*methodCallExpr) + heap(methodCallExpr->method.value) + heap(methodCallExpr->args);
+    return add("MethodCallExpr", bytes);
+  }
+
+  std::any visitYield(YieldExpr* yieldExpr) {
+    walk(yieldExpr->value);
+    return add("YieldExpr", sizeof(*yieldExpr));
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    walk(forExpr->source);
+    walk(forExpr->body);
+    return add("ForExpr", sizeof(*forExpr) + heap(forExpr->item.value));
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    walk(whileExpr->condition);
+    walk(whileExpr->body);
+    return add("WhileExpr", sizeof(*whileExpr));
+  }
+
+  std::any visitMap(MapExpr* mapExpr) {
+    for (auto [key, value] : mapExpr->entries) {
+      walk(key);
+      walk(value);
+    }
+    return add("MapExpr", sizeof(*mapExpr) + heap(mapExpr->entries));
+  }
+
+  // the tokens and the text they hold, into the memory report of the thread
+  static void reportTokens(const std::vector<Token>& tokens) {
+    auto textBytes = (int64_t)0;
+    for (auto& token : tokens) {
+      textBytes += token.value.size();
+    }
+    TimeReport::get().size("tokens", tokens.size(), heap(tokens));
+    TimeReport::get().size("token text", tokens.size(), textBytes);
+  }
+
+  // every kind of node as "ast <kind>"
+  static void reportTree(const std::vector<Expr*>& syntax) {
+    SizeWalker sizes;
+    sizes.Do(syntax);
+    for (auto& [kind, size] : sizes.kinds) {
+      TimeReport::get().size("ast " + kind, size.count, size.bytes);
+    }
+  }
+
+  // bytes outside of the object, short strings live inside of it
+  static int64_t heap(const std::string& text) {
+    auto inside = text.data() >= (const char*)&text && text.data() < (const char*)(&text + 1);
+    return inside ? 0 : text.capacity() + 1;
+  }
+
+  template <typename T> static int64_t heap(const std::vector<T>& items) {
+    return items.capacity() * sizeof(T);
+  }
+
+  static int64_t heap(const std::vector<Token>& tokens) {
+    auto bytes = (int64_t)(tokens.capacity() * sizeof(Token));
+    for (auto& token : tokens) {
+      bytes += heap(token.value);
+    }
+    return bytes;
+  }
+
+  static int64_t heap(const std::vector<std::string>& texts) {
+    auto bytes = (int64_t)(texts.capacity() * sizeof(std::string));
+    for (auto& text : texts) {
+      bytes += heap(text);
+    }
+    return bytes;
+  }
+
+private:
+  void walk(Expr* expr) {
+    if (expr != nullptr)
+      expr->visit(this);
+  }
+
+  template <typename T> void walk(const std::vector<T*>& exprs) {
+    for (auto expr : exprs) {
+      walk(expr);
+    }
+  }
+
+  std::any add(std::string kind, int64_t bytes) {
+    auto& size = kinds[kind];
+    size.count++;
+    size.bytes += bytes;
+    return {};
+  }
+};
+
+} // namespace Diploma
@@ -1,13 +1,21 @@
 #include "syntax_tree.hpp"
+#include "diagnostics.hpp"
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <vector>
 
 namespace Diploma {
 
-std::vector<Token> tokens;
-std::vector<Expr*> expressions;
+// per thread, for the compile server
+thread_local std::vector<Token> tokens;
+thread_local std::vector<Expr*> expressions;
+thread_local std::map<std::string, TypeExpr*> typeDecls;
 
-int currToken;
+thread_local int currToken;
+thread_local int yields = -1; // in the function being parsed, -1 outside of functions
 
 Token top(int offset = 0) { // get i-th or EOF
   if (tokens.empty())
@@ -35,8 +43,25 @@ bool topIsEnd() {
   return top().grapheme == END_OF_FILE;
 }
 
+// where the node starts, for the debug info
+template <typename T> T* at(Token token, T* expr) {
+  expr->line = token.line;
+  expr->column = token.column;
+  return expr;
+}
+
+template <typename T> T* at(Expr* from, T* expr) {
+  if (from != nullptr) {
+    expr->line = from->line;
+    expr->column = from->column;
+  }
+  return expr;
+}
+
+Expr* handleString(Token str);
 Expr* handlePrimitive();
 Expr* handleUnary();
+Expr* handleCast();
 Expr* handleFactor();
 Expr* handleTerm();
 Expr* handleComparison();
@@ -46,74 +71,204 @@ Expr* handleLogicalOr();
 BlockExpr* handleBlock();
 FuncExpr* handleFunc();
 Expr* handleIfElse();
+Expr* handleFor();
+Expr* handleWhile();
+Expr* handleMap();
+Expr* handleType();
 Expr* handleExpression();
 
-Expr* handlePrimitive() {
-  if (nextSequence(FALSE)) {
-    pop();
-    return new BoolExpr(false);
+Expr* handleInterpolation(std::string text, int line, int column) {
+  std::istringstream stream(text);
+  auto subTokens = performTokenization(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+  for (auto& t : subTokens) {
+    if (t.line == 0)
+      t.column += column;
+    t.line += line;
   }
-  if (nextSequence(TRUE)) {
-    pop();
-    return new BoolExpr(true);
+
+  auto oldToken = currToken;
+  std::swap(tokens, subTokens);
+  currToken = 0;
+  auto expr = handleLogicalOr();
+  if (!topIsEnd())
+    diagnostics() << "only one expression fits between quotes, the rest of '" << text << "' is ignored\n";
+  std::swap(tokens, subTokens);
+  currToken = oldToken;
+
+  return expr;
+}
+
+Expr* handleString(Token str) {
+  std::vector<Expr*> parts;
+  std::string segment = "";
+  auto value = str.value;
+  for (int i = 0; i < value.length(); i++) {
+    if (value[i] == '\\' && i + 1 < value.length() && value[i + 1] == '\'') {
+      segment += '\'';
+      i++;
+    } else if (value[i] == '\'') {
+      auto close = value.find('\'', i + 1);
+      if (close == std::string::npos) {
+        diagnostics() << "where is the closing quote for '" << value.substr(i + 1) << "'?\n";
+        segment += value.substr(i);
+        break;
+      }
+      if (close > i + 1) {
+        if (!segment.empty())
+          parts.emplace_back(at(str, new StrExpr(segment)));
+        segment = "";
+        auto text = value.substr(i + 1, close - i - 1);
+        parts.emplace_back(handleInterpolation(text, str.line, str.column + i + 2));
+      }
+      i = close;
+    } else {
+      segment += value[i];
+    }
   }
+  if (!segment.empty() || parts.empty())
+    parts.emplace_back(at(str, new StrExpr(segment)));
+
+  if (parts.size() == 1 && dynamic_cast<StrExpr*>(parts[0]))
+    return parts[0];
+  return at(str, new FormatExpr(parts));
+}
 
-  if (nextSequence(NUMBER)) {
-    auto num = pop();
-    auto isReal = num.value.find(".") != std::string::npos;
-    return isReal ? (Expr*)new Real64Expr(std::stod(num.value)) : (Expr*)new Int32Expr(std::stoi(num.value));
+// the suffix right after the digits picks the type: 7u64, 0.5f32
+Expr* handleNumber(Token num) {
+  auto digitsEnd = num.value.find_first_not_of("0123456789.");
+  auto digits = num.value.substr(0, digitsEnd);
+  auto suffix = digitsEnd == std::string::npos ? "" : num.value.substr(digitsEnd);
+  auto type = numberType(suffix);
+  if (!suffix.empty() && !type.has_value())
+    diagnostics() << "what number is '" << num.value << "'? there are i8, i16, i32, i64, u32, u64, f32 and f64\n";
+  auto isReal = digits.find(".") != std::string::npos;
+  if (isReal && type.has_value() && !isFloat(*type)) {
+    diagnostics() << "'" << num.value << "' has a fraction, it can't be " << suffix << "\n";
+    type = std::nullopt;
   }
+  if (isReal || (type.has_value() && isFloat(*type)))
+    return at(num, new RealExpr(std::strtod(digits.c_str(), nullptr), type.value_or(R64), type.has_value()));
+
+  errno = 0;
+  auto value = std::strtoull(digits.c_str(), nullptr, 10);
+  if (!type.has_value())
+    type = value <= INT32_MAX ? I32 : I64;
+  auto width = bitWidth(*type);
+  auto max = isUnsigned(*type) ? UINT64_MAX >> (64 - width) : 1ull << (width - 1); // -128i8 is fine
+  if (errno == ERANGE || value > max)
+    diagnostics() << num.value << " doesn't fit in " << typeName(*type) << "\n";
+  return at(num, new IntExpr(value, *type, !suffix.empty()));
+}
+
+Expr* handlePrimitive() {
+  if (nextSequence(FALSE))
+    return at(pop(), new BoolExpr(false));
+  if (nextSequence(TRUE))
+    return at(pop(), new BoolExpr(true));
+
+  if (nextSequence(NUMBER))
+    return handleNumber(pop());
   if (nextSequence(STRING)) {
     auto str = pop();
-    return new StrExpr(str.value);
+    return handleString(str);
   }
 
   if (nextSequence(IDENTIFIER)) {
     auto id = pop();
-    return new VarExpr(id);
+    return at(id, new VarExpr(id));
   }
 
+  if (nextSequence(LEFT_BRACE))
+    return handleMap();
+
   if (nextSequence(LEFT_PAREN)) {
     pop();
     auto expr = handleExpression();
     if (!nextSequence(RIGHT_PAREN))
-      std::cout << "STOP! Where is my ')'?" << std::endl;
+      diagnostics() << "STOP! Where is my ')'?" << std::endl;
     pop();
     return expr;
   }
 
+  auto token = top();
+  diagnostics() << "expected a value at " << token.line << ":" << token.column << ", not '" << token.value << "'\n";
   return nullptr;
 }
 
+std::vector<Expr*> handleArgs() {
+  pop(); // (
+  std::vector<Expr*> args;
+  while (!nextSequence(RIGHT_PAREN) && !topIsEnd()) {
+    args.emplace_back(handleExpression());
+
+    if (nextSequence(COMMA))
+      pop(); // ,
+  }
+  pop();     // )
+  return args;
+}
+
 Expr* handleUnary() {
   if (nextSequence(BANG) || nextSequence(MINUS) || nextSequence(PLUS)) {
     auto oper = pop();
-    return new UnaryExpr(oper, handleUnary());
+    return at(oper, new UnaryExpr(oper, handleUnary()));
   }
 
-  auto prim = handlePrimitive();
-  if (nextSequence(LEFT_PAREN)) {
-    pop(); // (
-    std::vector<Expr*> args;
-    while (!nextSequence(RIGHT_PAREN)) {
-      args.emplace_back(handleExpression());
+  if (nextSequence(UNIQ, REF) || nextSequence(SHAR, REF) || nextSequence(WEAK, REF)) {
+    auto kind = pop();
+    pop(); // ref
+    return at(kind, new RefExpr(kind.grapheme, handleUnary()));
+  }
+  if (nextSequence(REF)) {
+    auto ref = pop();
+    return at(ref, new RefExpr(UNIQ, handleUnary()));
+  }
+  if (nextSequence(DEREF)) {
+    auto deref = pop();
+    return at(deref, new DerefExpr(handleUnary()));
+  }
 
-      if (nextSequence(COMMA))
-        pop(); // ,
+  auto prim = handlePrimitive();
+  while (true) {
+    if (nextSequence(DOT, IDENTIFIER)) {
+      pop(); // .
+      auto member = pop();
+      if (nextSequence(LEFT_PAREN))
+        prim = at(member, new MethodCallExpr(prim, member, handleArgs()));
+      else
+        prim = at(member, new MemberExpr(prim, member));
+    } else if (nextSequence(LEFT_PAREN)) {
+      auto args = handleArgs();
+      auto var = dynamic_cast<VarExpr*>(prim);
+      auto typeDecl = var != nullptr ? typeDecls.find(var->identifier.value) : typeDecls.end();
+      if (typeDecl != typeDecls.end())
+        prim = at(prim, new NewObjExpr(typeDecl->second, args));
+      else
+        prim = at(prim, new CallExpr(prim, args));
+    } else {
+      break;
     }
-    pop();     // )
-    prim = new CallExpr(prim, args);
   }
 
   return prim;
 }
 
+// binds tighter than the operators: a * b as i64 is a * (b as i64)
+Expr* handleCast() {
+  auto value = handleUnary();
+  while (nextSequence(AS, IDENTIFIER)) {
+    pop(); // as
+    value = at(value, new CastExpr(value, pop()));
+  }
+  return value;
+}
+
 Expr* handleFactor() {
-  auto left = handleUnary();
+  auto left = handleCast();
   while (top().grapheme == STAR || top().grapheme == SLASH) {
     auto oper = pop();
-    auto right = handleUnary();
-    left = new BinaryExpr(oper, left, right);
+    auto right = handleCast();
+    left = at(oper, new BinaryExpr(oper, left, right));
   }
   return left;
 }
@@ -123,7 +278,7 @@ Expr* handleTerm() {
   while (top().grapheme == PLUS || top().grapheme == MINUS) {
     auto oper = pop();
     auto right = handleFactor();
-    left = new BinaryExpr(oper, left, right);
+    left = at(oper, new BinaryExpr(oper, left, right));
   }
   return left;
 }
@@ -134,7 +289,7 @@ Expr* handleComparison() {
          top().grapheme == LESS_EQUAL) {
     auto oper = pop();
     auto right = handleTerm();
-    left = new ComparisonExpr(oper, left, right);
+    left = at(oper, new ComparisonExpr(oper, left, right));
   }
   return left;
 }
@@ -144,7 +299,7 @@ Expr* handleEquality() {
   while (top().grapheme == BANG_EQUAL || top().grapheme == EQUAL_EQUAL) {
     auto oper = pop();
     auto right = handleComparison();
-    left = new ComparisonExpr(oper, left, right);
+    left = at(oper, new ComparisonExpr(oper, left, right));
   }
   return left;
 }
@@ -154,7 +309,7 @@ Expr* handleLogicalAnd() {
   if (nextSequence(AND)) {
     auto oper = pop();
     auto right = handleEquality();
-    expr = new LogicalExpr(oper, expr, right);
+    expr = at(oper, new LogicalExpr(oper, expr, right));
   }
   return expr;
 }
@@ -164,21 +319,22 @@ Expr* handleLogicalOr() {
   if (nextSequence(OR)) {
     auto oper = pop();
     auto right = handleLogicalAnd();
-    expr = new LogicalExpr(oper, expr, right);
+    expr = at(oper, new LogicalExpr(oper, expr, right));
   }
   return expr;
 }
 
 BlockExpr* handleBlock() {
   std::vector<Expr*> exprs;
-  auto blockStartColumn = top().column;
-  while (top().column == blockStartColumn) {
+  auto start = top();
+  while (top().column == start.column) {
     exprs.emplace_back(handleExpression());
   }
-  return new BlockExpr(exprs);
+  return at(start, new BlockExpr(exprs));
 }
 
 FuncExpr* handleFunc() {
+  auto start = top();
   std::vector<Token> args;
   auto withParen = top().grapheme == LEFT_PAREN;
   if (withParen)
@@ -200,18 +356,23 @@ FuncExpr* handleFunc() {
     if (top().grapheme == RIGHT_PAREN)
       pop(); // )
     else
-      std::cout << "Waiting for an extremely needed token ')'!\n";
+      diagnostics() << "Waiting for an extremely needed token ')'!\n";
   }
 
   if (top().grapheme != MINUS_GREATER)
-    std::cout << "Waited unnecessary '->' token" << std::endl;
+    diagnostics() << "Waited unnecessary '->' token" << std::endl;
   pop();
 
-  return new FuncExpr(args, handleBlock());
+  auto outerYields = yields;
+  yields = 0;
+  auto func = at(start, new FuncExpr(args, handleBlock()));
+  func->generator = yields > 0;
+  yields = outerYields;
+  return func;
 }
 
 Expr* handleIfElse() {
-  pop(); // if
+  auto start = pop(); // if
 
   auto condition = handleExpression();
   auto thenBlock = handleBlock();
@@ -221,7 +382,97 @@ Expr* handleIfElse() {
     elseBlock = handleBlock();
   }
 
-  return new IfElseExpr(condition, thenBlock, elseBlock);
+  return at(start, new IfElseExpr(condition, thenBlock, elseBlock));
+}
+
+Expr* handleFor() {
+  auto start = pop(); // for
+  auto item = pop();
+  pop(); // of
+
+  auto source = handleExpression();
+  return at(start, new ForExpr(item, source, handleBlock()));
+}
+
+Expr* handleWhile() {
+  auto start = pop(); // while
+
+  auto condition = handleExpression();
+  return at(start, new WhileExpr(condition, handleBlock()));
+}
+
+Expr* handleMap() {
+  auto start = pop(); // {
+  std::vector<std::pair<Expr*, Expr*>> entries;
+  while (!nextSequence(RIGHT_BRACE) && !topIsEnd()) {
+    auto key = handleLogicalOr();
+    if (!nextSequence(COLON)) {
+      diagnostics() << "every key of a map needs ':' and a value after it\n";
+      break;
+    }
+    pop(); // :
+    entries.emplace_back(key, handleLogicalOr());
+    if (!nextSequence(COMMA))
+      break;
+    pop(); // ,
+  }
+  if (nextSequence(RIGHT_BRACE))
+    pop(); // }
+  else
+    diagnostics() << "the map at " << start.line << ":" << start.column << " is never closed with '}'\n";
+  return at(start, new MapExpr(entries));
+}
+
+Expr* handleType() {
+  auto name = pop();
+  pop(); // type
+
+  std::vector<Token> params;
+  if (nextSequence(LEFT_PAREN)) {
+    pop(); // (
+    while (nextSequence(IDENTIFIER)) {
+      params.emplace_back(pop());
+      if (nextSequence(COMMA))
+        pop(); // ,
+    }
+    if (nextSequence(RIGHT_PAREN))
+      pop(); // )
+    else
+      diagnostics() << "fields of '" << name.value << "' are never closed with ')'\n";
+  }
+
+  auto typeExpr = at(name, new TypeExpr(name, params));
+  if (nextSequence(COLON, IDENTIFIER)) {
+    pop(); // :
+    auto baseName = pop();
+    auto base = typeDecls.find(baseName.value);
+    if (base == typeDecls.end()) {
+      diagnostics() << "'" << name.value << "' wants to be '" << baseName.value << "', but there is no such type yet\n";
+    } else {
+      typeExpr->base = base->second;
+      base->second->derived.emplace_back(typeExpr);
+    }
+    if (nextSequence(LEFT_PAREN))
+      typeExpr->baseArgs = handleArgs();
+  }
+  typeDecls[name.value] = typeExpr;
+
+  if (top().line > name.line && top().column > name.column) {
+    auto membersColumn = top().column;
+    while (top().column == membersColumn && !topIsEnd()) {
+      if (nextSequence(IDENTIFIER, COLON_EQUAL)) {
+        typeExpr->fields.emplace_back((NewVarExpr*)handleExpression());
+      } else if (nextSequence(IDENTIFIER)) {
+        auto methodName = pop();
+        typeExpr->methods.emplace_back(methodName.value, handleFunc());
+      } else {
+        diagnostics() << "only fields and methods live inside of '" << name.value << "'\n";
+        pop();
+      }
+    }
+  }
+
+  return typeExpr;
 }
 
 bool isNextFunc() {
@@ -253,18 +504,60 @@ Expr* handleExpression() {
     auto identifier = pop();
     pop();
     auto value = handleExpression();
-    return new NewVarExpr(identifier, value);
+    return at(identifier, new NewVarExpr(identifier, value));
   }
 
   if (nextSequence(IDENTIFIER, EQUAL)) {
     auto identifier = pop();
     pop();
     auto value = handleExpression();
-    return new VarAssignExpr(identifier, value);
+    return at(identifier, new VarAssignExpr(identifier, value));
+  }
+
+  if (nextSequence(IDENTIFIER, DOT, IDENTIFIER, EQUAL)) {
+    auto object = at(top(), new VarExpr(pop()));
+    pop(); // .
+    auto member = pop();
+    pop(); // =
+    return at(object, new MemberAssignExpr(object, member, handleExpression()));
+  }
+
+  if (nextSequence(IDENTIFIER, TYPE)) {
+    return handleType();
+  }
+
+  if (nextSequence(TAIL)) {
+    pop(); // tail
+    auto expr = handleExpression();
+    auto newVar = dynamic_cast<NewVarExpr*>(expr);
+    auto func = dynamic_cast<FuncExpr*>(newVar != nullptr ? newVar->value : expr);
+    if (func != nullptr)
+      func->tail = true;
+    else
+      diagnostics() << "only functions can be 'tail'\n";
+    if (func != nullptr && func->memo) {
+      diagnostics() << "a function can't be both 'tail' and 'memo', the result is cached after the call returns\n";
+      func->memo = false;
+    }
+    return expr;
+  }
+
+  if (nextSequence(MEMO)) {
+    pop(); // memo
+    auto expr = handleExpression();
+    auto newVar = dynamic_cast<NewVarExpr*>(expr);
+    auto func = dynamic_cast<FuncExpr*>(newVar != nullptr ? newVar->value : expr);
+    if (func == nullptr)
+      diagnostics() << "only functions can be 'memo'\n";
+    else if (func->tail)
+      diagnostics() << "a function can't be both 'tail' and 'memo', the result is cached after the call returns\n";
+    else
+      func->memo = true;
+    return expr;
   }
 
   if (top().grapheme == IDENTIFIER && top().value == "println") {
-    pop();     // println
+    auto start = pop(); // println
     auto withParen = top().grapheme == LEFT_PAREN;
     if (withParen)
       pop();   // (
@@ -280,11 +573,11 @@ Expr* handleExpression() {
       if (top().grapheme == RIGHT_PAREN)
         pop(); // )
       else
-        std::cout << "expected a ')' token,"
-                     "but if you don't like writing brackets,"
-                     "you can remove the '(' that comes after 'println'\n";
+        diagnostics() << "expected a ')' token,"
+                         "but if you don't like writing brackets,"
+                         "you can remove the '(' that comes after 'println'\n";
     }
-    return new PrintlnExpr(values);
+    return at(start, new PrintlnExpr(values));
   }
 
   if (isNextFunc()) {
@@ -295,12 +588,32 @@ Expr* handleExpression() {
     return handleIfElse();
   }
 
+  if (nextSequence(FOR, IDENTIFIER, OF)) {
+    return handleFor();
+  }
+
+  if (nextSequence(WHILE)) {
+    return handleWhile();
+  }
+
+  if (nextSequence(YIELD)) {
+    auto start = pop(); // yield
+    if (yields < 0)
+      diagnostics() << "yield only works inside of a function, that function becomes a generator\n";
+    else
+      yields++;
+    return at(start, new YieldExpr(handleLogicalOr()));
+  }
+
   return handleLogicalOr();
 }
 
-std::vector<Expr*> parseSyntaxTree(std::vector<Token> t) {
+std::vector<Expr*> parseSyntaxTree(std::vector<Token> t, bool keepTypes) {
   tokens = t;
   expressions = {};
+  yields = -1;
+  if (!keepTypes)
+    typeDecls = {};
   currToken = 0;
   while (!topIsEnd()) {
     auto exp = handleExpression();
@@ -312,4 +625,104 @@ std::vector<Expr*> parseSyntaxTree(std::vector<Token> t) {
   return expressions;
 }
 
+std::optional<ExprType> numberType(const std::string& name) {
+  static const std::pair<const char*, ExprType> types[] = {
+    {"i8", I8}, {"i16", I16}, {"i32", I32}, {"i64", I64}, {"u32", U32}, {"u64", U64}, {"f32", F32}, {"f64", R64},
+  };
+  for (auto [typeName, type] : types) {
+    if (name == typeName)
+      return type;
+  }
+  return std::nullopt;
+}
+
+std::string typeName(ExprType type) {
+  switch (type) {
+  case VOID:
+    return "void";
+  case BOOL:
+    return "bool";
+  case I8:
+    return "i8";
+  case I16:
+    return "i16";
+  case I32:
+    return "i32";
+  case I64:
+    return "i64";
+  case U32:
+    return "u32";
+  case U64:
+    return "u64";
+  case F32:
+    return "f32";
+  case R64:
+    return "f64";
+  case STR:
+    return "str";
+  case FUNC:
+    return "func";
+  case GEN:
+    return "generator";
+  case MAP:
+    return "map";
+  case UNIQ_REF:
+    return "uniq ref";
+  case SHAR_REF:
+    return "shar ref";
+  case WEAK_REF:
+    return "weak ref";
+  case OBJ:
+    return "object";
+  }
+  return "?";
+}
+
+bool isNumber(ExprType type) {
+  return isInteger(type) || isFloat(type);
+}
+
+bool isInteger(ExprType type) {
+  return type == I8 || type == I16 || type == I32 || type == I64 || type == U32 || type == U64;
+}
+
+bool isFloat(ExprType type) {
+  return type == F32 || type == R64;
+}
+
+bool isUnsigned(ExprType type) {
+  return type == U32 || type == U64;
+}
+
+int bitWidth(ExprType type) {
+  switch (type) {
+  case BOOL:
+    return 1;
+  case I8:
+    return 8;
+  case I16:
+    return 16;
+  case I32:
+  case U32:
+  case F32:
+    return 32;
+  case I64:
+  case U64:
+  case R64:
+    return 64;
+  default:
+    return 0;
+  }
+}
+
+ExprType promote(ExprType left, ExprType right) {
+  if (!isNumber(left) || !isNumber(right)) // the type of a recursive call is not known yet
+    return isNumber(left) ? left : isNumber(right) ? right : I32;
+  if (isFloat(left) || isFloat(right))
+    return left == R64 || right == R64 ? R64 : F32;
+  if (bitWidth(left) != bitWidth(right))
+    return bitWidth(left) > bitWidth(right) ? left : right;
+  return isUnsigned(left) ? left : right;
+}
+
 } // namespace Diploma
@@ -0,0 +1,236 @@
+#include "timing.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace Diploma {
+
+TimeReport& TimeReport::get() {
+  static thread_local TimeReport report; // one per compile server worker
+  return report;
+}
+
+int64_t TimeReport::now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+int64_t TimeReport::originMicroseconds() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(origin.time_since_epoch()).count();
+}
+
+void TimeReport::clear() {
+  origin = std::chrono::steady_clock::now();
+  events.clear();
+  open.clear();
+  counters.clear();
+  sizes.clear();
+}
+
+void TimeReport::begin(std::string name) {
+  open.emplace_back(events.size());
+  auto memory = memoryCounters();
+  auto outerPeak = resetPeak(memory.allocated - memory.freed); // kept in peak until the phase ends
+  events.push_back({name, now(), 0, (int)open.size() - 1, memory.allocated, memory.freed, outerPeak, 0});
+}
+
+void TimeReport::end() {
+  if (open.empty())
+    return;
+  auto& event = events[open.back()];
+  event.duration = now() - event.start;
+  auto memory = memoryCounters();
+  auto outerPeak = event.peak;
+  event.peak = memory.peak - (event.allocated - event.freed);
+  event.allocated = memory.allocated - event.allocated;
+  event.freed = memory.freed - event.freed;
+  event.resident = peakResidentBytes();
+  resetPeak(std::max(memory.peak, outerPeak));
+  open.pop_back();
+}
+
+void TimeReport::count(std::string counter, int64_t value) {
+  for (auto& [name, v] : counters) {
+    if (name == counter) {
+      v = value;
+      return;
+    }
+  }
+  counters.emplace_back(counter, value);
+}
+
+void TimeReport::size(std::string name, int64_t count, int64_t bytes) {
+  sizes.push_back({name, count, bytes});
+}
+
+int64_t TimeReport::total(std::string name) {
+  auto sum = (int64_t)0;
+  for (auto& event : events) {
+    if (event.name == name)
+      sum += event.duration;
+  }
+  return sum;
+}
+
+size_t TimeReport::mark() {
+  return events.size();
+}
+
+// the starts go over to the clock of the other report, the depths to the phase it has open
+std::vector<TimeReport::Event> TimeReport::take(size_t mark) {
+  std::vector<Event> taken(events.begin() + mark, events.end());
+  events.resize(mark);
+  for (auto& event : taken) {
+    event.start += originMicroseconds();
+    event.depth -= open.size();
+  }
+  return taken;
+}
+
+void TimeReport::add(const std::vector<Event>& taken, int thread) {
+  for (auto event : taken) {
+    event.start -= originMicroseconds();
+    event.depth += open.size();
+    event.thread = thread;
+    events.emplace_back(event);
+  }
+}
+
+// phases with the same name and depth are summed up, in the order they first ran,
+// the ones of -jN workers add up their time and can take longer than the phase around them
+void TimeReport::print(std::ostream& out) {
+  struct Row {
+    std::string name;
+    int depth;
+    int64_t total;
+    int calls;
+  };
+  std::vector<Row> rows;
+  auto wall = (int64_t)0;
+  for (auto& event : events) {
+    if (event.depth == 0)
+      wall += event.duration;
+    auto row = std::find_if(rows.begin(), rows.end(), [&](auto& r) {
+      return r.name == event.name && r.depth == event.depth;
+    });
+    if (row == rows.end())
+      rows.push_back({event.name, event.depth, event.duration, 1});
+    else {
+      row->total += event.duration;
+      row->calls++;
+    }
+  }
+
+  char line[128];
+  out << "===-------------------- time report --------------------===\n";
+  std::snprintf(line, sizeof(line), "  %-32s %10s %7s %7s\n", "phase", "ms", "calls", "%");
+  out << line;
+  for (auto& row : rows) {
+    auto name = std::string(row.depth * 2, ' ') + row.name;
+    auto percent = wall > 0 ? 100.0 * row.total / wall : 0.0;
+    auto ms = row.total / 1000.0;
+    std::snprintf(line, sizeof(line), "  %-32s %10.3f %7d %6.1f%%\n", name.c_str(), ms, row.calls, percent);
+    out << line;
+  }
+  std::snprintf(line, sizeof(line), "  %-32s %10.3f\n", "total", wall / 1000.0);
+  out << line;
+
+  if (!counters.empty())
+    out << "  counters:\n";
+  for (auto& [name, value] : counters) {
+    std::snprintf(line, sizeof(line), "    %-30s %12lld\n", name.c_str(), (long long)value);
+    out << line;
+  }
+}
+
+// grouped like the time report, what a phase kept is what it allocated and didn't free
+void TimeReport::printMemory(std::ostream& out) {
+  std::vector<Event> rows;
+  for (auto& event : events) {
+    auto row = std::find_if(rows.begin(), rows.end(), [&](auto& r) {
+      return r.name == event.name && r.depth == event.depth;
+    });
+    if (row == rows.end())
+      rows.emplace_back(event);
+    else {
+      row->allocated += event.allocated;
+      row->freed += event.freed;
+      row->peak = std::max(row->peak, event.peak);
+      row->resident = std::max(row->resident, event.resident);
+    }
+  }
+
+  char line[160];
+  auto kb = [](int64_t bytes) { return bytes / 1024.0; };
+  out << "===-------------------- memory report --------------------===\n";
+  std::snprintf(
+    line, sizeof(line), "  %-32s %12s %12s %12s %12s %10s\n", "phase", "allocated KB", "freed KB", "kept KB",
+    "peak KB", "max RSS MB"
+  );
+  out << line;
+  for (auto& row : rows) {
+    auto name = std::string(row.depth * 2, ' ') + row.name;
+    std::snprintf(
+      line, sizeof(line), "  %-32s %12.1f %12.1f %12.1f %12.1f %10.1f\n", name.c_str(), kb(row.allocated),
+      kb(row.freed), kb(row.allocated - row.freed), kb(row.peak), row.resident / (1024.0 * 1024.0)
+    );
+    out << line;
+  }
+
+  if (!sizes.empty()) {
+    std::snprintf(line, sizeof(line), "  %-32s %12s %12s\n", "sizes", "count", "KB");
+    out << line;
+  }
+  for (auto& size : sizes) {
+    auto count = (long long)size.count;
+    std::snprintf(line, sizeof(line), "    %-30s %12lld %12.1f\n", size.name.c_str(), count, kb(size.bytes));
+    out << line;
+  }
+
+  auto memory = memoryCounters();
+  std::snprintf(
+    line, sizeof(line), "  still allocated: %.1f KB in %lld blocks of %lld\n", kb(memory.allocated - memory.freed),
+    (long long)(memory.allocations - memory.frees), (long long)memory.allocations
+  );
+  out << line;
+}
+
+static std::string jsonString(std::string text) {
+  std::string escaped = "\"";
+  for (auto c : text) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    if ((unsigned char)c >= 0x20)
+      escaped += c;
+  }
+  return escaped + "\"";
+}
+
+bool TimeReport::writeTrace(std::string path) {
+  std::ofstream out(path);
+  if (!out)
+    return false;
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"diploma\"}}";
+  auto threads = 0;
+  for (auto& event : events) {
+    threads = std::max(threads, event.thread);
+  }
+  for (auto thread = 1; thread <= threads; thread++) { // the -jN workers get tracks of their own
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread + 1
+        << ",\"args\":{\"name\":\"worker " << thread << "\"}}";
+  }
+  for (auto& event : events) {
+    out << ",\n{\"name\":" << jsonString(event.name) << ",\"cat\":\"compile\",\"ph\":\"X\",\"ts\":" << event.start
+        << ",\"dur\":" << event.duration << ",\"pid\":1,\"tid\":" << event.thread + 1 << "}";
+  }
+  for (auto& [name, value] : counters) { // shown as counter tracks at the end of the run
+    out << ",\n{\"name\":" << jsonString(name) << ",\"ph\":\"C\",\"ts\":" << now() << ",\"pid\":1,\"args\":{"
+        << jsonString(name) << ":" << value << "}}";
+  }
+  out << "\n]}\n";
+  return (bool)out;
+}
+
+} // namespace Diploma
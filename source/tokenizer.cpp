@@ -1,5 +1,6 @@
 #include "tokenizer.hpp"
 #include "common.hpp"
+#include "diagnostics.hpp"
 #include <functional>
 #include <iostream>
 #include <optional>
@@ -7,40 +8,40 @@
 
 namespace Diploma {
 
-int currLine, currColumn;
+thread_local int currLine, currColumn; // the compile server tokenizes on several threads
 
 Token::Token(Grapheme token, std::string value, int ln, int col)
   : grapheme(token), value(value), line(ln >= 0 ? ln : currLine), column(col >= 0 ? col : currColumn) {}
 
-bool isDigit(std::string str, int i) {
+bool isDigit(const std::string& str, int i) {
   return i < str.length() ? isdigit(str[i]) : false;
 }
 
-bool isQuot(std::string str, int i) {
+bool isQuot(const std::string& str, int i) {
   return i < str.length() ? str[i] == '"' : false;
 }
 
-bool isLSpace(std::string str, int i) {
+bool isLSpace(const std::string& str, int i) {
   return i < str.length() ? str[i] == '_' : false;
 }
 
-bool isBSlash(std::string str, int i) {
+bool isBSlash(const std::string& str, int i) {
   return i < str.length() ? str[i] == '\\' : false;
 }
 
-bool isAlpha(std::string str, int i) {
+bool isAlpha(const std::string& str, int i) {
   return i < str.length() ? isalpha(str[i]) || str[i] == '_' : false;
 }
 
-bool isSpaceOrEOF(std::string str, int i) {
+bool isSpaceOrEOF(const std::string& str, int i) {
   return i < str.length() ? isspace(str[i]) : true;
 }
 
-bool isSub(std::string str, int from, std::string substr) {
+bool isSub(const std::string& str, int from, std::string substr) {
   return str.substr(from, substr.length()) == substr;
 }
 
-void incCursor(std::string str, int& i, int count = 1) {
+void incCursor(const std::string& str, int& i, int count = 1) {
   for (; i < str.length() && count > 0; count--) {
     currColumn++;
     if (str[i] == '\n') { // TODO ignore while string parsing
@@ -52,9 +53,9 @@ void incCursor(std::string str, int& i, int count = 1) {
   }
 }
 
-std::function<std::optional<Token>(std::string str, int& i)>
+std::function<std::optional<Token>(const std::string& str, int& i)>
 wordHandler(Grapheme grapheme, std::string word, bool nonAlphaCheck = false) {
-  return [grapheme, word, nonAlphaCheck](std::string str, int& i) {
+  return [grapheme, word, nonAlphaCheck](const std::string& str, int& i) {
     std::optional<Token> result = std::nullopt;
     auto niceSubstr = isSub(str, i, word);
     auto coolNextToIt = !nonAlphaCheck || (!isAlpha(str, i + word.length()) && !isDigit(str, i + word.length()));
@@ -66,7 +67,7 @@ wordHandler(Grapheme grapheme, std::string word, bool nonAlphaCheck = false) {
   };
 }
 
-std::optional<Token> numberHandler(std::string str, int& i) {
+std::optional<Token> numberHandler(const std::string& str, int& i) {
   std::optional<Token> result = std::nullopt;
   if (isDigit(str, i)) {
     bool has_dot = false;
@@ -75,7 +76,7 @@ std::optional<Token> numberHandler(std::string str, int& i) {
     while (i < str.length()) {
       if (str[i] == '.') {
         if (has_dot) {
-          std::cout << "Too much dots for one number, I know you love it but don't overdo" << std::endl;
+          diagnostics() << "Too much dots for one number, I know you love it but don't overdo" << std::endl;
         } else {
           value += '.';
           has_dot = true;
@@ -87,12 +88,18 @@ std::optional<Token> numberHandler(std::string str, int& i) {
       }
       incCursor(str, i);
     }
+    if (isAlpha(str, i) && (isDigit(str, i - 1) || str[i - 1] == '.')) { // the type suffix sticks to the digits
+      do {
+        value += str[i];
+        incCursor(str, i);
+      } while (isAlpha(str, i) || isDigit(str, i));
+    }
     result = Token(NUMBER, value, sLn, sCol);
   }
   return result;
 }
 
-std::optional<Token> stringHandler(std::string str, int& i) {
+std::optional<Token> stringHandler(const std::string& str, int& i) {
   std::optional<Token> result = std::nullopt;
   if (isQuot(str, i)) {
     std::string value = "";
@@ -115,7 +122,7 @@ std::optional<Token> stringHandler(std::string str, int& i) {
   return result;
 }
 
-std::optional<Token> identifierHandler(std::string str, int& i) {
+std::optional<Token> identifierHandler(const std::string& str, int& i) {
   std::optional<Token> result = std::nullopt;
   if (isAlpha(str, i)) {
     std::string value = "";
@@ -131,7 +138,7 @@ std::optional<Token> identifierHandler(std::string str, int& i) {
   return result;
 }
 
-std::function<std::optional<Token>(std::string str, int& i)> tokenHandlers[] = {
+std::function<std::optional<Token>(const std::string& str, int& i)> tokenHandlers[] = {
   wordHandler(LEFT_PAREN, "("),
   wordHandler(RIGHT_PAREN, ")"),
   wordHandler(LEFT_BRACE, "{"),
@@ -169,6 +176,17 @@ std::function<std::optional<Token>(std::string str, int& i)> tokenHandlers[] = {
   wordHandler(IF, "if", true),
   wordHandler(ELSE, "else", true),
   wordHandler(RET, "ret", true),
+  wordHandler(TAIL, "tail", true),
+  wordHandler(MEMO, "memo", true),
+  wordHandler(YIELD, "yield", true),
+  wordHandler(TYPE, "type", true),
+  wordHandler(REF, "ref32", true),
+  wordHandler(REF, "ref64", true),
+  wordHandler(REF, "ref", true),
+  wordHandler(DEREF, "deref", true),
+  wordHandler(UNIQ, "uniq", true),
+  wordHandler(SHAR, "shar", true),
+  wordHandler(WEAK, "weak", true),
 
   numberHandler,
   stringHandler,
@@ -190,7 +208,7 @@ std::vector<Token> performTokenization(std::istreambuf_iterator<char> begin, std
       }
     }
 
-    for (auto handler : tokenHandlers) {
+    for (auto& handler : tokenHandlers) {
       auto res = handler(str, i);
       if (res.has_value()) {
         tokens.emplace_back(res.value());
@@ -1,19 +1,54 @@
+#include "diagnostics.hpp"
 #include "syntax_tree.hpp"
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <optional>
+#include <set>
 
 namespace Diploma {
 
 class TypeWalker : public TreeWalker {
   std::map<std::string, Expr*> context;
+  std::map<RefExpr*, Expr*> pointees;
+
+  std::map<TypeExpr*, std::map<std::string, Expr*>> classFields; // own and inherited
+  std::set<TypeExpr*> instantiated;
+  std::vector<MethodCallExpr*> methodCalls;
+  std::set<FuncExpr*> walkingMethods;
+  TypeExpr* currentOwner = nullptr; // type of the method being walked
+
+  std::map<std::string, FuncExpr*> functions; // top level ones, seen from everywhere
+  std::map<FuncExpr*, std::vector<CallExpr*>> recursiveCalls; // waiting for the type of the function
+  std::map<FuncExpr*, std::map<std::string, Expr*>> closures;  // what the function sees where it is created
+  std::set<FuncExpr*> called; // the types of a function come from its first call, the rest can't be compiled
+
+  // generators: a call gives the call itself as the value, 'for' finds the generator and what it yields from it
+  FuncExpr* currentFunc = nullptr;
+  std::map<FuncExpr*, Expr*> yields; // the first value every generator yields
+  std::map<Expr*, FuncExpr*> generatorOf;
+  std::map<Expr*, ForExpr*> iteratedBy;
+
+  std::map<MapExpr*, Expr*> mapValues; // the first value every map gets, what its get gives
 
 public:
+  // stays on one thread with -jN: the types of a function come from its first call, where its body is walked along
+  // with the bodies it calls, so no signature is fixed before the bodies behind it are checked
   void Do(std::vector<Expr*> syntax) {
+    for (auto expr : syntax) { // functions can call the ones declared below
+      auto newVar = dynamic_cast<NewVarExpr*>(expr);
+      if (newVar != nullptr && dynamic_cast<FuncExpr*>(newVar->value) != nullptr)
+        functions[newVar->identifier.value] = (FuncExpr*)newVar->value;
+    }
     for (auto expr : syntax) {
       expr->visit(this);
     }
+    resolveMethodCalls();
+  }
+
+  bool wasCalled(FuncExpr* func) {
+    return called.count(func) != 0;
   }
 
   std::any visitBool(BoolExpr* boolExpr) {
@@ -21,14 +56,14 @@ public:
     return (Expr*)boolExpr;
   }
 
-  std::any visitInt32(Int32Expr* int32Expr) {
-    int32Expr->type = I32;
-    return (Expr*)int32Expr;
+  std::any visitInt(IntExpr* intExpr) {
+    intExpr->type = intExpr->literalType;
+    return (Expr*)intExpr;
   }
 
-  std::any visitReal64(Real64Expr* real64Expr) {
-    real64Expr->type = R64;
-    return (Expr*)real64Expr;
+  std::any visitReal(RealExpr* realExpr) {
+    realExpr->type = realExpr->literalType;
+    return (Expr*)realExpr;
   }
 
   std::any visitStr(StrExpr* strExpr) {
@@ -36,12 +71,21 @@ public:
     return (Expr*)strExpr;
   }
 
+  std::any visitFormat(FormatExpr* formatExpr) {
+    for (auto part : formatExpr->parts) {
+      part->visit(this);
+    }
+    formatExpr->type = STR;
+    return (Expr*)formatExpr;
+  }
+
   std::any visitNewVar(NewVarExpr* newVarExpr) {
     auto initValue = std::any_cast<Expr*>(newVarExpr->value->visit(this));
     newVarExpr->type = initValue->type;
+    newVarExpr->objType = initValue->objType;
     auto res = context.try_emplace(newVarExpr->identifier.value, initValue);
     if (!res.second) {
-      std::cout << "oh no, you should use assign(=) instead of creating(:=) operator\n";
+      diagnostics() << "oh no, you should use assign(=) instead of creating(:=) operator\n";
     }
     return (Expr*)initValue;
   }
@@ -49,13 +93,36 @@ public:
   std::any visitVarAssign(VarAssignExpr* varAssignExpr) {
     auto newValue = std::any_cast<Expr*>(varAssignExpr->value->visit(this));
     varAssignExpr->type = newValue->type;
+    varAssignExpr->objType = newValue->objType;
+    auto oldValue = context[varAssignExpr->identifier.value];
+    if (oldValue != nullptr && isNumber(oldValue->type) && newValue->type != oldValue->type) {
+      if (adapt(varAssignExpr->value, oldValue->type)) {
+        varAssignExpr->type = oldValue->type;
+      } else {
+        diagnostics() << "'" << varAssignExpr->identifier.value << "' holds " << typeName(oldValue->type) << ", not "
+                      << typeName(newValue->type) << ", convert it with 'as'\n";
+      }
+      return (Expr*)oldValue;
+    }
+    if (oldValue != nullptr && oldValue->objType != nullptr) {
+      if (newValue->objType == nullptr || !newValue->objType->isSubtypeOf(oldValue->objType)) {
+        diagnostics() << "'" << varAssignExpr->identifier.value << "' holds " << oldValue->objType->name.value
+                      << ", only it or its derived types fit there\n";
+      }
+      return (Expr*)newValue; // keep the more general type for the variable
+    }
     context[varAssignExpr->identifier.value] = newValue;
     return (Expr*)newValue;
   }
 
   std::any visitVar(VarExpr* varExpr) {
+    if (context.count(varExpr->identifier.value) == 0 && functions.count(varExpr->identifier.value) != 0) {
+      varExpr->type = FUNC;
+      return (Expr*)functions[varExpr->identifier.value];
+    }
     auto value = context[varExpr->identifier.value];
     varExpr->type = value->type;
+    varExpr->objType = value->objType;
     return (Expr*)value;
   }
 
@@ -65,22 +132,37 @@ public:
     return (Expr*)unaryExpr;
   }
 
+  std::any visitCast(CastExpr* castExpr) {
+    auto value = std::any_cast<Expr*>(castExpr->value->visit(this));
+    auto target = castExpr->target.value;
+    auto type = target == "bool" ? BOOL : numberType(target).value_or(VOID);
+    if (type == VOID)
+      diagnostics() << "can't convert to '" << target << "', only to numbers and bool\n";
+    else if (!isNumber(value->type) && value->type != BOOL)
+      diagnostics() << typeName(value->type) << " can't be converted to " << target << "\n";
+    castExpr->type = type;
+    return (Expr*)castExpr;
+  }
+
   std::any visitComparison(ComparisonExpr* comparisonExpr) {
-    auto left = std::any_cast<Expr*>(comparisonExpr->left->visit(this));
-    auto right = std::any_cast<Expr*>(comparisonExpr->right->visit(this));
+    comparisonExpr->left->visit(this);
+    comparisonExpr->right->visit(this);
+    if (!areStrings(comparisonExpr->left, comparisonExpr->right))
+      meet(comparisonExpr->left, comparisonExpr->right);
     comparisonExpr->type = BOOL;
     return (Expr*)comparisonExpr;
   }
 
   std::any visitBinary(BinaryExpr* binaryExpr) {
-    auto left = std::any_cast<Expr*>(binaryExpr->left->visit(this));
-    auto right = std::any_cast<Expr*>(binaryExpr->right->visit(this));
-
-    if (left->type == R64 || right->type == R64)
-      binaryExpr->type = R64;
-    else
-      binaryExpr->type = I32;
-
+    binaryExpr->left->visit(this);
+    binaryExpr->right->visit(this);
+    if (areStrings(binaryExpr->left, binaryExpr->right)) {
+      if (binaryExpr->oper.grapheme != PLUS)
+        diagnostics() << "strings can only be joined with '+', not '" << binaryExpr->oper.value << "'\n";
+      binaryExpr->type = STR;
+      return (Expr*)binaryExpr;
+    }
+    binaryExpr->type = meet(binaryExpr->left, binaryExpr->right);
     return (Expr*)binaryExpr;
   }
 
@@ -92,15 +174,30 @@ public:
   }
 
   std::any visitIfElse(IfElseExpr* ifElseExpr) {
+    ifElseExpr->condition->visit(this);
     auto thenRetType = std::any_cast<Expr*>(ifElseExpr->thenBlock->visit(this))->type;
     auto elseRetType = (std::optional<ExprType>)std::nullopt;
     if (ifElseExpr->elseBlock != nullptr) {
       elseRetType = std::any_cast<Expr*>(ifElseExpr->elseBlock->visit(this))->type;
     }
-    if (elseRetType.has_value() && thenRetType != elseRetType) {
-      std::cout << "it can be ok, but there are different types if-else blocks return\n";
+    if (elseRetType.has_value() && isNumber(thenRetType) && isNumber(*elseRetType) && thenRetType != elseRetType) {
+      auto& thenList = ifElseExpr->thenBlock->list;
+      auto& elseList = ifElseExpr->elseBlock->list;
+      if (!thenList.empty() && adapt(thenList.back(), *elseRetType))
+        thenRetType = ifElseExpr->thenBlock->type = *elseRetType;
+      else if (!elseList.empty() && adapt(elseList.back(), thenRetType))
+        elseRetType = ifElseExpr->elseBlock->type = thenRetType;
+    }
+    auto recursive = thenRetType == VOID || elseRetType == VOID;
+    if (elseRetType.has_value() && thenRetType != elseRetType && !recursive) {
+      diagnostics() << "it can be ok, but there are different types if-else blocks return\n";
     }
     ifElseExpr->type = thenRetType;
+    ifElseExpr->objType = ifElseExpr->thenBlock->objType;
+    if (thenRetType == VOID && elseRetType.has_value()) { // then block is a recursive call
+      ifElseExpr->type = elseRetType.value();
+      ifElseExpr->objType = ifElseExpr->elseBlock->objType;
+    }
     return (Expr*)ifElseExpr;
   }
 
@@ -110,32 +207,66 @@ public:
       lastValue = std::any_cast<Expr*>(b->visit(this));
     }
     blockExpr->type = lastValue->type;
+    blockExpr->objType = lastValue->objType;
     return (Expr*)lastValue;
   }
 
   std::any visitFunc(FuncExpr* funcExpr) {
+    closures[funcExpr] = context;
     funcExpr->type = FUNC;
     return (Expr*)funcExpr;
   }
 
   std::any visitCall(CallExpr* callExpr) {
     auto func = (FuncExpr*)std::any_cast<Expr*>(callExpr->func->visit(this));
+    std::vector<Expr*> args;
+    for (auto a : callExpr->args) {
+      args.emplace_back(std::any_cast<Expr*>(a->visit(this)));
+    }
+
+    if (recursiveCalls.count(func) != 0) { // the type comes from the other branches
+      recursiveCalls[func].emplace_back(callExpr);
+      callExpr->type = func->retType;
+      if (func->generator)
+        generatorOf[callExpr] = func;
+      return (Expr*)callExpr;
+    }
+
     auto oldContext = context;
-    context.clear();
-    if (func->argsTypes.empty() && !callExpr->args.empty()) {
-      for (auto i = 0; i < callExpr->args.size(); i++) {
-        auto arg = std::any_cast<Expr*>(callExpr->args[i]->visit(this));
+    context = closures[func];
+    if (func->argsTypes.empty()) {
+      for (auto arg : args) {
         func->argsTypes.emplace_back(arg->type);
-        context[func->args[i].value] = arg;
       }
     }
-    if (func->args.size() != func->argsTypes.size()) {
-      std::cout << "No no, you call func with " << func->argsTypes.size() << " args of " << func->args.size()
-                << ", it not very zingy for now!\n";
+    for (auto i = 0; i < args.size() && i < func->args.size(); i++) {
+      context[func->args[i].value] = args[i];
+    }
+    if (func->args.size() != args.size()) {
+      diagnostics() << "No no, you call func with " << args.size() << " args of " << func->args.size()
+                    << ", it not very zingy for now!\n";
     }
 
+    recursiveCalls[func] = {};
+    if (func->generator)
+      func->retType = GEN; // known before the body, it can go over itself
+    auto oldFunc = currentFunc;
+    currentFunc = func;
     auto result = std::any_cast<Expr*>(func->body->visit(this));
+    currentFunc = oldFunc;
+    if (func->generator) {
+      result = callExpr;
+      callExpr->type = GEN;
+      generatorOf[callExpr] = func;
+    }
     func->retType = callExpr->type = result->type;
+    callExpr->objType = result->objType;
+    for (auto recursive : recursiveCalls[func]) {
+      recursive->type = func->retType;
+      recursive->objType = result->objType;
+    }
+    recursiveCalls.erase(func);
+    called.insert(func);
     context = oldContext;
     return result;
   }
@@ -147,6 +278,461 @@ public:
     printlnExpr->type = I32;
     return (Expr*)printlnExpr;
   }
+
+  std::any visitRef(RefExpr* refExpr) {
+    auto value = std::any_cast<Expr*>(refExpr->value->visit(this));
+    refExpr->objType = value->objType;
+    if (refExpr->kind == WEAK) {
+      auto target = dynamic_cast<RefExpr*>(value);
+      if (value->type != SHAR_REF || target == nullptr) {
+        diagnostics() << "weak ref can only watch a shar ref\n";
+        refExpr->valueType = VOID;
+      } else {
+        refExpr->valueType = target->valueType;
+        pointees[refExpr] = pointees[target];
+      }
+      refExpr->type = WEAK_REF;
+    } else {
+      refExpr->valueType = value->type;
+      pointees[refExpr] = value;
+      refExpr->type = refExpr->kind == SHAR ? SHAR_REF : UNIQ_REF;
+    }
+    return (Expr*)refExpr;
+  }
+
+  std::any visitDeref(DerefExpr* derefExpr) {
+    auto ref = dynamic_cast<RefExpr*>(std::any_cast<Expr*>(derefExpr->ref->visit(this)));
+    if (ref == nullptr) {
+      diagnostics() << "deref needs a ref, there is nothing to follow\n";
+      derefExpr->type = VOID;
+      return (Expr*)derefExpr;
+    }
+    derefExpr->type = ref->valueType;
+    derefExpr->objType = ref->objType;
+    auto pointee = pointees[ref];
+    return pointee != nullptr ? pointee : (Expr*)derefExpr;
+  }
+
+  std::any visitType(TypeExpr* typeExpr) {
+    typeExpr->type = VOID;
+    return (Expr*)typeExpr;
+  }
+
+  std::any visitNewObj(NewObjExpr* newObjExpr) {
+    std::vector<Expr*> args;
+    for (auto a : newObjExpr->args) {
+      args.emplace_back(std::any_cast<Expr*>(a->visit(this)));
+    }
+    construct(newObjExpr->objType, args);
+    instantiated.insert(newObjExpr->objType);
+    newObjExpr->type = OBJ;
+    return (Expr*)newObjExpr;
+  }
+
+  std::any visitMember(MemberExpr* memberExpr) {
+    auto object = std::any_cast<Expr*>(memberExpr->object->visit(this));
+    auto field = findField(object->objType, memberExpr->member.value);
+    if (field == nullptr) {
+      memberExpr->type = VOID;
+      return (Expr*)memberExpr;
+    }
+    memberExpr->type = field->type;
+    memberExpr->objType = field->objType;
+    return field;
+  }
+
+  std::any visitMemberAssign(MemberAssignExpr* memberAssignExpr) {
+    auto object = std::any_cast<Expr*>(memberAssignExpr->object->visit(this));
+    auto value = std::any_cast<Expr*>(memberAssignExpr->value->visit(this));
+    auto field = findField(object->objType, memberAssignExpr->member.value);
+    if (field != nullptr && field->type != value->type) {
+      diagnostics() << "field '" << memberAssignExpr->member.value << "' can't change its type\n";
+    }
+    memberAssignExpr->type = value->type;
+    memberAssignExpr->objType = value->objType;
+    return value;
+  }
+
+  std::any visitMethodCall(MethodCallExpr* methodCallExpr) {
+    auto receiver = (TypeExpr*)nullptr;
+    auto base = dynamic_cast<VarExpr*>(methodCallExpr->object);
+    if (base != nullptr && base->identifier.value == "base" && context.count("base") == 0 && currentOwner != nullptr) {
+      receiver = currentOwner->base;
+      methodCallExpr->throughBase = true;
+    } else {
+      auto object = std::any_cast<Expr*>(methodCallExpr->object->visit(this));
+      if (methodCallExpr->object->type == MAP)
+        return walkMapMethod(methodCallExpr, dynamic_cast<MapExpr*>(object));
+      receiver = object->objType;
+    }
+
+    std::vector<Expr*> args;
+    for (auto a : methodCallExpr->args) {
+      args.emplace_back(std::any_cast<Expr*>(a->visit(this)));
+    }
+
+    auto [owner, method] = receiver != nullptr ? receiver->findMethod(methodCallExpr->method.value)
+                                               : std::pair<TypeExpr*, FuncExpr*>(nullptr, nullptr);
+    if (method == nullptr) {
+      diagnostics() << "there is no method '" << methodCallExpr->method.value << "' to call\n";
+      methodCallExpr->type = VOID;
+      return (Expr*)methodCallExpr;
+    }
+
+    if (methodCallExpr->receiverType == nullptr) {
+      methodCallExpr->receiverType = receiver;
+      methodCalls.emplace_back(methodCallExpr);
+    } else { // walked again from another call, both types have to fit
+      methodCallExpr->receiverType = commonBase(methodCallExpr->receiverType, receiver);
+    }
+    methodCallExpr->targetOwner = owner;
+    methodCallExpr->target = method;
+
+    auto result = walkMethod(owner, method, receiver, args);
+    methodCallExpr->type = result->type;
+    methodCallExpr->objType = result->objType;
+    return result;
+  }
+
+  // every yield of a generator gives the same type, a number literal takes the type of the first one
+  std::any visitYield(YieldExpr* yieldExpr) {
+    auto value = std::any_cast<Expr*>(yieldExpr->value->visit(this));
+    yieldExpr->type = value->type;
+    yieldExpr->objType = value->objType;
+    if (currentFunc == nullptr || value->type == VOID) // a method, or a recursive call without a type yet
+      return value;
+    auto& first = yields[currentFunc];
+    if (first == nullptr) {
+      first = value;
+      currentFunc->yieldType = value->type;
+    } else if (value->type != currentFunc->yieldType) {
+      if (adapt(yieldExpr->value, currentFunc->yieldType))
+        yieldExpr->type = currentFunc->yieldType;
+      else
+        diagnostics() << "the generator yields " << typeName(currentFunc->yieldType) << ", it can't yield "
+                      << typeName(value->type) << " too\n";
+    }
+    return value;
+  }
+
+  std::any visitFor(ForExpr* forExpr) {
+    auto source = std::any_cast<Expr*>(forExpr->source->visit(this));
+    auto name = forExpr->item.value;
+    auto generator = generatorOf.count(source) != 0 ? generatorOf[source] : nullptr;
+    auto map = dynamic_cast<MapExpr*>(source);
+    auto item = (Expr*)nullptr;
+    if (forExpr->source->type == MAP && map != nullptr) {
+      forExpr->itemType = map->keyType;
+      if (map->keyType == VOID)
+        diagnostics() << "the map has no keys before the 'for', the type of '" << name << "' is unknown\n";
+    } else if (forExpr->source->type != GEN || generator == nullptr) {
+      diagnostics() << "'for' goes over a generator or the keys of a map, not over " << typeName(forExpr->source->type)
+                    << "\n";
+    } else {
+      forExpr->itemType = generator->yieldType;
+      item = yields[generator];
+      if (item == nullptr)
+        diagnostics() << "the generator goes over itself before it yields anything, the type of '" << name
+                      << "' is unknown\n";
+      auto [iterated, first] = iteratedBy.try_emplace(source, forExpr);
+      if (!first && iterated->second != forExpr)
+        diagnostics() << "a generator runs once, 'for' frees it, call the generator again for another 'for'\n";
+    }
+    if (item == nullptr) {
+      item = new VarExpr(forExpr->item);
+      item->type = forExpr->itemType;
+    }
+
+    auto shadowed = context.find(name);
+    auto outer = shadowed != context.end() ? shadowed->second : nullptr;
+    context[name] = item;
+    forExpr->body->visit(this);
+    if (outer != nullptr)
+      context[name] = outer;
+    else
+      context.erase(name);
+    forExpr->type = VOID;
+    return (Expr*)forExpr;
+  }
+
+  std::any visitWhile(WhileExpr* whileExpr) {
+    whileExpr->condition->visit(this);
+    whileExpr->body->visit(this);
+    whileExpr->type = VOID;
+    return (Expr*)whileExpr;
+  }
+
+  // the first entry gives the types of the map
+  std::any visitMap(MapExpr* mapExpr) {
+    for (auto& [key, value] : mapExpr->entries) {
+      key->visit(this);
+      fitMap(mapExpr, key, std::any_cast<Expr*>(value->visit(this)), value);
+    }
+    mapExpr->type = MAP;
+    return (Expr*)mapExpr;
+  }
+
+private:
+  // put(key, value), get(key), has(key), remove(key) and size(), the keys and values of an empty map
+  // get their types from the first of them that has one
+  Expr* walkMapMethod(MethodCallExpr* methodCallExpr, MapExpr* map) {
+    std::vector<Expr*> args;
+    for (auto a : methodCallExpr->args) {
+      args.emplace_back(std::any_cast<Expr*>(a->visit(this)));
+    }
+    methodCallExpr->type = VOID;
+    auto name = methodCallExpr->method.value;
+    auto count = name == "put" ? 2 : name == "size" ? 0 : 1;
+    if (map == nullptr) {
+      diagnostics() << "can't tell which map '" << name << "' is called on, keep it in a variable first\n";
+      return (Expr*)methodCallExpr;
+    }
+    if (name != "put" && name != "get" && name != "has" && name != "remove" && name != "size") {
+      diagnostics() << "a map has put, get, has, remove and size, there is no '" << name << "'\n";
+      return (Expr*)methodCallExpr;
+    }
+    if (args.size() != count) {
+      diagnostics() << "'" << name << "' of a map takes " << count << " args, not " << args.size() << "\n";
+      return (Expr*)methodCallExpr;
+    }
+
+    if (methodCallExpr->map == nullptr)
+      methodCallExpr->map = map;
+    else if (methodCallExpr->map != map && !sameTypes(methodCallExpr->map, map))
+      diagnostics() << "'" << name << "' is called on maps of different types, the code is made for the first one\n";
+    if (count > 0)
+      fitMap(map, methodCallExpr->args[0], count > 1 ? args[1] : nullptr, count > 1 ? methodCallExpr->args[1] : nullptr);
+
+    if (name == "has" || name == "remove") {
+      methodCallExpr->type = BOOL;
+      return (Expr*)methodCallExpr;
+    }
+    if (name == "size") {
+      methodCallExpr->type = I64;
+      return (Expr*)methodCallExpr;
+    }
+    methodCallExpr->type = map->valueType;
+    auto value = mapValues[map];
+    if (value == nullptr) {
+      diagnostics() << "nothing is put into the map before this '" << name << "', the type of its values is unknown\n";
+      return (Expr*)methodCallExpr;
+    }
+    methodCallExpr->objType = value->objType;
+    return name == "put" ? args[1] : value;
+  }
+
+  // the first key and value give the types of the map, number literals after them take those types;
+  // value is what the type walk gave for valueExpr
+  void fitMap(MapExpr* mapExpr, Expr* key, Expr* value, Expr* valueExpr) {
+    if (key->type != VOID && mapExpr->keyType == VOID) {
+      mapExpr->keyType = key->type;
+      if (key->type != I32 && key->type != R64 && key->type != STR)
+        diagnostics() << "the keys of a map are i32, f64 or str, not " << typeName(key->type) << "\n";
+    } else if (key->type != VOID && key->type != mapExpr->keyType && !adapt(key, mapExpr->keyType)) {
+      diagnostics() << "the keys of the map are " << typeName(mapExpr->keyType) << ", not " << typeName(key->type)
+                    << "\n";
+    }
+    if (value == nullptr || valueExpr->type == VOID) // a recursive call without a type yet
+      return;
+    if (mapExpr->valueType == VOID) {
+      mapExpr->valueType = valueExpr->type;
+      mapValues[mapExpr] = value;
+    } else if (valueExpr->type != mapExpr->valueType && !adapt(valueExpr, mapExpr->valueType)) {
+      diagnostics() << "the values of the map are " << typeName(mapExpr->valueType) << ", not "
+                    << typeName(valueExpr->type) << "\n";
+    }
+  }
+
+  static bool sameTypes(MapExpr* left, MapExpr* right) {
+    return left->keyType == right->keyType && left->valueType == right->valueType;
+  }
+
+  // a number without a suffix on one side takes the type of the other one,
+  // so x + 1 stays in the width of x; returns the type the operation is done in
+  // a string goes only with another string, or a recursive call that has no type yet
+  bool areStrings(Expr* left, Expr* right) {
+    if (left->type != STR && right->type != STR)
+      return false;
+    auto other = left->type == STR ? right->type : left->type;
+    if (other != STR && other != VOID)
+      diagnostics() << "a string can only be joined with or compared to a string, not " << typeName(other) << "\n";
+    return true;
+  }
+
+  ExprType meet(Expr* left, Expr* right) {
+    if (isNumber(left->type) && !adapt(right, left->type))
+      adapt(left, right->type);
+    return promote(left->type, right->type);
+  }
+
+  // an integer literal turns into any number, a real one into another float
+  static bool adapt(Expr* expr, ExprType type) {
+    if (!isNumber(type))
+      return false;
+    auto unary = dynamic_cast<UnaryExpr*>(expr);
+    if (unary != nullptr && unary->oper.grapheme != BANG && adapt(unary->value, type)) {
+      unary->type = type;
+      return true;
+    }
+    auto intExpr = dynamic_cast<IntExpr*>(expr);
+    auto realExpr = dynamic_cast<RealExpr*>(expr);
+    if ((intExpr != nullptr && !intExpr->suffixed) || (realExpr != nullptr && !realExpr->suffixed && isFloat(type))) {
+      expr->type = type;
+      return true;
+    }
+    return false;
+  }
+
+  // fields get their types from the first construction
+  void construct(TypeExpr* typeExpr, std::vector<Expr*> args) {
+    auto oldContext = context;
+    context.clear();
+    if (args.size() != typeExpr->params.size()) {
+      diagnostics() << typeExpr->name.value << " needs " << typeExpr->params.size() << " values, not " << args.size()
+                    << "\n";
+    }
+    for (auto i = 0; i < args.size() && i < typeExpr->params.size(); i++) {
+      context[typeExpr->params[i].value] = args[i];
+    }
+
+    auto inherited = std::map<std::string, Expr*>();
+    if (typeExpr->base != nullptr) {
+      std::vector<Expr*> baseArgs;
+      for (auto a : typeExpr->baseArgs) {
+        baseArgs.emplace_back(std::any_cast<Expr*>(a->visit(this)));
+      }
+      construct(typeExpr->base, baseArgs);
+      inherited = classFields[typeExpr->base];
+      for (auto [name, value] : inherited) {
+        context.try_emplace(name, value);
+      }
+    }
+
+    for (auto field : typeExpr->fields) {
+      auto value = std::any_cast<Expr*>(field->value->visit(this));
+      field->type = value->type;
+      field->objType = value->objType;
+      auto name = field->identifier.value;
+      if (inherited.count(name) != 0 && inherited[name]->type != value->type) {
+        diagnostics() << typeExpr->name.value << " can give '" << name << "' a new value, but not a new type\n";
+      }
+      context[name] = value;
+    }
+
+    if (classFields.count(typeExpr) == 0) {
+      for (auto param : typeExpr->params) {
+        if (inherited.count(param.value) == 0)
+          typeExpr->ownFields.emplace_back(param.value, context[param.value]->type);
+      }
+      for (auto field : typeExpr->fields) {
+        if (inherited.count(field->identifier.value) == 0)
+          typeExpr->ownFields.emplace_back(field->identifier.value, field->type);
+      }
+      classFields[typeExpr] = context;
+    }
+    context = oldContext;
+  }
+
+  Expr* findField(TypeExpr* typeExpr, std::string name) {
+    if (typeExpr == nullptr) {
+      diagnostics() << "'" << name << "' is looked up in something that is not an object\n";
+      return nullptr;
+    }
+    auto fields = classFields[typeExpr];
+    if (fields.count(name) == 0) {
+      diagnostics() << typeExpr->name.value << " has no field '" << name << "'\n";
+      return nullptr;
+    }
+    return fields[name];
+  }
+
+  Expr* walkMethod(TypeExpr* owner, FuncExpr* method, TypeExpr* receiver, std::vector<Expr*> args) {
+    if (walkingMethods.count(method) != 0) { // recursion, the type comes from the other branches
+      auto unknown = new VarExpr(Token(IDENTIFIER, "recursion"));
+      unknown->type = VOID;
+      return unknown;
+    }
+    walkingMethods.insert(method);
+    if (method->generator)
+      diagnostics() << "methods can't yield yet, make a generator function and give it the object\n";
+
+    auto oldContext = context;
+    auto oldOwner = currentOwner;
+    auto oldFunc = currentFunc;
+    context = classFields[receiver];
+    currentOwner = owner;
+    currentFunc = nullptr;
+    if (method->argsTypes.empty()) {
+      for (auto arg : args) {
+        method->argsTypes.emplace_back(arg->type);
+      }
+    }
+    if (method->args.size() != args.size()) {
+      diagnostics() << "method takes " << method->args.size() << " args, but got " << args.size() << "\n";
+    }
+    for (auto i = 0; i < args.size() && i < method->args.size(); i++) {
+      context[method->args[i].value] = args[i];
+    }
+
+    auto result = std::any_cast<Expr*>(method->body->visit(this));
+    method->retType = result->type;
+    method->type = FUNC;
+
+    context = oldContext;
+    currentOwner = oldOwner;
+    currentFunc = oldFunc;
+    walkingMethods.erase(method);
+    return result;
+  }
+
+  static TypeExpr* commonBase(TypeExpr* a, TypeExpr* b) {
+    for (auto t = a; t != nullptr; t = t->base) {
+      if (b->isSubtypeOf(t))
+        return t;
+    }
+    return nullptr;
+  }
+
+  // class hierarchy analysis over the types that are actually created:
+  // a call stays direct unless objects of several implementations can reach it
+  void resolveMethodCalls() {
+    for (auto call : methodCalls) {
+      if (call->throughBase || call->receiverType == nullptr)
+        continue;
+
+      std::map<FuncExpr*, TypeExpr*> implementations;
+      for (auto type : instantiated) {
+        if (type->isSubtypeOf(call->receiverType)) {
+          auto [owner, method] = type->findMethod(call->method.value);
+          if (method != nullptr)
+            implementations.try_emplace(method, type);
+        }
+      }
+      if (implementations.size() == 1) {
+        auto [method, type] = *implementations.begin();
+        if (method != call->target) { // the only one in use overrides the static choice
+          call->target = method;
+          call->targetOwner = type->findMethod(call->method.value).first;
+          walkMethod(call->targetOwner, method, type, call->args);
+        }
+        continue;
+      }
+      if (implementations.size() < 2)
+        continue;
+
+      call->dynamic = true;
+      auto root = call->receiverType->root();
+      root->polymorphic = true;
+      auto& slots = root->vtable;
+      if (std::find(slots.begin(), slots.end(), call->method.value) == slots.end())
+        slots.emplace_back(call->method.value);
+      for (auto [method, type] : implementations) {
+        walkMethod(type->findMethod(call->method.value).first, method, type, call->args);
+        if (method->retType != call->target->retType)
+          diagnostics() << "overrides of '" << call->method.value << "' return different types\n";
+      }
+    }
+  }
 };
 
 } // namespace Diploma
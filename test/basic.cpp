@@ -1,17 +1,16 @@
-#include "abstract_syntax_tree.hpp"
-#include <fstream>
+#include "server.hpp"
 #include <gtest/gtest.h>
-#include <optional>
+#include <llvm/Support/TargetSelect.h>
+#include <map>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 
 using namespace std;
+using namespace Diploma;
 using namespace testing;
 
 TEST(Basic, CalcAOBOC) {
-  stringstream resultStream;
-  auto originalOutput = cout.rdbuf();
-  cout.rdbuf(resultStream.rdbuf());
-
   auto operations = {'+', '-', '*', '/'};
   auto numbers = {-2, -1, 0, +1, +2};
   auto binaryOperation = [](int l, int r, char o) {
@@ -24,7 +23,7 @@ TEST(Basic, CalcAOBOC) {
     } else if (o == '/') {
       return l / r;
     } else {
-      throw new exception("bad operator in test setup");
+      throw invalid_argument("bad operator in test setup");
     }
   };
   map<string, int> exprWithResult;
@@ -49,20 +48,23 @@ TEST(Basic, CalcAOBOC) {
             exprWithResult[exprStr.str()] = right;
           }
 
+  // one program prints them all, it is linked with the runtime and run like 'diploma-client --run' does
+  CompileRequest request;
+  request.mode = "run";
   for (auto p : exprWithResult) {
-    std::istringstream stream("println " + p.first);
-    auto tokens = performTokenization(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
-    auto syntaxTree = parseSyntaxTree(tokens);
-    for (auto t : syntaxTree) {
-      t->evaluate();
-    }
+    request.source += "println(" + p.first + ")\n";
+  }
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  auto reply = compile(request, DIPLOMA_RUNTIME);
+  ASSERT_EQ(reply.status, 0) << reply.diagnostics;
 
+  stringstream resultStream(reply.output);
+  for (auto p : exprWithResult) {
     string value;
     resultStream >> value;
-    if (stoi(value) != p.second) {
+    if (value.empty() || stoi(value) != p.second) {
       FAIL() << ("println " + p.first) << " is " << value << " but " << p.second << " needed";
     }
   }
-
-  cout.rdbuf(originalOutput);
 }
@@ -0,0 +1,210 @@
+#include "escape_walker.cpp"
+#include "fold_walker.cpp"
+#include "llvm_walker.cpp"
+#include "reach_walker.cpp"
+#include "server.hpp"
+#include "size_walker.cpp"
+#include "type_walker.cpp"
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <llvm/Support/TargetSelect.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Diploma;
+using namespace testing;
+
+struct PhaseRow {
+  double allocated, freed, kept, peak;
+};
+
+struct MemoryReport {
+  map<string, PhaseRow> phases; // the first row of every name
+  map<string, pair<int64_t, double>> sizes;
+};
+
+// the phases of 'diploma --mem-report', without the files
+MemoryReport compileWithReport(string source, int jobs) {
+  auto& report = TimeReport::get();
+  report.clear();
+  report.measureSizes = true;
+  report.begin("compile");
+  stringstream input(source);
+  auto tokens = vector<Token>();
+  {
+    ScopedTimer timer("tokenize");
+    tokens = performTokenization(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+  }
+  SizeWalker::reportTokens(tokens);
+  auto syntaxTree = vector<Expr*>();
+  {
+    ScopedTimer timer("parse");
+    syntaxTree = parseSyntaxTree(tokens);
+  }
+  SizeWalker::reportTree(syntaxTree);
+  {
+    ScopedTimer timer("reachability");
+    ReachWalker reach;
+    reach.Do(syntaxTree);
+    syntaxTree = reach.reachable;
+  }
+  {
+    ScopedTimer timer("type check");
+    TypeWalker().Do(syntaxTree);
+  }
+  {
+    ScopedTimer timer("fold calls");
+    FoldWalker().Do(syntaxTree);
+  }
+  {
+    ScopedTimer timer("escape analysis");
+    EscapeWalker().Do(syntaxTree);
+  }
+  {
+    ScopedTimer timer("codegen");
+    InterpreterWalker codegen(0, "");
+    codegen.useThreads(jobs);
+    codegen.Do(syntaxTree);
+    codegen.finish();
+  }
+  report.end();
+  report.measureSizes = false;
+
+  stringstream printed;
+  report.printMemory(printed);
+  MemoryReport parsed;
+  string line;
+  auto inSizes = false;
+  getline(printed, line); // the title
+  getline(printed, line); // the column names
+  while (getline(printed, line) && line.rfind("  still allocated", 0) != 0) {
+    if (line.rfind("  sizes", 0) == 0) {
+      inSizes = true;
+      continue;
+    }
+    vector<string> words;
+    stringstream fields(line);
+    for (string word; fields >> word;) {
+      words.emplace_back(word);
+    }
+    auto numbers = inSizes ? 2 : 5;
+    EXPECT_GT(words.size(), numbers) << line;
+    if (words.size() <= numbers)
+      continue;
+    auto name = words[0];
+    for (auto i = 1; i < words.size() - numbers; i++) {
+      name += " " + words[i];
+    }
+    auto number = [&](int i) { return stod(words[words.size() - numbers + i]); };
+    if (inSizes)
+      parsed.sizes[name] = {(int64_t)number(0), number(1)};
+    else
+      parsed.phases.try_emplace(name, PhaseRow{number(0), number(1), number(2), number(3)});
+  }
+  return parsed;
+}
+
+const string program = "square := (x) ->\n"
+                       "    x * x\n"
+                       "total := square(3) + square(4)\n"
+                       "if total > 20\n"
+                       "    println(total, \"total is 'total'\")\n";
+
+TEST(MemReport, TokensAndNodes) {
+  stringstream input(program);
+  auto tokens = performTokenization(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+  auto report = compileWithReport(program, 1);
+
+  ASSERT_EQ(report.sizes.count("tokens"), 1);
+  EXPECT_EQ(report.sizes["tokens"].first, tokens.size());
+  EXPECT_GT(report.sizes["tokens"].second, 0);
+  EXPECT_EQ(report.sizes["token text"].first, tokens.size());
+  EXPECT_GT(report.sizes["token text"].second, 0);
+
+  EXPECT_EQ(report.sizes["ast FuncExpr"].first, 1);
+  EXPECT_EQ(report.sizes["ast CallExpr"].first, 2);
+  EXPECT_EQ(report.sizes["ast IntExpr"].first, 3);
+  EXPECT_EQ(report.sizes["ast IfElseExpr"].first, 1);
+  EXPECT_EQ(report.sizes["ast PrintlnExpr"].first, 1);
+  for (auto& [name, size] : report.sizes) {
+    EXPECT_GT(size.first, 0) << name;
+    if (name.rfind("ast ", 0) == 0)
+      EXPECT_GT(size.second, 0) << name;
+  }
+  EXPECT_GT(report.sizes["llvm module bitcode"].second, 0);
+}
+
+TEST(MemReport, PhasesAddUp) {
+  auto report = compileWithReport(program, 1);
+  for (auto name : {"compile", "tokenize", "parse", "type check", "codegen", "verify"}) {
+    ASSERT_EQ(report.phases.count(name), 1) << name;
+  }
+  for (auto& [name, row] : report.phases) {
+    EXPECT_GE(row.allocated, 0) << name;
+    EXPECT_GE(row.freed, 0) << name;
+    EXPECT_NEAR(row.kept, row.allocated - row.freed, 0.15) << name; // printed with one decimal
+    EXPECT_GE(row.peak, 0) << name;
+  }
+  EXPECT_GT(report.phases["compile"].allocated, 0);
+  EXPECT_GT(report.phases["tokenize"].allocated, 0);
+  EXPECT_GT(report.phases["parse"].kept, 0); // the nodes live as long as the tree
+  EXPECT_GT(report.phases["codegen"].allocated, 0);
+  EXPECT_GT(report.phases["codegen"].freed, 0);
+}
+
+// the units are emitted on other threads, what they allocate still belongs to codegen
+TEST(MemReport, ParallelUnitsAreCounted) {
+  stringstream source;
+  for (auto i = 0; i < 200; i++) { // enough that the other threads get some of them
+    source << "f" << i << " := (a) ->\n    a * " << i + 1 << "\n";
+  }
+  for (auto i = 0; i < 200; i++) {
+    source << "println(f" << i << "(" << i << "))\n";
+  }
+  compileWithReport(source.str(), 1); // what LLVM sets up once doesn't count in the others
+  auto single = compileWithReport(source.str(), 1);
+  auto parallel = compileWithReport(source.str(), 4);
+
+  ASSERT_EQ(parallel.phases.count("codegen units"), 1);
+  ASSERT_EQ(parallel.phases.count("emit unit"), 1); // timed on the threads
+  EXPECT_GT(parallel.phases["codegen units"].allocated, 0);
+  EXPECT_GE(parallel.phases["codegen units"].kept, 0);
+  // the bitcode of the threads is freed on this one, without what they allocated codegen would free more than
+  // it allocated; the threads themselves and the phases of the units in the report are a few KB
+  EXPECT_GE(parallel.phases["codegen"].kept, 0);
+  EXPECT_LT(parallel.phases["codegen"].kept, single.phases["codegen"].kept + 256);
+}
+
+// the strings of the program are counted by the runtime, every join replaces the text before it
+TEST(MemReport, StringsAreFreed) {
+  setenv("DIPLOMA_HEAP_STATS", "1", 1);
+  CompileRequest request;
+  request.mode = "run";
+  request.optLevel = 2;
+  request.source = "line := 0\n"
+                   "while line < 100\n"
+                   "    text := \"line 'line':\"\n"
+                   "    i := 0\n"
+                   "    while i < 20\n"
+                   "        text = text + \" 'line + i'\"\n"
+                   "        i = i + 1\n"
+                   "    line = line + 1\n"
+                   "println(line)\n";
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  auto reply = compile(request, DIPLOMA_RUNTIME);
+  unsetenv("DIPLOMA_HEAP_STATS");
+  ASSERT_EQ(reply.status, 0) << reply.diagnostics;
+
+  long long allocations = 0, frees = 0, live = -1;
+  auto stats = reply.output.find("ref heap: ");
+  ASSERT_NE(stats, string::npos) << reply.output;
+  auto format = "ref heap: %lld allocations %*s %*s %*s %*s %lld frees, %*s %*s %lld bytes live";
+  ASSERT_EQ(sscanf(reply.output.c_str() + stats, format, &allocations, &frees, &live), 3) << reply.output;
+  EXPECT_GT(allocations, 1000); // most of the joins are too long to be inline
+  EXPECT_EQ(frees, allocations);
+  EXPECT_EQ(live, 0);
+}
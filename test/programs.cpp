@@ -0,0 +1,152 @@
+#include "server.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <llvm/Support/TargetSelect.h>
+#include <sstream>
+#include <string>
+
+using namespace std;
+using namespace Diploma;
+using namespace testing;
+
+struct RunResult {
+  string printed; // without the heap line
+  int64_t allocations = -1, frees = -1, live = -1;
+};
+
+// runs the program like 'diploma-client --run' does; the runtime prints its heap stats to stderr at exit,
+// which comes back in the output too, maybe before what the program printed since stdout is a pipe
+RunResult run(string source, int optLevel) {
+  setenv("DIPLOMA_HEAP_STATS", "1", 1);
+  CompileRequest request;
+  request.mode = "run";
+  request.optLevel = optLevel;
+  request.source = source;
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  auto reply = compile(request, DIPLOMA_RUNTIME);
+  EXPECT_EQ(reply.status, 0) << reply.diagnostics;
+
+  RunResult result;
+  stringstream lines(reply.output);
+  for (string line; getline(lines, line);) {
+    long long allocations, frees, live;
+    auto format = "ref heap: %lld allocations %*s %*s %*s %*s %lld frees, %*s %*s %lld bytes live";
+    if (sscanf(line.c_str(), format, &allocations, &frees, &live) == 3) {
+      result.allocations = allocations;
+      result.frees = frees;
+      result.live = live;
+    } else {
+      result.printed += line + "\n";
+    }
+  }
+  return result;
+}
+
+// every string that is replaced or goes out of scope is freed by the time the program ends
+void expectAllFreed(const RunResult& result) {
+  ASSERT_GE(result.allocations, 0) << "no heap stats, nothing was allocated";
+  EXPECT_EQ(result.frees, result.allocations);
+  EXPECT_EQ(result.live, 0);
+}
+
+TEST(Programs, LongStringsAreReassignedAndLeaveTheirScope) {
+  auto source = "describe := (n) ->\n"
+                "    text := \"a string too long to be kept inline\"\n"
+                "    i := 0\n"
+                "    while i < n\n"
+                "        text = text + \", 'i'\"\n"
+                "        i = i + 1\n"
+                "    text\n"
+                "kept := \"\"\n"
+                "round := 0\n"
+                "while round < 3\n"
+                "    line := describe(round)\n"
+                "    println(line)\n"
+                "    kept = line\n"
+                "    round = round + 1\n"
+                "println(kept == describe(2))\n";
+  for (auto optLevel : {0, 2}) {
+    auto result = run(source, optLevel);
+    EXPECT_EQ(result.printed, "a string too long to be kept inline\n"
+                              "a string too long to be kept inline, 0\n"
+                              "a string too long to be kept inline, 0, 1\n"
+                              "1\n")
+      << "-O" << optLevel;
+    expectAllFreed(result);
+  }
+}
+
+// the map has no iteration yet, the keys that were put are walked again
+TEST(Programs, MapWithStrKeys) {
+  auto source = "counts := {\"the first key of the map\": 0}\n"
+                "i := 0\n"
+                "while i < 20\n"
+                "    counts.put(\"key number 'i' of the map\", i * i)\n"
+                "    i = i + 1\n"
+                "println(counts.size())\n"
+                "println(counts.get(\"key number 7 of the map\"))\n"
+                "i = 0\n"
+                "while i < 20\n"
+                "    if i / 2 * 2 == i\n"
+                "        counts.remove(\"key number 'i' of the map\")\n"
+                "    i = i + 1\n"
+                "println(counts.size())\n"
+                "sum := 0\n"
+                "i = 0\n"
+                "while i < 20\n"
+                "    if counts.has(\"key number 'i' of the map\")\n"
+                "        sum = sum + counts.get(\"key number 'i' of the map\")\n"
+                "    i = i + 1\n"
+                "println(sum)\n"
+                "println(counts.remove(\"key number 4 of the map\"))\n";
+  for (auto optLevel : {0, 2}) {
+    auto result = run(source, optLevel);
+    EXPECT_EQ(result.printed, "21\n49\n11\n1330\n0\n") << "-O" << optLevel;
+    expectAllFreed(result);
+  }
+}
+
+// there is no break, the generator leaves its loop at the first square over the limit
+TEST(Programs, GeneratorStopsEarly) {
+  auto source = "squaresBelow := (limit) ->\n"
+                "    i := 1\n"
+                "    while i < 100 and i * i < limit\n"
+                "        yield \"the square of 'i' is 'i * i'\"\n"
+                "        i = i + 1\n"
+                "count := 0\n"
+                "for line of squaresBelow(30)\n"
+                "    println(line)\n"
+                "    count = count + 1\n"
+                "println(count)\n";
+  for (auto optLevel : {0, 2}) {
+    auto result = run(source, optLevel);
+    EXPECT_EQ(result.printed, "the square of 1 is 1\n"
+                              "the square of 2 is 4\n"
+                              "the square of 3 is 9\n"
+                              "the square of 4 is 16\n"
+                              "the square of 5 is 25\n"
+                              "5\n")
+      << "-O" << optLevel;
+    expectAllFreed(result);
+  }
+}
+
+TEST(Programs, MemoRecursion) {
+  setenv("DIPLOMA_MEMO_STATS", "1", 1);
+  auto source = "memo fib := (n) ->\n"
+                "    if n < 2\n"
+                "        n\n"
+                "    else\n"
+                "        fib(n - 1) + fib(n - 2)\n"
+                "println(fib(40))\n"
+                "println(fib(10))\n";
+  for (auto optLevel : {0, 2}) {
+    auto result = run(source, optLevel);
+    // every n from 0 to 40 is computed once, fib(10) is a hit
+    EXPECT_NE(result.printed.find("102334155\n55\n"), string::npos) << result.printed;
+    EXPECT_NE(result.printed.find(" 41 misses"), string::npos) << result.printed;
+  }
+  unsetenv("DIPLOMA_MEMO_STATS");
+}